@@ -0,0 +1,8 @@
+#ifndef BENCH_FILELIST_H
+#define BENCH_FILELIST_H
+
+/* This generated file contains includes for project dependencies */
+#include "bench-filelist/bake_config.h"
+
+#endif
+
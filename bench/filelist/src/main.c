@@ -0,0 +1,233 @@
+#include <bench_filelist.h>
+
+/* The benchmark is linked with the filelist implementation of bake itself */
+#include "../../../src/filelist.c"
+
+/* Measures the filelist operations that bake does for every project, over a
+ * generated project with a large number of sources and one target per source:
+ * matching the sources with a pattern, merging lists, iterating, freeing, and
+ * the check of a pattern rule that decides whether targets are out of date.
+ *
+ * The staleness check is measured both as an n-to-n comparison of inputs and
+ * targets, which is what pattern rules did before, and as the comparison of
+ * the newest input with the oldest target, which is what they do now.
+ *
+ * Usage: bench_filelist [sources] [runs] */
+
+ut_tls BAKE_FILELIST_KEY;
+
+static
+double bench_now(void)
+{
+    struct timespec t;
+    timespec_gettime(&t);
+    return timespec_toDouble(t);
+}
+
+/* Create files in directories of 100 files */
+static
+int16_t bench_create_files(
+    const char *root,
+    const char *dir,
+    const char *ext,
+    int count)
+{
+    int i;
+
+    for (i = 0; i < count; i ++) {
+        char *file;
+        int err = 0;
+
+        if (!(i % 100)) {
+            char *path = ut_asprintf("%s/%s/d%d", root, dir, i / 100);
+            err = ut_mkdir(path);
+            free(path);
+        }
+
+        file = ut_asprintf("%s/%s/d%d/f%d.%s", root, dir, i / 100, i, ext);
+        if (!err) {
+            err = ut_touch(file);
+        }
+        free(file);
+
+        if (err) {
+            ut_throw("failed to create files in '%s/%s'", root, dir);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Create a project with sources in src and a target per source in obj */
+static
+int16_t bench_create_project(
+    const char *root,
+    int sources)
+{
+    ut_try (bench_create_files(root, "src", "c", sources), NULL);
+
+    /* Make sure targets are newer than sources */
+    sleep(1);
+
+    ut_try (bench_create_files(root, "obj", "o", sources), NULL);
+
+    return 0;
+error:
+    return -1;
+}
+
+/* Compare every input with every target */
+static
+bool bench_stale_all_pairs(
+    bake_filelist *inputs,
+    bake_filelist *targets)
+{
+    bool build = false;
+
+    ut_iter src_iter = bake_filelist_iter(inputs);
+    while (!build && ut_iter_hasNext(&src_iter)) {
+        bake_file *src = ut_iter_next(&src_iter);
+
+        ut_iter dst_iter = bake_filelist_iter(targets);
+        while (!build && ut_iter_hasNext(&dst_iter)) {
+            bake_file *dst = ut_iter_next(&dst_iter);
+            if (!src->timestamp || src->timestamp > dst->timestamp) {
+                build = true;
+            }
+        }
+    }
+
+    return build;
+}
+
+/* Compare the newest input with the oldest target */
+static
+bool bench_stale_newest_oldest(
+    bake_filelist *inputs,
+    bake_filelist *targets)
+{
+    uint64_t newest = 0, oldest = UINT64_MAX;
+
+    ut_iter it = bake_filelist_iter(inputs);
+    while (ut_iter_hasNext(&it)) {
+        bake_file *src = ut_iter_next(&it);
+        if (!src->timestamp) {
+            return true;
+        }
+        if (src->timestamp > newest) {
+            newest = src->timestamp;
+        }
+    }
+
+    it = bake_filelist_iter(targets);
+    while (ut_iter_hasNext(&it)) {
+        bake_file *dst = ut_iter_next(&it);
+        if (dst->timestamp < oldest) {
+            oldest = dst->timestamp;
+        }
+    }
+
+    return newest > oldest;
+}
+
+int main(int argc, char *argv[]) {
+    int sources = argc > 1 ? atoi(argv[1]) : 10000;
+    int runs = argc > 2 ? atoi(argv[2]) : 20;
+    double t_pattern = 0, t_merge = 0, t_iter = 0, t_free = 0;
+    double t_all_pairs = 0, t_newest_oldest = 0;
+    const char *tmp = getenv("TMPDIR");
+    char *root;
+    int r, count = 0;
+
+    ut_init(argv[0]);
+    ut_tls_new(&BAKE_FILELIST_KEY, NULL);
+
+    if (!tmp) {
+        tmp = "/tmp";
+    }
+
+    root = ut_asprintf("%s/bench_filelist_%d", tmp, getpid());
+    if (bench_create_project(root, sources)) {
+        ut_raise();
+        ut_rmtree(root);
+        return -1;
+    }
+
+    for (r = 0; r < runs; r ++) {
+        bake_filelist *inputs, *targets, *merged;
+        double t_start, t_stop;
+        ut_iter it;
+        int i;
+
+        t_start = bench_now();
+        inputs = bake_filelist_new(root, NULL);
+        bake_filelist_add_pattern(inputs, "src", "//*.c");
+        t_stop = bench_now();
+        t_pattern += t_stop - t_start;
+
+        targets = bake_filelist_new(root, NULL);
+        bake_filelist_add_pattern(targets, "obj", "//*.o");
+
+        t_start = bench_now();
+        merged = bake_filelist_new(root, NULL);
+        for (i = 0; i < 5; i ++) {
+            bake_filelist_merge(merged, inputs);
+        }
+        t_stop = bench_now();
+        t_merge += t_stop - t_start;
+
+        t_start = bench_now();
+        it = bake_filelist_iter(merged);
+        while (ut_iter_hasNext(&it)) {
+            bake_file *file = ut_iter_next(&it);
+            if (file->timestamp) {
+                count ++;
+            }
+        }
+        t_stop = bench_now();
+        t_iter += t_stop - t_start;
+
+        t_start = bench_now();
+        if (bench_stale_newest_oldest(inputs, targets)) {
+            ut_error("targets are out of date");
+        }
+        t_stop = bench_now();
+        t_newest_oldest += t_stop - t_start;
+
+        /* The n-to-n comparison takes seconds, measure it once */
+        if (!r) {
+            t_start = bench_now();
+            if (bench_stale_all_pairs(inputs, targets)) {
+                ut_error("targets are out of date");
+            }
+            t_stop = bench_now();
+            t_all_pairs = t_stop - t_start;
+        }
+
+        t_start = bench_now();
+        bake_filelist_free(merged);
+        bake_filelist_free(inputs);
+        t_stop = bench_now();
+        t_free += t_stop - t_start;
+
+        bake_filelist_free(targets);
+    }
+
+    printf("%d sources, average of %d runs (%d files in merged list)\n\n",
+        sources, runs, count / runs);
+    printf("add_pattern                %10.2f ms\n", t_pattern * 1000 / runs);
+    printf("merge 5x into one list     %10.2f ms\n", t_merge * 1000 / runs);
+    printf("iterate merged list        %10.2f ms\n", t_iter * 1000 / runs);
+    printf("free                       %10.2f ms\n", t_free * 1000 / runs);
+    printf("staleness, all pairs       %10.2f ms (1 run)\n", t_all_pairs * 1000);
+    printf("staleness, newest/oldest   %10.2f ms\n",
+        t_newest_oldest * 1000 / runs);
+
+    ut_rmtree(root);
+    free(root);
+
+    ut_deinit();
+
+    return 0;
+}
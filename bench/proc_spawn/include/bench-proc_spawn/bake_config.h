@@ -0,0 +1,26 @@
+/*
+                                   )
+                                  (.)
+                                  .|.
+                                  | |
+                              _.--| |--._
+                           .-';  ;`-'& ; `&.
+                          \   &  ;    &   &_/
+                           |"""---...---"""|
+                           \ | | | | | | | /
+                            `---.|.|.|.---'
+
+ * This file is generated by bake.lang.c for your convenience. Headers of
+ * dependencies will automatically show up in this file. Include bake_config.h
+ * in your main project file. Do not edit! */
+
+#ifndef BENCH_PROC_SPAWN_BAKE_CONFIG_H
+#define BENCH_PROC_SPAWN_BAKE_CONFIG_H
+
+/* Headers of public dependencies */
+#ifdef __BAKE__
+#include <bake_util.h>
+#endif
+
+#endif
+
@@ -0,0 +1,8 @@
+#ifndef BENCH_PROC_SPAWN_H
+#define BENCH_PROC_SPAWN_H
+
+/* This generated file contains includes for project dependencies */
+#include "bench-proc_spawn/bake_config.h"
+
+#endif
+
@@ -0,0 +1,147 @@
+#include <bench_proc_spawn.h>
+
+/* Measures how many processes per second ut_proc_run and ut_proc_runRedirect
+ * start, compared with fork + execvp, which they used before they used
+ * posix_spawn. The cost of fork grows with the memory of the parent, so each
+ * measurement is repeated with a heap of increasing size.
+ *
+ * Usage: bench_proc_spawn [spawns] [heap size in MB]... */
+
+static const char *true_argv[] = {"true", NULL};
+
+static
+double bench_now(void)
+{
+    struct timespec t;
+    timespec_gettime(&t);
+    return timespec_toDouble(t);
+}
+
+static
+void bench_wait(
+    pid_t pid)
+{
+    int status;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR) { }
+}
+
+/* Start process like ut_proc_run did before it used posix_spawn */
+static
+void bench_fork_exec(
+    bool redirect)
+{
+    pid_t pid = fork();
+    if (!pid) {
+        char arg0[] = "true";
+        char *exec_argv[] = {arg0, NULL};
+        if (redirect) {
+            int fd = open("/dev/null", O_RDWR);
+            dup2(fd, 0);
+            dup2(fd, 1);
+            dup2(fd, 2);
+            close(fd);
+        }
+        execvp(exec_argv[0], exec_argv);
+        _exit(127);
+    } else if (pid > 0) {
+        bench_wait(pid);
+    }
+}
+
+static
+void bench_spawn(
+    bool redirect,
+    FILE *devnull)
+{
+    ut_proc pid;
+    if (redirect) {
+        pid = ut_proc_runRedirect(
+            true_argv[0], true_argv, devnull, devnull, devnull);
+    } else {
+        pid = ut_proc_run(true_argv[0], true_argv);
+    }
+
+    if (pid) {
+        int8_t rc;
+        ut_proc_wait(pid, &rc);
+    }
+}
+
+/* Returns processes started per second */
+static
+double bench_run(
+    int spawns,
+    bool fork_exec,
+    bool redirect,
+    FILE *devnull)
+{
+    double start = bench_now();
+    int i;
+
+    for (i = 0; i < spawns; i ++) {
+        if (fork_exec) {
+            bench_fork_exec(redirect);
+        } else {
+            bench_spawn(redirect, devnull);
+        }
+    }
+
+    return spawns / (bench_now() - start);
+}
+
+int main(int argc, char *argv[]) {
+    int spawns = argc > 1 ? atoi(argv[1]) : 2000;
+    int default_heaps[] = {0, 256, 1024}, *heaps = default_heaps;
+    int i, heap_count = 3;
+    FILE *devnull;
+
+    if (argc > 2) {
+        heap_count = argc - 2;
+        heaps = ut_calloc(sizeof(int) * (size_t)heap_count);
+        for (i = 0; i < heap_count; i ++) {
+            heaps[i] = atoi(argv[i + 2]);
+        }
+    }
+
+    ut_init(argv[0]);
+
+    devnull = fopen("/dev/null", "r+");
+    if (!devnull) {
+        ut_error("cannot open /dev/null: %s", strerror(errno));
+        return -1;
+    }
+
+    printf("%d spawns of '%s', processes per second\n\n", spawns, true_argv[0]);
+    printf("heap       fork+execvp   ut_proc_run   "
+           "fork+execvp   ut_proc_runRedirect\n");
+    printf("                                       "
+           "(redirect)\n");
+
+    for (i = 0; i < heap_count; i ++) {
+        size_t size = (size_t)heaps[i] * 1024 * 1024;
+        char *heap = NULL;
+        if (size) {
+            /* Touch the heap, so that its pages are mapped */
+            heap = malloc(size);
+            memset(heap, 1, size);
+        }
+
+        printf("%4d MB  %11.0f/s %11.0f/s %11.0f/s %11.0f/s\n", heaps[i],
+            bench_run(spawns, true, false, devnull),
+            bench_run(spawns, false, false, devnull),
+            bench_run(spawns, true, true, devnull),
+            bench_run(spawns, false, true, devnull));
+
+        free(heap);
+    }
+
+    fclose(devnull);
+
+    if (heaps != default_heaps) {
+        free(heaps);
+    }
+
+    ut_deinit();
+
+    return 0;
+}
@@ -52,17 +52,23 @@ all: prebuild prelink $(TARGET) $(OBJDIR)
 
 BAKE_SOURCE= ..\src\attribute.c \
 			..\src\build.c \
+			..\src\cache.c \
+			..\src\build_state.c \
 			..\src\bundle.c \
 			..\src\config.c \
 			..\src\crawler.c \
+			..\src\crawl_cache.c \
 			..\src\driver.c \
 			..\src\filelist.c \
 			..\src\git.c \
 			..\src\install.c \
+			..\src\jobs.c \
 			..\src\json_utils.c \
 			..\src\main.c \
 			..\src\project.c \
 			..\src\rule.c \
+			..\src\server.c \
+			..\src\trace.c \
 			..\src\run.c \
 			..\src\setup.c \
 
@@ -77,6 +83,7 @@ UTIL_SOURCE= ..\util\src\win\dl.c \
 			..\util\src\expr.c \
 			..\util\src\file.c \
 			..\util\src\fs.c \
+			..\util\src\hash.c \
 			..\util\src\iter.c \
 			..\util\src\jsw_rbtree.c \
 			..\util\src\ll.c \
@@ -88,11 +95,13 @@ UTIL_SOURCE= ..\util\src\win\dl.c \
 			..\util\src\path.c \
 			..\util\src\proc_common.c \
 			..\util\src\rb.c \
+			..\util\src\stat.c \
 			..\util\src\strbuf.c \
 			..\util\src\string.c \
 			..\util\src\time.c \
 			..\util\src\util.c \
-			..\util\src\version.c
+			..\util\src\version.c \
+			..\util\src\watch.c
 
 CPP_SOURCE=$(BAKE_SOURCE) $(UTIL_SOURCE)
 
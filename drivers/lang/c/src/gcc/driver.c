@@ -23,6 +23,9 @@
 
 #include <bake.h>
 
+/* Length of object list above which objects are passed in a response file */
+#define GCC_RESPONSE_FILE_THRESHOLD (4096)
+
 static
 void gcc_add_includes(
     bake_driver_api *driver,
@@ -222,6 +225,79 @@ void gcc_add_std(
     }
 }
 
+/* Test whether link time optimization is used. Compiling and linking use the
+ * same test, so that objects are only compiled for LTO if the link uses LTO.
+ * LTO is not used for strict builds (it can hide warnings) and for builds with
+ * symbols. On some Linux versions clang has trouble loading the LTO plugin of
+ * the system linker, so there clang only uses LTO if ThinLTO is selected. */
+static
+bool gcc_use_lto(
+    bake_driver_api *driver,
+    bake_config *config,
+    bake_src_lang lang)
+{
+    const char *lto = driver->get_attr_string("lto");
+
+    if (!config->optimizations || config->strict || config->symbols) {
+        return false;
+    }
+
+    if (!strcmp(lto, "none")) {
+        return false;
+    }
+
+    if (is_clang(lang) && is_linux()) {
+        return !strcmp(lto, "thin");
+    }
+
+    return true;
+}
+
+/* Add flags for link time optimization. The "lto" attribute selects full LTO
+ * ("full"), ThinLTO ("thin") or no LTO ("none"). When gcc links, the LTO stage
+ * runs in parallel with -flto=auto. ThinLTO is only supported by clang, which
+ * stores the results in a cache in the project tmp directory, so that only
+ * modules that changed are optimized again. Other compilers use full LTO. */
+static
+void gcc_add_lto(
+    bake_driver_api *driver,
+    bake_project *project,
+    bake_src_lang lang,
+    ut_strbuf *cmd,
+    bool link)
+{
+    const char *lto = driver->get_attr_string("lto");
+
+    if (is_clang(lang)) {
+        if (strcmp(lto, "thin")) {
+            ut_strbuf_appendstr(cmd, " -flto");
+            return;
+        }
+
+        ut_strbuf_appendstr(cmd, " -flto=thin");
+
+        if (link) {
+            char *cache_dir = ut_asprintf("%s"UT_OS_PS"%s"UT_OS_PS"lto",
+                project->path, driver->get_attr_string("tmp-dir"));
+            const char *linker = driver->get_attr_string("linker");
+
+            if (is_darwin()) {
+                ut_strbuf_append(cmd, " -Wl,-cache_path_lto,%s", cache_dir);
+            } else if (!strcmp(linker, "lld")) {
+                ut_strbuf_append(cmd, " -Wl,--thinlto-cache-dir=%s", cache_dir);
+            } else {
+                ut_strbuf_append(cmd, " -Wl,-plugin-opt,cache-dir=%s", cache_dir);
+            }
+
+            free(cache_dir);
+        }
+    } else if (link && !is_emcc() && !is_icc()) {
+        ut_strbuf_appendstr(cmd, " -flto=auto");
+    } else {
+        ut_strbuf_appendstr(cmd, " -flto");
+    }
+}
+
 static
 void gcc_add_optimization(
     bake_driver_api *driver,
@@ -233,16 +309,10 @@ void gcc_add_optimization(
 {
     /* Enable full optimizations, including cross-file */
     if (config->optimizations) {
-        if ((!is_clang(lang) || !is_linux()) && !config->symbols) {
-            ut_strbuf_appendstr(cmd, " -O3");
+        ut_strbuf_appendstr(cmd, " -O3");
 
-            /* LTO can hide warnings */
-            if (!config->strict && !is_pch) {
-                ut_strbuf_appendstr(cmd, " -flto");
-            }
-        } else {
-            /* On some Linux versions clang has trouble loading the LTO plugin */
-            ut_strbuf_appendstr(cmd, " -O3");
+        if (!is_pch && gcc_use_lto(driver, config, lang)) {
+            gcc_add_lto(driver, project, lang, cmd, false);
         }
     } else {
         ut_strbuf_appendstr(cmd, " -O0");
@@ -350,19 +420,12 @@ void gcc_add_misc_link(
     gcc_add_sanitizers(config, cmd);
 }
 
-/* Compile source file */
+/* Get language of source file */
 static
-void gcc_compile_src(
-    bake_driver_api *driver,
-    bake_config *config,
-    bake_project *project,
-    char *source,
-    char *target)
+bake_src_lang gcc_src_lang(
+    const char *source)
 {
-    ut_strbuf cmd = UT_STRBUF_INIT;
     char *ext = strrchr(source, '.');
-    bool cpp = is_cpp(project);
-    bool file_has_different_language = false;
     bake_src_lang lang = BAKE_SRC_LANG_C;
 
     if (ext && strcmp(ext, ".c")) {
@@ -371,46 +434,562 @@ void gcc_compile_src(
         } else {
             lang = BAKE_SRC_LANG_CPP;
         }
+    }
+
+    return lang;
+}
+
+/* Get main header of project, which is precompiled if the project enables the
+ * precompile-header attribute. Returns NULL if there is nothing to precompile. */
+static
+char* gcc_pch_header(
+    bake_driver_api *driver,
+    bake_config *config,
+    bake_project *project)
+{
+    if (!driver->get_attr_bool("precompile-header") || config->assembly) {
+        return NULL;
+    }
+
+    char *header = ut_asprintf("%s"UT_OS_PS"include"UT_OS_PS"%s.h",
+        project->path, project->id_underscore);
+    if (ut_file_test(header) != 1) {
+        free(header);
+        return NULL;
+    }
+
+    return header;
+}
+
+/* Get directory with precompiled header. The directory is added to the include
+ * path before the project include directory, so that the compiler finds the
+ * precompiled header when a source includes the main project header. */
+static
+char* gcc_pch_dir(
+    bake_driver_api *driver,
+    bake_project *project)
+{
+    return ut_asprintf("%s"UT_OS_PS"%s"UT_OS_PS"pch",
+        project->path, driver->get_attr_string("obj-dir"));
+}
 
-        file_has_different_language = true;
+/* Get directory with precompiled header if it can be used by a source file of
+ * the specified language, or NULL if no precompiled header is available. */
+static
+char* gcc_pch_dir_for_lang(
+    bake_driver_api *driver,
+    bake_config *config,
+    bake_project *project,
+    bake_src_lang lang)
+{
+    bake_src_lang project_lang =
+        is_cpp(project) ? BAKE_SRC_LANG_CPP : BAKE_SRC_LANG_C;
+    if (lang != project_lang || config->assembly ||
+        !driver->get_attr_bool("precompile-header"))
+    {
+        return NULL;
+    }
+
+    char *pch_dir = gcc_pch_dir(driver, project);
+    char *gch = ut_asprintf("%s"UT_OS_PS"%s.h.gch",
+        pch_dir, project->id_underscore);
+    bool exists = ut_file_test(gch) == 1;
+    free(gch);
+
+    if (!exists) {
+        free(pch_dir);
+        return NULL;
     }
 
+    return pch_dir;
+}
+
+/* Add compiler, flags and include paths for compiling source file */
+static
+void gcc_add_compile_flags(
+    bake_driver_api *driver,
+    bake_config *config,
+    bake_project *project,
+    const char *source,
+    bake_src_lang lang,
+    bool is_pch,
+    ut_strbuf *cmd)
+{
     /* Test if the source file is from the project itself. If the project
      * imports (amalgamated) source files from other projects. */
     bool own_source = true;
-    char *relative_src = &source[strlen(project->path)];
+    const char *relative_src = &source[strlen(project->path)];
     if (!strncmp(relative_src, "deps"UT_OS_PS, 5)) {
         own_source = false;
     }
 
-    ut_strbuf_append(&cmd, "%s", cc(lang));
+    ut_strbuf_append(cmd, "%s", cc(lang));
 
     /* Add misc options */
-    gcc_add_misc(driver, config, project, lang, &cmd);
+    gcc_add_misc(driver, config, project, lang, cmd);
 
     /* Add optimization flags */
-    gcc_add_optimization(driver, config, project, lang, &cmd, false);
+    gcc_add_optimization(driver, config, project, lang, cmd, is_pch);
 
     /* Add c/c++ standard arguments */
-    gcc_add_std(driver, config, project, lang, &cmd, own_source, false);
+    gcc_add_std(driver, config, project, lang, cmd, own_source, is_pch);
 
     /* Add CFLAGS */
-    gcc_add_flags(driver, config, project, lang, &cmd);
+    gcc_add_flags(driver, config, project, lang, cmd);
+
+    /* Add precompiled header directory before other include directories */
+    if (!is_pch) {
+        char *pch_dir = gcc_pch_dir_for_lang(driver, config, project, lang);
+        if (pch_dir) {
+            ut_strbuf_append(cmd, " -Winvalid-pch -I %s", pch_dir);
+            free(pch_dir);
+        }
+    }
 
     /* Add include directories */
-    gcc_add_includes(driver, config, project, &cmd);
+    gcc_add_includes(driver, config, project, cmd);
+}
+
+/* Create command for compiling source file. The returned command is also used
+ * to detect whether objects need to be rebuilt because of changed settings. */
+static
+char* gcc_compile_cmd(
+    bake_driver_api *driver,
+    bake_config *config,
+    bake_project *project,
+    char *source,
+    char *target)
+{
+    ut_strbuf cmd = UT_STRBUF_INIT;
+
+    gcc_add_compile_flags(
+        driver, config, project, source, gcc_src_lang(source), false, &cmd);
 
     /* Add source file and object file */
     ut_strbuf_append(&cmd, " -c %s", source);
 
     if (!config->assembly) {
         ut_strbuf_append(&cmd, " -o %s", target);
+
+        /* Generate dependency file next to object, so bake can find out which
+         * objects need to be rebuilt when a header changes */
+        char *depfile = ut_strdup(target);
+        char *ext = strrchr(depfile, '.');
+        if (ext && !strchr(ext, '/')) {
+            *ext = '\0';
+        }
+        ut_strbuf_append(&cmd, " -MD -MF %s.d", depfile);
+        free(depfile);
     }
 
-    /* Execute command */
-    char *cmdstr = ut_strbuf_get(&cmd);
+    return ut_strbuf_get(&cmd);
+}
+
+/* Get dependencies from a dependency file (the part after the target) */
+static
+char* gcc_depfile_deps(
+    const char *depfile)
+{
+    if (ut_file_test(depfile) != 1) {
+        return NULL;
+    }
+
+    char *content = ut_file_load(depfile);
+    if (!content) {
+        ut_catch();
+        return NULL;
+    }
+
+    /* Target is terminated by ': ' (path may contain a ':') */
+    char *deps = strstr(content, ": ");
+    if (!deps) {
+        free(content);
+        return NULL;
+    }
+
+    char *result = ut_strdup(deps + 2);
+    free(content);
+    return result;
+}
+
+/* The dependency file of an object compiled with a precompiled header doesn't
+ * contain the headers in the precompiled header. Add the dependencies of the
+ * precompiled header, so the object is rebuilt when one of these changes. */
+static
+void gcc_pch_add_deps(
+    bake_project *project,
+    const char *pch_dir,
+    const char *target)
+{
+    char *pch_depfile = ut_asprintf("%s"UT_OS_PS"%s.h.d",
+        pch_dir, project->id_underscore);
+    char *deps = gcc_depfile_deps(pch_depfile);
+    free(pch_depfile);
+    if (!deps) {
+        return;
+    }
+
+    char *depfile = ut_strdup(target);
+    char *ext = strrchr(depfile, '.');
+    if (ext && !strchr(ext, '/')) {
+        *ext = '\0';
+    }
+    char *tmp = depfile;
+    depfile = ut_asprintf("%s.d", depfile);
+    free(tmp);
+
+    char *content = NULL;
+    if (ut_file_test(depfile) == 1 && (content = ut_file_load(depfile))) {
+        /* Strip trailing newline before appending dependencies */
+        size_t len = strlen(content);
+        while (len && isspace(content[len - 1])) {
+            content[-- len] = '\0';
+        }
+
+        FILE *f = fopen(depfile, "w");
+        if (f) {
+            fprintf(f, "%s \\\n %s", content, deps);
+            fclose(f);
+            ut_stat_invalidate(depfile);
+        }
+    } else {
+        ut_catch();
+    }
+
+    free(content);
+    free(depfile);
+    free(deps);
+}
+
+/* Compute key of precompiled header from the compiler command and the content
+ * of the header and all files it includes, as listed in the dependency file.
+ * Returns -1 if the dependency file is missing or a file could not be read. */
+static
+int16_t gcc_pch_key(
+    const char *cmd,
+    const char *depfile,
+    uint64_t *key_out)
+{
+    char *deps = gcc_depfile_deps(depfile);
+    if (!deps) {
+        return -1;
+    }
+
+    uint64_t key = ut_hash_str(cmd, UT_HASH_INIT);
+    char *ptr = deps, *dep = deps, ch;
+    int16_t result = 0;
+
+    do {
+        ch = *ptr;
+        if (!ch || isspace(ch) || (ch == '\\' && isspace(ptr[1]))) {
+            *ptr = '\0';
+            if (dep[0]) {
+                uint64_t file_hash;
+                if (ut_file_hash(dep, &file_hash)) {
+                    ut_catch();
+                    result = -1;
+                    break;
+                }
+                key = ut_hash_str(dep, key);
+                key = ut_hash(&file_hash, sizeof(file_hash), key);
+            }
+            dep = ptr + 1;
+        }
+        ptr ++;
+    } while (ch);
+
+    free(deps);
+    *key_out = key;
+    return result;
+}
+
+/* Precompile the main project header, which includes bake_config.h and with
+ * that the headers of project dependencies. The header is only compiled again
+ * when the compiler command or one of the files it includes changed. */
+static
+void gcc_precompile_header(
+    bake_driver_api *driver,
+    bake_config *config,
+    bake_project *project)
+{
+    char *header = gcc_pch_header(driver, config, project);
+    if (!header) {
+        return;
+    }
+
+    ut_strbuf cmd_buf = UT_STRBUF_INIT;
+    bool cpp = is_cpp(project);
+    bake_src_lang lang = cpp ? BAKE_SRC_LANG_CPP : BAKE_SRC_LANG_C;
+    char *pch_dir = gcc_pch_dir(driver, project);
+    char *gch = ut_asprintf("%s"UT_OS_PS"%s.h.gch",
+        pch_dir, project->id_underscore);
+    char *depfile = ut_asprintf("%s"UT_OS_PS"%s.h.d",
+        pch_dir, project->id_underscore);
+    char *keyfile = ut_asprintf("%s"UT_OS_PS"%s.h.key",
+        pch_dir, project->id_underscore);
+    char key_str[18];
+    uint64_t key;
+
+    gcc_add_compile_flags(driver, config, project, header, lang, true, &cmd_buf);
+    ut_strbuf_append(&cmd_buf, " -x %s %s -o %s -MD -MF %s",
+        cpp ? "c++-header" : "c-header", header, gch, depfile);
+    char *cmd = ut_strbuf_get(&cmd_buf);
+
+    /* If the header could not be precompiled before, only try again when the
+     * command or header changed. */
+    uint64_t header_hash = 0;
+    if (ut_file_hash(header, &header_hash)) {
+        ut_catch();
+    }
+    uint64_t failed_key = ut_hash(
+        &header_hash, sizeof(header_hash), ut_hash_str(cmd, UT_HASH_INIT));
+
+    if (ut_file_test(keyfile) == 1) {
+        char *stored = ut_file_load(keyfile);
+        bool up_to_date = false;
+        if (stored && stored[0] == '!') {
+            sprintf(key_str, "%016" PRIx64, failed_key);
+            up_to_date = !strcmp(&stored[1], key_str);
+        } else if (stored && ut_file_test(gch) == 1 &&
+            !gcc_pch_key(cmd, depfile, &key))
+        {
+            sprintf(key_str, "%016" PRIx64, key);
+            up_to_date = !strcmp(stored, key_str);
+        }
+        free(stored);
+        if (up_to_date) {
+            ut_trace("#[grey]precompiled header for %s is up to date", header);
+            goto done;
+        }
+    }
+
+    /* Remove key first, so an interrupted build doesn't use a stale header */
+    ut_mkdir(pch_dir);
+    ut_rm(keyfile);
+
+    ut_trace("precompile header %s", header);
+
+    /* The precompiled header is an optimization, so if the header can't be
+     * compiled by itself the project is built without it. Any real errors in
+     * the header are reported when compiling the sources that include it. */
+    int8_t rc = 0;
+    char *envcmd = ut_envparse("%s", cmd);
+    if (envcmd && !ut_proc_cmd_redirect(envcmd, &rc, NULL, NULL) && !rc &&
+        !gcc_pch_key(cmd, depfile, &key))
+    {
+        sprintf(key_str, "%016" PRIx64, key);
+    } else {
+        ut_catch();
+        ut_trace("cannot precompile %s, building without it", header);
+        ut_rm(gch);
+        sprintf(key_str, "!%016" PRIx64, failed_key);
+    }
+    free(envcmd);
+
+    FILE *f = fopen(keyfile, "w");
+    if (f) {
+        fprintf(f, "%s", key_str);
+        fclose(f);
+        ut_stat_invalidate(keyfile);
+    }
+
+done:
+    free(cmd);
+    free(keyfile);
+    free(depfile);
+    free(gch);
+    free(pch_dir);
+    free(header);
+}
+
+/* Hashes of compiler versions, so that each compiler is only invoked once */
+static ut_rb gcc_compiler_hashes;
+static struct ut_mutex_s gcc_compiler_hashes_lock;
+
+/* Linkers that have been tested with a compiler (also uses the lock) */
+static ut_rb gcc_linkers;
+
+static
+int gcc_compiler_compare(
+    void *ctx,
+    const void* key1,
+    const void* key2)
+{
+    return strcmp(key1, key2);
+}
+
+/* Get hash of the version information of a compiler, so that objects in the
+ * cache are not used after the compiler is upgraded. */
+static
+uint64_t gcc_compiler_hash(
+    const char *compiler)
+{
+    uint64_t *result;
+
+    ut_mutex_lock(&gcc_compiler_hashes_lock);
+    if (!(result = ut_rb_find(gcc_compiler_hashes, compiler))) {
+        result = malloc(sizeof(uint64_t));
+        *result = ut_hash_str(compiler, UT_HASH_INIT);
+
+        FILE *f = tmpfile();
+        char *cmd = ut_asprintf("%s --version", compiler);
+        int8_t rc = 0;
+        if (f && !ut_proc_cmd_redirect(cmd, &rc, f, f) && !rc) {
+            char buffer[1024];
+            size_t read;
+            rewind(f);
+            while ((read = fread(buffer, 1, sizeof(buffer), f))) {
+                *result = ut_hash(buffer, read, *result);
+            }
+        } else {
+            ut_catch();
+        }
+        free(cmd);
+        if (f) {
+            fclose(f);
+        }
+
+        ut_rb_set(gcc_compiler_hashes, ut_strdup(compiler), result);
+    }
+    ut_mutex_unlock(&gcc_compiler_hashes_lock);
+
+    return *result;
+}
+
+/* Test whether a compiler can use a linker. The result is stored, so that the
+ * linker is only tested once for each compiler. */
+static
+bool gcc_linker_test(
+    const char *compiler,
+    const char *linker)
+{
+    char *key = ut_asprintf("%s -fuse-ld=%s", compiler, linker);
+    bool *result;
+
+    ut_mutex_lock(&gcc_compiler_hashes_lock);
+    if (!(result = ut_rb_find(gcc_linkers, key))) {
+        result = malloc(sizeof(bool));
+
+        FILE *f = tmpfile();
+        char *cmd = ut_asprintf("%s -Wl,--version", key);
+        int8_t rc = 0;
+        *result = f && !ut_proc_cmd_redirect(cmd, &rc, f, f) && !rc;
+        if (!*result) {
+            ut_catch();
+        }
+        free(cmd);
+        if (f) {
+            fclose(f);
+        }
+
+        ut_rb_set(gcc_linkers, key, result);
+    } else {
+        free(key);
+    }
+    ut_mutex_unlock(&gcc_compiler_hashes_lock);
+
+    return *result;
+}
+
+/* Compute key for the object cache from the compiler version, the compiler
+ * flags and the preprocessed source. Preprocessing also (re)generates the
+ * dependency file of the object. Returns 0 if the source could not be
+ * preprocessed, in which case the regular compile reports the errors. */
+static
+uint64_t gcc_cache_key(
+    bake_driver_api *driver,
+    bake_config *config,
+    bake_project *project,
+    char *source,
+    char *target)
+{
+    ut_strbuf flags_buf = UT_STRBUF_INIT;
+    uint64_t result = 0, src_hash;
+    int8_t rc = 0;
+
+    bake_src_lang lang = gcc_src_lang(source);
+    gcc_add_compile_flags(
+        driver, config, project, source, lang, false, &flags_buf);
+    char *flags = ut_strbuf_get(&flags_buf);
+
+    char *base = ut_strdup(target);
+    char *ext = strrchr(base, '.');
+    if (ext && !strchr(ext, '/')) {
+        *ext = '\0';
+    }
+
+    char *preprocessed = ut_asprintf("%s.i", base);
+    char *cmd = ut_envparse("%s -E %s -o %s -MD -MF %s.d -MT %s",
+        flags, source, preprocessed, base, target);
+
+    if (cmd && !ut_proc_cmd_redirect(cmd, &rc, NULL, NULL) && !rc &&
+        !ut_file_hash(preprocessed, &src_hash))
+    {
+        result = gcc_compiler_hash(cc(lang));
+        result = ut_hash_str(flags, result);
+
+        /* Debug information contains the working directory */
+        if (config->symbols) {
+            result = ut_hash_str(ut_cwd(), result);
+        }
+
+        result = ut_hash(&src_hash, sizeof(src_hash), result);
+        if (!result) {
+            result = 1;
+        }
+    } else {
+        ut_catch();
+    }
+
+    ut_rm(preprocessed);
+    free(preprocessed);
+    free(cmd);
+    free(base);
+    free(flags);
+
+    return result;
+}
+
+/* Compile source file */
+static
+void gcc_compile_src(
+    bake_driver_api *driver,
+    bake_config *config,
+    bake_project *project,
+    char *source,
+    char *target)
+{
+    uint64_t key = 0;
+
+    /* Coverage, profiling & loop analysis produce output besides the object,
+     * which can't be restored from the cache */
+    if (config->cache && !config->assembly && !config->coverage &&
+        !config->profile_build && !config->loop_test)
+    {
+        key = gcc_cache_key(driver, config, project, source, target);
+        if (key && driver->cache_get(key, target)) {
+            ut_trace("#[grey]use cached object for %s", source);
+            return;
+        }
+
+        /* Remove old object, so it can't be stored if the compile fails */
+        ut_rm(target);
+    }
+
+    char *cmdstr = gcc_compile_cmd(driver, config, project, source, target);
     driver->exec(cmdstr);
     free(cmdstr);
+
+    char *pch_dir = gcc_pch_dir_for_lang(
+        driver, config, project, gcc_src_lang(source));
+    if (pch_dir) {
+        gcc_pch_add_deps(project, pch_dir, target);
+        free(pch_dir);
+    }
+
+    if (key && ut_file_test(target) == 1) {
+        driver->cache_put(key, target);
+    }
 }
 
 /* A better mechanism is needed to abstract away from the difference between
@@ -474,6 +1053,127 @@ char* gcc_find_static_lib(
     return NULL;
 }
 
+/* Unpack objects of a static library to a directory and add them to the link
+ * command. Objects are extracted one at a time with 'ar p', as running 'ar x'
+ * requires changing the working directory, which is shared with projects that
+ * are built in parallel. */
+static
+int16_t gcc_unpack_static_lib(
+    const char *static_lib,
+    const char *obj_path,
+    ut_strbuf *cmd)
+{
+    char line[PATH_MAX];
+    int8_t rc = 0;
+    int sig;
+
+    FILE *members = tmpfile();
+    if (!members) {
+        ut_throw("failed to create temporary file");
+        goto error;
+    }
+
+    char *list_cmd = ut_asprintf("ar t %s", static_lib);
+    sig = ut_proc_cmd_redirect(list_cmd, &rc, members, stderr);
+    free(list_cmd);
+    if (sig || rc) {
+        ut_throw("failed to list objects in '%s'", static_lib);
+        goto error;
+    }
+
+    ut_try (ut_mkdir(obj_path), NULL);
+
+    rewind(members);
+    while (fgets(line, sizeof(line), members)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (!line[0]) {
+            continue;
+        }
+
+        char *obj = ut_asprintf("%s/%s", obj_path, line);
+        FILE *out = fopen(obj, "wb");
+        if (!out) {
+            ut_throw("cannot open '%s'", obj);
+            free(obj);
+            goto error;
+        }
+
+        char *extract_cmd = ut_asprintf("ar p %s %s", static_lib, line);
+        sig = ut_proc_cmd_redirect(extract_cmd, &rc, out, stderr);
+        free(extract_cmd);
+        fclose(out);
+        if (sig || rc) {
+            ut_throw("failed to extract '%s' from '%s'", line, static_lib);
+            free(obj);
+            goto error;
+        }
+
+        ut_strbuf_append(cmd, " %s", obj);
+        free(obj);
+    }
+
+    fclose(members);
+    return 0;
+error:
+    if (members) {
+        fclose(members);
+    }
+    return -1;
+}
+
+/* Write arguments to a response file if they are too long to pass on the
+ * command line. Returns "@<file>" if a response file is written, or NULL if
+ * the arguments should be passed as-is. */
+static
+char* gcc_response_file(
+    bake_driver_api *driver,
+    bake_project *project,
+    const char *args)
+{
+    if (strlen(args) < GCC_RESPONSE_FILE_THRESHOLD) {
+        return NULL;
+    }
+
+    char *file = ut_asprintf("%s"UT_OS_PS"%s"UT_OS_PS"link.rsp",
+        project->path, driver->get_attr_string("tmp-dir"));
+    char *result = NULL;
+    const char *ptr;
+
+    FILE *f = fopen(file, "w");
+    if (!f) {
+        ut_throw("cannot open '%s' (%s)", file, strerror(errno));
+        ut_raise();
+        free(file);
+        return NULL;
+    }
+
+    /* One argument per line. Backslashes are escaped, since gcc interprets
+     * them in response files. */
+    for (ptr = args; *ptr; ptr ++) {
+        if (*ptr == ' ') {
+            if (ptr[1] && ptr[1] != ' ' && ptr != args) {
+                fputc('\n', f);
+            }
+        } else if (*ptr == '\\') {
+            fputs("\\\\", f);
+        } else {
+            fputc(*ptr, f);
+        }
+    }
+    fputc('\n', f);
+
+    if (fclose(f)) {
+        ut_throw("failed to write '%s' (%s)", file, strerror(errno));
+        ut_raise();
+    } else {
+        result = ut_asprintf("@%s", file);
+    }
+
+    free(file);
+
+    return result;
+}
+
 /* Link a binary */
 static
 void gcc_link_dynamic_binary(
@@ -484,6 +1184,7 @@ void gcc_link_dynamic_binary(
     char *target)
 {
     ut_strbuf cmd = UT_STRBUF_INIT;
+    ut_strbuf objects = UT_STRBUF_INIT;
     bool hide_symbols = false;
     ut_ll static_object_paths = NULL;
 
@@ -519,11 +1220,23 @@ void gcc_link_dynamic_binary(
         cpp,
         &cmd);
 
+    /* Use alternative linker */
+    const char *linker = driver->get_attr_string("linker");
+    if (linker[0]) {
+        if (!gcc_linker_test(cc(cpp), linker)) {
+            ut_error("linker '%s' cannot be used with '%s'", linker, cc(cpp));
+            project->error = true;
+            ut_strbuf_reset(&cmd);
+            return;
+        }
+        ut_strbuf_append(&cmd, " -fuse-ld=%s", linker);
+    }
+
     /* Set optimizations */
     if (config->optimizations) {
         ut_strbuf_appendstr(&cmd, " -O3");
-        if (!config->strict) {
-            ut_strbuf_appendstr(&cmd, " -flto");
+        if (gcc_use_lto(driver, config, lang)) {
+            gcc_add_lto(driver, project, lang, &cmd, true);
         }
     } else {
         ut_strbuf_appendstr(&cmd, " -O0");
@@ -553,8 +1266,9 @@ void gcc_link_dynamic_binary(
         }
     }
 
-    /* Add object files */
-    ut_strbuf_append(&cmd, " %s", source);
+    /* Add object files. Objects and static libraries are collected separately,
+     * so they can be passed in a response file if there are many. */
+    ut_strbuf_appendstr(&objects, source);
 
     /* Link static library */
     bake_attr *static_lib_attr = driver->get_attr("static-lib");
@@ -563,6 +1277,7 @@ void gcc_link_dynamic_binary(
         if (static_lib_attr->kind != BAKE_ARRAY) {
             ut_error("attribute 'static-lib' is not of type array");
             project->error = true;
+            ut_strbuf_reset(&objects);
             return;
         }
 
@@ -571,47 +1286,59 @@ void gcc_link_dynamic_binary(
             bake_attr *lib = ut_iter_next(&it);
 
             if (!hide_symbols) {
-                ut_strbuf_append(&cmd, " -l%s", lib->is.string);
+                ut_strbuf_append(&objects, " -l%s", lib->is.string);
             } else {
-                /* If hiding symbols and linking with static library, unpack
-                 * library objects to temp directory. If the library would be
-                 * linked as-is, symbols would be exported, even though
-                 * fvisibility is set to hidden */
+                /* If hiding symbols and linking with static library, the
+                 * symbols of the library would still be exported, as the
+                 * library was not necessarily built with fvisibility set to
+                 * hidden. Let the linker hide the symbols of the library.
+                 * All objects of the library are linked, like when they were
+                 * unpacked, so that objects that are only used through
+                 * constructors or static initializers are not dropped. */
                 char *static_lib = gcc_find_static_lib(
                     driver, project, config, lib->is.string);
                 if (!static_lib) {
                     continue;
                 }
 
-                /* Unpack objects in static lib to temporary directory */
-                char *cwd = strdup(ut_cwd());
-                char *obj_path = ut_asprintf(".bake_cache/obj_%s/%s-%s",
-                    lib->is.string, UT_PLATFORM_STRING, config->configuration);
-                char *unpack_cmd = ut_asprintf("ar x %s", static_lib);
-
-                /* The ar command doesn't have an option to output files to a
-                 * specific directory, so have to use chdir. This will be an
-                 * issue for multithreaded builds. */
-                ut_mkdir(obj_path);
-                ut_chdir(obj_path);
-                driver->exec(unpack_cmd);
-                free(unpack_cmd);
-                free(static_lib);
-                ut_chdir(cwd);
-                free(cwd);
-                ut_strbuf_append(&cmd, " %s/*", obj_path);
-
-                if (!static_object_paths) {
-                    static_object_paths = ut_ll_new();
+                if (!is_darwin() && !is_emcc()) {
+                    ut_strbuf_append(&objects, 
+                        " -Wl,--whole-archive %s -Wl,--no-whole-archive"
+                        " -Wl,--exclude-libs,%s",
+                        static_lib, strrchr(static_lib, '/') + 1);
+                } else {
+                    /* The emscripten linker cannot hide symbols of a library.
+                     * The MacOS linker can (-load_hidden), but not for an
+                     * archive that is also force loaded, so unpack the library
+                     * objects to a temp directory */
+                    char *obj_path = ut_asprintf("%s/.bake_cache/obj_%s/%s-%s",
+                        project->path, lib->is.string, UT_PLATFORM_STRING,
+                        config->configuration);
+                    if (gcc_unpack_static_lib(static_lib, obj_path, &objects)) {
+                        ut_raise();
+                        project->error = true;
+                    }
+
+                    if (!static_object_paths) {
+                        static_object_paths = ut_ll_new();
+                    }
+
+                    /* Add path with object files to static_object_paths. These
+                     * will be cleaned up after the compile command */
+                    ut_ll_append(static_object_paths, obj_path);
                 }
 
-                /* Add path with object files to static_object_paths. These will
-                 * be cleaned up after the compile command */
-                ut_ll_append(static_object_paths, obj_path);
+                free(static_lib);
             }
         }
     }
 
+    char *objects_str = ut_strbuf_get(&objects);
+    char *rsp = gcc_response_file(driver, project, objects_str);
+    ut_strbuf_append(&cmd, " %s", rsp ? rsp : objects_str);
+    free(objects_str);
+    free(rsp);
+
     /* Add BAKE_TARGET to library path */
     if (ut_file_test(config->lib)) {
         ut_strbuf_append(&cmd, " -L%s", config->lib);
@@ -693,11 +1420,51 @@ void gcc_link_static_binary(
     char *source,
     char *target)
 {
-    ut_strbuf cmd = UT_STRBUF_INIT;
-    ut_strbuf_append(&cmd, "ar rcs %s %s", target, source);
-    char *cmdstr = ut_strbuf_get(&cmd);
-    driver->exec(cmdstr);
-    free(cmdstr);
+    /* The ar on MacOS doesn't support response files */
+    char *rsp = NULL;
+    if (!is_darwin()) {
+        rsp = gcc_response_file(driver, project, source);
+    }
+
+    if (rsp) {
+        const char *argv[] = {"ar", "rcs", target, rsp, NULL};
+        driver->exec_argv(argv);
+        free(rsp);
+    } else {
+        /* Pass objects as separate arguments, so the command isn't parsed */
+        char *objects = ut_strdup(source), *ptr, *obj = NULL;
+        int32_t count = 3, size = 16;
+        const char **argv = malloc(size * sizeof(char*));
+        argv[0] = "ar";
+        argv[1] = "rcs";
+        argv[2] = target;
+
+        for (ptr = objects; ; ptr ++) {
+            if (*ptr && *ptr != ' ') {
+                if (!obj) obj = ptr;
+                continue;
+            }
+
+            if (obj) {
+                if (count == size - 1) {
+                    size *= 2;
+                    argv = realloc(argv, size * sizeof(char*));
+                }
+                argv[count ++] = obj;
+                obj = NULL;
+            }
+
+            if (!*ptr) {
+                break;
+            }
+            *ptr = '\0';
+        }
+
+        argv[count] = NULL;
+        driver->exec_argv(argv);
+        free(argv);
+        free(objects);
+    }
 }
 
 /* Link a library */
@@ -1098,8 +1865,16 @@ void gcc_clean_coverage(
 
 static
 bake_compiler_interface gcc_get() {
+    if (!gcc_compiler_hashes) {
+        gcc_compiler_hashes = ut_rb_new(gcc_compiler_compare, NULL);
+        gcc_linkers = ut_rb_new(gcc_compiler_compare, NULL);
+        ut_mutex_new(&gcc_compiler_hashes_lock);
+    }
+
     bake_compiler_interface result = {
         .compile = gcc_compile_src,
+        .compile_cmd = gcc_compile_cmd,
+        .precompile_header = gcc_precompile_header,
         .link = gcc_link_binary,
         .clean_coverage = gcc_clean_coverage,
         .coverage = gcc_coverage,
@@ -23,6 +23,9 @@
 
 #define CACHE_DIR ".bake_cache"
 
+/* Number of sources in a unity file when unity-batch-size is not set */
+#define UNITY_BATCH_SIZE (8)
+
 typedef enum bake_src_lang {
     BAKE_SRC_LANG_C = 0,
     BAKE_SRC_LANG_CPP = 1,
@@ -31,6 +34,8 @@ typedef enum bake_src_lang {
 
 typedef struct bake_compiler_interface {
     bake_rule_action_cb compile;
+    bake_rule_command_cb compile_cmd;
+    bake_driver_cb precompile_header;
     bake_rule_action_cb link;
     bake_driver_cb clean_coverage;
     bake_driver_cb coverage;
@@ -247,6 +252,214 @@ char* src_to_obj(
     return result;
 }
 
+static
+int unity_compare(
+    const void *p1,
+    const void *p2)
+{
+    return strcmp(*(char* const*)p1, *(char* const*)p2);
+}
+
+/* Get extension of the unity file for a source file. Sources of different
+ * languages go in different unity files. */
+static
+const char* unity_ext(
+    const char *source)
+{
+    char *ext = strrchr(source, '.');
+    if (!ext || !strcmp(ext, ".c")) {
+        return ".c";
+    } else if (!strcmp(ext, ".m")) {
+        return ".m";
+    } else {
+        return ".cpp";
+    }
+}
+
+/* Write unity file if its content changed. A unity file that is not written
+ * keeps its timestamp, so that only batches with modified sources (which are
+ * tracked as dependencies of the object) are recompiled. */
+static
+int16_t unity_write(
+    const char *file,
+    const char *content)
+{
+    char *old_content = NULL;
+    if (ut_file_test(file) == 1) {
+        old_content = ut_file_load(file);
+    }
+
+    if (old_content && !strcmp(old_content, content)) {
+        free(old_content);
+        return 0;
+    }
+
+    free(old_content);
+
+    FILE *f = fopen(file, "w");
+    if (!f) {
+        ut_throw("failed to open '%s'", file);
+        return -1;
+    }
+
+    fputs(content, f);
+    fclose(f);
+    ut_stat_invalidate(file);
+
+    return 0;
+}
+
+/* Replace sources with unity files that each include a batch of sources, so
+ * that headers which are included by many sources are parsed once per batch */
+static
+ut_ll unity_sources(
+    bake_driver_api *driver,
+    bake_config *config,
+    bake_project *project,
+    ut_ll sources)
+{
+    const char *exts[] = {".c", ".cpp", ".m"};
+    int32_t batch_size = UNITY_BATCH_SIZE, count = ut_ll_count(sources);
+    int32_t i, e;
+    ut_ll result = NULL;
+
+    /* Assembly is generated per source file */
+    if (!count || config->assembly || !driver->get_attr_bool("unity")) {
+        return NULL;
+    }
+
+    bake_attr *batch_attr = driver->get_attr("unity-batch-size");
+    if (batch_attr) {
+        if (batch_attr->kind != BAKE_NUMBER || batch_attr->is.number < 1) {
+            ut_error("attribute 'unity-batch-size' must be a positive number");
+            project->error = true;
+            return NULL;
+        }
+        batch_size = batch_attr->is.number;
+    }
+
+    /* Sort sources, so batches don't depend on the order of the filesystem */
+    char **files = malloc(count * sizeof(char*));
+    ut_iter it = ut_ll_iter(sources);
+    for (i = 0; ut_iter_hasNext(&it); i ++) {
+        files[i] = ut_iter_next(&it);
+    }
+    qsort(files, count, sizeof(char*), unity_compare);
+
+    /* Sources are included relative to the directory of the unity files */
+    char *obj_dir = driver->get_attr_string("obj-dir");
+    char *unity_dir = ut_asprintf("%s"UT_OS_PS"unity", obj_dir);
+    ut_strbuf root = UT_STRBUF_INIT;
+    if (ut_path_is_relative(unity_dir)) {
+        char *ptr, ch;
+        ut_strbuf_appendstr(&root, "..");
+        for (ptr = unity_dir; (ch = *ptr); ptr ++) {
+            if (ch == UT_OS_PS[0]) {
+                ut_strbuf_appendstr(&root, "/..");
+            }
+        }
+    } else {
+        ut_strbuf_appendstr(&root, project->fullpath);
+    }
+    char *root_str = ut_strbuf_get(&root);
+
+    if (ut_mkdir("%s"UT_OS_PS"%s", project->path, unity_dir)) {
+        ut_raise();
+        project->error = true;
+        goto error;
+    }
+
+    result = ut_ll_new();
+
+    for (e = 0; e < 3; e ++) {
+        int32_t ext_count = 0, batch_count, b;
+
+        for (i = 0; i < count; i ++) {
+            if (!strcmp(unity_ext(files[i]), exts[e])) {
+                ext_count ++;
+            }
+        }
+
+        if (!ext_count) {
+            continue;
+        }
+
+        /* A source is assigned to a batch by the hash of its path, so that
+         * adding or removing a source only changes the batch of that source,
+         * unless the number of batches changes. */
+        batch_count = (ext_count + batch_size - 1) / batch_size;
+        ut_strbuf *content = calloc(batch_count, sizeof(ut_strbuf));
+
+        for (i = 0; i < count; i ++) {
+            if (strcmp(unity_ext(files[i]), exts[e])) {
+                continue;
+            }
+
+            b = ut_hash_str(files[i], UT_HASH_INIT) % batch_count;
+
+            if (!content[b].elementCount) {
+                ut_strbuf_appendstr(&content[b],
+                    "/* Generated by bake, compiles a batch of sources as a "
+                    "single unit. Do not edit! */\n");
+            }
+
+            if (ut_path_is_relative(files[i])) {
+                ut_strbuf_append(
+                    &content[b], "#include \"%s/%s\"\n", root_str, files[i]);
+            } else {
+                ut_strbuf_append(&content[b], "#include \"%s\"\n", files[i]);
+            }
+        }
+
+        for (b = 0; b < batch_count; b ++) {
+            char *content_str = ut_strbuf_get(&content[b]);
+            if (!content_str) {
+                continue;
+            }
+
+            char *unity_file = ut_asprintf("%s"UT_OS_PS"unity_%d%s",
+                unity_dir, b, exts[e]);
+            char *unity_path = ut_asprintf("%s"UT_OS_PS"%s",
+                project->path, unity_file);
+
+            int16_t ret = unity_write(unity_path, content_str);
+            free(content_str);
+            free(unity_path);
+            if (ret) {
+                free(unity_file);
+                for (b ++; b < batch_count; b ++) {
+                    ut_strbuf_reset(&content[b]);
+                }
+                free(content);
+                ut_raise();
+                project->error = true;
+                goto error;
+            }
+
+            ut_ll_append(result, unity_file);
+        }
+
+        free(content);
+    }
+
+    free(root_str);
+    free(unity_dir);
+    free(files);
+    return result;
+error:
+    if (result) {
+        char *file;
+        while ((file = ut_ll_takeFirst(result))) {
+            free(file);
+        }
+        ut_ll_free(result);
+    }
+    free(root_str);
+    free(unity_dir);
+    free(files);
+    return NULL;
+}
+
 /* Initialize project defaults */
 static
 void init(
@@ -283,6 +496,38 @@ void init(
         driver->set_attr_bool("export-symbols", false);
     }
 
+    if (!driver->get_attr("precompile-header")) {
+        driver->set_attr_bool("precompile-header", true);
+    }
+
+    if (!driver->get_attr("unity")) {
+        driver->set_attr_bool("unity", false);
+    }
+
+    if (!driver->get_attr("lto")) {
+        driver->set_attr_string("lto", "full");
+    } else {
+        const char *lto = driver->get_attr_string("lto");
+        if (strcmp(lto, "full") && strcmp(lto, "thin") && strcmp(lto, "none")) {
+            ut_error(
+                "invalid value '%s' for attribute 'lto' (expected full, thin or none)",
+                lto);
+            project->error = true;
+        }
+    }
+
+    if (driver->get_attr("linker")) {
+        const char *linker = driver->get_attr_string("linker");
+        if (strcmp(linker, "bfd") && strcmp(linker, "gold") &&
+            strcmp(linker, "lld") && strcmp(linker, "mold"))
+        {
+            ut_error(
+                "invalid value '%s' for attribute 'linker' (expected bfd, gold, lld or mold)",
+                linker);
+            project->error = true;
+        }
+    }
+
     char *tmp_dir  = ut_asprintf(
         CACHE_DIR UT_OS_PS "%s-%s", config->build_target, 
         config->configuration);
@@ -427,6 +672,9 @@ void build(
     bake_config *config,
     bake_project *project)
 {
+    if (cif.precompile_header) {
+        cif.precompile_header(driver, config, project);
+    }
 }
 
 static
@@ -632,6 +880,12 @@ int bakemain(bake_driver_api *driver)
     /* Create rule for dynamically generating object files from source files */
     driver->rule("objects", "$SOURCES", driver->target_map(src_to_obj), cif.compile);
 
+    /* Rebuild objects when the compiler command changes */
+    driver->rule_command("objects", cif.compile_cmd);
+
+    /* Compile sources in batches when unity builds are enabled */
+    driver->sources(unity_sources);
+
     /* Create rule for creating binary from objects */
     driver->rule("ARTEFACT", "$objects", driver->target_pattern(NULL), cif.link);
 
@@ -101,9 +101,10 @@ void msvc_add_flags(
     }
 }
 
-/* Compile source file for Windows platform using MSVC*/
+/* Create command for compiling source file. The returned command is also used
+ * to detect whether objects need to be rebuilt because of changed settings. */
 static
-void msvc_compile_src(
+char* msvc_compile_cmd(
     bake_driver_api *driver,
     bake_config *config,
     bake_project *project,
@@ -173,8 +174,19 @@ void msvc_compile_src(
         ut_strbuf_append(&cmd, " /Zi");
     }
 
-    /* Execute command */
-    char *cmdstr = ut_strbuf_get(&cmd);
+    return ut_strbuf_get(&cmd);
+}
+
+/* Compile source file for Windows platform using MSVC*/
+static
+void msvc_compile_src(
+    bake_driver_api *driver,
+    bake_config *config,
+    bake_project *project,
+    char *source,
+    char *target)
+{
+    char *cmdstr = msvc_compile_cmd(driver, config, project, source, target);
     driver->exec(cmdstr);
     free(cmdstr);
 }
@@ -527,6 +539,7 @@ static
 bake_compiler_interface msvc_get() {
     bake_compiler_interface result = {
         .compile = msvc_compile_src,
+        .compile_cmd = msvc_compile_cmd,
         .link = msvc_link_binary,
         .clean_coverage = msvc_clean_coverage,
         .coverage = msvc_coverage,
@@ -1,11 +1,19 @@
 
 #include <bake_test.h>
 
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
 static bake_test_suite *current_testsuite;
 static bake_test_case *current_testcase;
 
 static bool test_expect_abort_signal = false;
 static bool test_flaky = false;
+static bool test_no_fork = false;
+static int32_t test_slowest = 5;
+static int32_t test_shard_index = 0; /* Starts at 1, 0 if not sharded */
+static int32_t test_shard_count = 0;
 
 static const char *params[1024];
 static uint32_t param_count = 0;
@@ -192,24 +200,71 @@ bake_test_suite* bake_find_suite(
     return NULL;
 }
 
-typedef struct {
-    const char *test_project;
-    const char *exec;
+/* A run of a testsuite. A suite with parameters has a run for each
+ * combination of parameter values. */
+typedef struct bake_test_suite_run {
     bake_test_suite *suite;
+    int32_t *values;        /* Index of value for each suite parameter */
+    uint32_t remaining;     /* Testcases that haven't finished yet */
     uint32_t fail;
     uint32_t empty;
     uint32_t pass;
-    uint32_t offset;
-    uint32_t count;
     int8_t result;
-    ut_thread job;
-} bake_test_exec_ctx;
+} bake_test_suite_run;
+
+/* Resources used by a testcase */
+typedef struct bake_test_timing {
+    double wall;            /* Wall time in seconds */
+    double cpu;             /* CPU time in seconds, 0 if not measured */
+    int64_t rss;            /* Max resident set size in KB, 0 if not measured */
+} bake_test_timing;
+
+/* A testcase of a run, the unit of work that is scheduled */
+typedef struct bake_test_item {
+    bake_test_suite_run *run;
+    bake_test_case *test;
+    char *key;              /* Identifies the testcase in the history */
+    int32_t order;          /* Order in which the testcase was added */
+    double expected;        /* Wall time from history, -1 if unknown */
+    bake_test_timing timing;
+    bool measured;
+} bake_test_item;
+
+/* Timing of a testcase in the history */
+typedef struct bake_test_history_entry {
+    char *key;
+    bake_test_timing timing;
+    bool updated;           /* Testcase ran in this run */
+} bake_test_history_entry;
+
+/* All testcases of all runs are added to a single queue. Jobs take the next
+ * testcase from the queue when they are done with the previous one, so jobs
+ * don't sit idle while another job still has testcases left, and a suite
+ * doesn't have to wait for the previous suite to finish. Runs are reported
+ * in the order in which they were added, as soon as a run and all runs before
+ * it have finished. */
+typedef struct bake_test_queue {
+    const char *test_project;
+    const char *exec;
+    bake_test_suite_run **runs;
+    int32_t run_count;
+    int32_t run_size;
+    int32_t reported;       /* Number of runs that have been reported */
+    bake_test_item *items;
+    int32_t count;
+    int32_t size;
+    int32_t next;           /* Next item to run */
+    struct ut_mutex_s lock; /* Protects results of runs */
+    char *history_file;     /* File with timings of previous runs */
+    ut_rb history;          /* Timings by testcase key */
+} bake_test_queue;
 
 static
 void bake_test_cmd_append_params(
     ut_strbuf *buf,
-    bake_test_suite *suite)
+    bake_test_suite_run *run)
 {
+    bake_test_suite *suite = run->suite;
     uint32_t p;
     for (p = 0; p < suite->param_count; p ++) {
         bake_test_param *param = &suite->params[p];
@@ -219,186 +274,441 @@ void bake_test_cmd_append_params(
             ut_strbuf_append(buf, " --param %s=%s", param->name, cmd_line_value);
         } else {
             ut_strbuf_append(buf, " --param %s=%s", param->name, 
-                param->values[param->value_cur]);
+                param->values[run->values[p]]);
         }
     } 
 }
 
+/* Command that runs a single testcase */
 static
-void* bake_test_run_suite_range(
-    bake_test_exec_ctx *ctx)
+char* bake_test_cmd(
+    const char *exec,
+    bake_test_suite_run *run,
+    const char *test_name)
 {
-    int8_t result = 0;
-    uint32_t fail = 0, empty = 0, pass = 0;
-    uint32_t offset = ctx->offset, count = ctx->count;
-    const char *exec = ctx->exec;
-    bake_test_suite *suite = ctx->suite;
     const char *prefix = ut_getenv("BAKE_TEST_PREFIX");
 
-    uint32_t t;
-    for (t = offset; t < (offset + count); t ++) {
-        bake_test_case *test = &suite->testcases[t];
+    ut_strbuf cmd = UT_STRBUF_INIT;
+    if (prefix) {
+        ut_strbuf_append(&cmd, "%s ", prefix);
+    }
 
-        char *test_name = ut_asprintf("%s.%s", suite->id, test->id);
-        ut_proc proc;
-        int8_t rc = 0;
-        int sig = 0;
-        bool proc_fail = false;
-        int32_t retry_count = 0;
+    ut_strbuf_append(&cmd, "%s %s", exec, test_name);
 
-retry:
-        memset(&proc, 0, sizeof(ut_proc));
+    if (run->suite->param_count) {
+        bake_test_cmd_append_params(&cmd, run);
+    }
 
-        ut_strbuf cmd = UT_STRBUF_INIT;
-        if (prefix) {
-            ut_strbuf_append(&cmd, "%s ");
-        }
+    return ut_strbuf_get(&cmd);
+}
 
-        ut_strbuf_append(&cmd, "%s %s", exec, test_name);
+/* The history stores the resources used by each testcase in the last run in
+ * which it ran. It is used to start the slowest testcases first, so that a
+ * slow testcase doesn't start when all others are done, which would leave the
+ * other jobs idle while it runs.
+ *
+ * The history is stored in a text file with a header line, followed by a line
+ * per testcase ("<wall time> <cpu time> <max rss> <key>"). The key is the
+ * name of the testcase, followed by its parameters when the suite has them. */
 
-        if (suite->param_count) {
-            bake_test_cmd_append_params(&cmd, suite);
+#define BAKE_TEST_HISTORY_HEADER "bake test history 1"
+
+static
+int bake_test_history_strcmp(
+    void *ctx,
+    const void* key1,
+    const void* key2)
+{
+    return strcmp(key1, key2);
+}
+
+/* Test executables are built to <project>/bin/<platform>-<config>, the
+ * history is stored in <project>/.bake_cache/<platform>-<config>. Returns
+ * NULL if the executable is not in a project bin directory. */
+static
+char* bake_test_history_file(
+    const char *exec)
+{
+    char *result = NULL;
+    char *path = ut_strdup(exec);
+    char *sep = strrchr(path, UT_OS_PS[0]);
+    if (!sep) {
+        goto done;
+    }
+
+    *sep = '\0';
+    char *platform = strrchr(path, UT_OS_PS[0]);
+    if (!platform) {
+        goto done;
+    }
+
+    *platform = '\0';
+    platform ++;
+
+    char *bin = strrchr(path, UT_OS_PS[0]);
+    bin = bin ? bin + 1 : path;
+    if (strcmp(bin, "bin")) {
+        goto done;
+    }
+
+    *bin = '\0';
+    result = ut_asprintf("%s.bake_cache"UT_OS_PS"%s"UT_OS_PS"test_history",
+        path, platform);
+done:
+    free(path);
+    return result;
+}
+
+static
+bake_test_history_entry* bake_test_history_set(
+    ut_rb history,
+    const char *key,
+    bake_test_timing *timing)
+{
+    bake_test_history_entry *entry = ut_rb_find(history, key);
+    if (!entry) {
+        entry = ut_calloc(sizeof(bake_test_history_entry));
+        entry->key = ut_strdup(key);
+        ut_rb_set(history, entry->key, entry);
+    }
+
+    entry->timing = *timing;
+
+    return entry;
+}
+
+static
+int16_t bake_test_history_parse(
+    ut_rb history,
+    char *buffer)
+{
+    char *ptr = buffer, *line = ut_file_nextln(&ptr);
+    if (!line || strcmp(line, BAKE_TEST_HISTORY_HEADER)) {
+        return -1;
+    }
+
+    while ((line = ut_file_nextln(&ptr))) {
+        bake_test_timing timing;
+        long long rss;
+        int key_offset = 0;
+
+        if (sscanf(line, "%lf %lf %lld %n",
+            &timing.wall, &timing.cpu, &rss, &key_offset) != 3 || !key_offset)
+        {
+            return -1;
         }
 
-        char *cmd_str = ut_strbuf_get(&cmd);
-        sig = ut_proc_cmd(cmd_str, &rc);
+        timing.rss = rss;
+        bake_test_history_set(history, &line[key_offset], &timing);
+    }
 
-        if (sig || rc) {
-            ut_catch();
-            if (sig) {
-                if (sig == 6) {
-                    ut_log("#[red]FAIL#[reset]: %s aborted\n", test_name);
-                } else if (sig == 11) {
-                    ut_log("#[red]FAIL#[reset]: %s segfaulted\n", test_name);
-                } else {
-                    /* Signal 4 seems to get thrown every now and then when 
-                     * trying to create lots of processes. Retry a few times
-                     * before actually failing the test. */
-                    if (sig == 4) {
-                        retry_count ++;
-                        if (retry_count < 5) {
-                            /* Don't retry too fast in case OS resources are
-                             * limited. */
-                            ut_sleep(0, 100 * 1000 * 1000);
-                            ut_log("#[grey]retrying after sig 4...\n");
-                            goto retry;
-                        } else {
-                            ut_log("#[red]retried 5 times after sig 4\n");
-                        }
-                    }
-                    ut_log("#[red]FAIL#[reset]: %s exited with signal %d\n", 
-                        test_name, sig);
-                }
-                result = -1;
-                fail ++;
-            } else {
-                if (rc == 2) {
-                    /* Testcase is empty. No action required, but print the
-                     * test command on command line */
-                    empty ++;
-                } else if (rc != -1) {
-                    /* If return code is not -1, this was not a simple
-                     * testcase failure (which already has been reported) */
-                    ut_log(
-                        "#[red]FAIL#[reset]: %s failed with return code %d\n", 
-                        test_name, rc);
-
-                    result = -1;
-                    fail ++;
-                } else {
-                    /* Normal test failure */
-                    result = -1;
-                    fail ++;
-                }
-            }
+    return 0;
+}
 
-            ut_catch();
-            print_dbg_command(ctx->test_project, cmd_str);
-        } else if (proc_fail) {
-            ut_log("Testcase '%s' failed to start\n", test_name);
-        } else {
-            if (ut_log_verbosityGet() <= UT_OK) {
-                ut_log("#[green]PASS#[reset] %s.%s\n", 
-                    suite->id, test->id);
-            }
-            pass ++;
+static
+void bake_test_history_clear(
+    ut_rb history)
+{
+    ut_iter it = ut_rb_iter(history);
+    while (ut_iter_hasNext(&it)) {
+        bake_test_history_entry *entry = ut_iter_next(&it);
+        free(entry->key);
+        free(entry);
+    }
+    ut_rb_free(history);
+}
+
+/* Load history from file. Returns an empty history if the file does not
+ * exist or is invalid. */
+static
+ut_rb bake_test_history_load(
+    const char *file)
+{
+    ut_rb history = ut_rb_new(bake_test_history_strcmp, NULL);
+    if (!file || ut_file_test(file) != 1) {
+        return history;
+    }
+
+    char *buffer = ut_file_load(file);
+    if (!buffer) {
+        ut_catch();
+        return history;
+    }
+
+    if (bake_test_history_parse(history, buffer)) {
+        /* An invalid history just means that testcases run in the order in
+         * which they are defined */
+        ut_trace("discard invalid test history '%s'", file);
+        bake_test_history_clear(history);
+        history = ut_rb_new(bake_test_history_strcmp, NULL);
+    }
+
+    free(buffer);
+
+    return history;
+}
+
+/* Write timings of testcases that ran to the history. Testcases that didn't
+ * run keep their previous timing, unless all testcases ran, in which case
+ * they no longer exist. */
+static
+int16_t bake_test_history_save(
+    bake_test_queue *queue,
+    bool all)
+{
+    ut_strbuf buf = UT_STRBUF_INIT;
+    int32_t i;
+
+    if (!queue->history_file) {
+        return 0;
+    }
+
+    for (i = 0; i < queue->count; i ++) {
+        bake_test_item *item = &queue->items[i];
+        if (item->measured) {
+            bake_test_history_set(
+                queue->history, item->key, &item->timing)->updated = true;
         }
+    }
 
-        free(cmd_str);
-        free(test_name);
+    ut_strbuf_append(&buf, "%s\n", BAKE_TEST_HISTORY_HEADER);
+
+    ut_iter it = ut_rb_iter(queue->history);
+    while (ut_iter_hasNext(&it)) {
+        bake_test_history_entry *entry = ut_iter_next(&it);
+        if (all && !entry->updated) {
+            continue;
+        }
+        ut_strbuf_append(&buf, "%.6f %.6f %lld %s\n", entry->timing.wall,
+            entry->timing.cpu, (long long)entry->timing.rss, entry->key);
     }
 
-    ctx->fail = fail;
-    ctx->empty = empty;
-    ctx->pass = pass;
-    
-    ctx->result = result;
+    char *content = ut_strbuf_get(&buf);
+    int16_t result = ut_file_save(queue->history_file, content);
+    free(content);
+
+    return result;
+}
+
+static
+void bake_test_queue_init(
+    bake_test_queue *queue,
+    const char *test_project,
+    const char *exec)
+{
+    memset(queue, 0, sizeof(bake_test_queue));
+    queue->test_project = test_project;
+    queue->exec = exec;
+    ut_mutex_new(&queue->lock);
+    queue->history_file = bake_test_history_file(exec);
+    queue->history = bake_test_history_load(queue->history_file);
+}
+
+static
+void bake_test_queue_deinit(
+    bake_test_queue *queue)
+{
+    int32_t i;
+    for (i = 0; i < queue->run_count; i ++) {
+        free(queue->runs[i]->values);
+        free(queue->runs[i]);
+    }
+    for (i = 0; i < queue->count; i ++) {
+        free(queue->items[i].key);
+    }
+    free(queue->runs);
+    free(queue->items);
+    bake_test_history_clear(queue->history);
+    free(queue->history_file);
+    ut_mutex_free(&queue->lock);
+}
+
+/* Shards split the testcases of a test executable over multiple processes
+ * or machines. Every shard computes the same assignment of testcases to
+ * shards independently, so that each testcase runs in exactly one shard.
+ * The unit of assignment is a testcase, including all combinations of the
+ * parameters of its suite, so that a listed testcase runs in one shard.
+ *
+ * Testcases that have no history are assigned by a hash of their name, which
+ * doesn't change when other testcases are added or removed. The remaining
+ * testcases are assigned longest first to the shard that has the least work,
+ * counting testcases without history as taking the average time. Shards only
+ * get the same assignment when they use the same history file, so sharded
+ * runs don't update the history. Otherwise a shard that runs after another
+ * shard would compute a different assignment, and testcases would be skipped
+ * or run twice. */
+
+typedef struct bake_test_shard_unit {
+    char *key;              /* Name of testcase */
+    double expected;        /* Wall time from history, -1 if unknown */
+    int32_t shard;
+} bake_test_shard_unit;
+
+static
+int bake_test_shard_unit_compare(
+    const void *ptr1,
+    const void *ptr2)
+{
+    const bake_test_shard_unit *unit1 = *(bake_test_shard_unit* const*)ptr1;
+    const bake_test_shard_unit *unit2 = *(bake_test_shard_unit* const*)ptr2;
+
+    if (unit1->expected != unit2->expected) {
+        return unit1->expected > unit2->expected ? -1 : 1;
+    }
+
+    return strcmp(unit1->key, unit2->key);
+}
+
+/* FNV-1a, a stable hash for testcases without history */
+static
+uint32_t bake_test_shard_hash(
+    const char *key)
+{
+    uint32_t hash = 2166136261u;
+    const char *ptr;
+    for (ptr = key; *ptr; ptr ++) {
+        hash = (hash ^ (uint8_t)*ptr) * 16777619u;
+    }
+    return hash;
+}
+
+static
+int16_t bake_test_shard_parse(
+    const char *str)
+{
+    int index, count, len = 0;
+    if (sscanf(str, "%d/%d%n", &index, &count, &len) != 2 || str[len] ||
+        count < 1 || index < 1 || index > count)
+    {
+        ut_throw("invalid shard '%s' (expected <index>/<count>, "
+            "where index starts at 1)", str);
+        return -1;
+    }
+
+    test_shard_index = index;
+    test_shard_count = count;
 
     return 0;
 }
 
+/* Returns for each testcase of each suite, in the order in which they are
+ * defined, whether it belongs to the shard. Returns NULL if not sharded. */
 static
-int8_t bake_test_run_suite(
-    const char *test_id,
+bool* bake_test_shard_select(
     const char *exec,
-    bake_test_suite *suite,
-    uint32_t *fail_out,
-    uint32_t *empty_out,
-    uint32_t *pass_out,
-    uint32_t job_count)
+    bake_test_suite *suites,
+    uint32_t suite_count)
 {
-    assert(test_id != NULL);
-    assert(exec != NULL);
-    assert(strlen(exec) != 0);
-
-    uint32_t i, cur = 0;
-    float next = 0, tests_per_runner = 
-        (float)suite->testcase_count / (float)job_count;
-
-    bake_test_exec_ctx *ctx = ut_calloc(
-        sizeof(bake_test_exec_ctx) * job_count);
-    assert(ctx != NULL);
-
-    // Divide the work
-    for (i = 0; i < job_count; i ++) {
-        next += tests_per_runner;
-        ctx[i].test_project = test_id;
-        ctx[i].exec = exec;
-        ctx[i].suite = suite;
-        ctx[i].offset = cur;
-        ctx[i].count = next - cur;
-        
-        if (i == (job_count - 1)) {
-            ctx[i].count += suite->testcase_count - ((uint32_t)next);
-            assert(cur + ctx[i].count == suite->testcase_count);
+    if (!test_shard_count) {
+        return NULL;
+    }
+
+    uint32_t i, t, count = 0;
+    for (i = 0; i < suite_count; i ++) {
+        count += suites[i].testcase_count;
+    }
+
+    bake_test_shard_unit *units = ut_calloc(
+        sizeof(bake_test_shard_unit) * (count + 1));
+    ut_rb by_key = ut_rb_new(bake_test_history_strcmp, NULL);
+    uint32_t u = 0;
+
+    for (i = 0; i < suite_count; i ++) {
+        bake_test_suite *suite = &suites[i];
+        for (t = 0; t < suite->testcase_count; t ++) {
+            bake_test_shard_unit *unit = &units[u ++];
+            unit->key = ut_asprintf("%s.%s", suite->id, suite->testcases[t].id);
+            unit->expected = -1;
+            ut_rb_set(by_key, unit->key, unit);
+        }
+    }
+
+    /* The expected time of a testcase is the sum of the times of all of its
+     * parameter combinations */
+    char *history_file = bake_test_history_file(exec);
+    ut_rb history = bake_test_history_load(history_file);
+    ut_iter it = ut_rb_iter(history);
+    while (ut_iter_hasNext(&it)) {
+        bake_test_history_entry *entry = ut_iter_next(&it);
+        char *key = ut_strdup(entry->key);
+        char *params = strchr(key, ' ');
+        if (params) {
+            *params = '\0';
         }
 
-        cur += ctx[i].count;
+        bake_test_shard_unit *unit = ut_rb_find(by_key, key);
+        if (unit) {
+            if (unit->expected < 0) {
+                unit->expected = 0;
+            }
+            unit->expected += entry->timing.wall;
+        }
+
+        free(key);
+    }
+    bake_test_history_clear(history);
+    free(history_file);
+    ut_rb_free(by_key);
+
+    double *load = ut_calloc(sizeof(double) * test_shard_count);
+    bake_test_shard_unit **known = ut_calloc(
+        sizeof(bake_test_shard_unit*) * (count + 1));
+    uint32_t known_count = 0;
+    double known_total = 0;
+
+    for (u = 0; u < count; u ++) {
+        if (units[u].expected >= 0) {
+            known[known_count ++] = &units[u];
+            known_total += units[u].expected;
+        }
     }
 
-    // Run jobs
-    for (i = 0; i < job_count; i ++) {
-        ctx[i].job = ut_thread_new(
-            (ut_thread_cb)bake_test_run_suite_range, &ctx[i]);
+    double average = known_count ? known_total / known_count : 0;
+    for (u = 0; u < count; u ++) {
+        if (units[u].expected < 0) {
+            units[u].shard = 
+                bake_test_shard_hash(units[u].key) % test_shard_count;
+            load[units[u].shard] += average;
+        }
     }
 
-    // Wait for jobs to complete
-    for (i = 0; i < job_count; i ++) {
-        ut_thread_join(ctx[i].job, NULL);
+    qsort(known, known_count, sizeof(bake_test_shard_unit*), 
+        bake_test_shard_unit_compare);
+
+    for (u = 0; u < known_count; u ++) {
+        int32_t s, least = 0;
+        for (s = 1; s < test_shard_count; s ++) {
+            if (load[s] < load[least]) {
+                least = s;
+            }
+        }
+        known[u]->shard = least;
+        load[least] += known[u]->expected;
     }
 
-    // Collect results
-    for (i = 1; i < job_count; i ++) {
-        ctx->pass += ctx[i].pass;
-        ctx->fail += ctx[i].fail;
-        ctx->empty += ctx[i].empty;
-        ctx->result |= ctx[i].result;
+    bool *result = ut_calloc(sizeof(bool) * (count + 1));
+    for (u = 0; u < count; u ++) {
+        result[u] = units[u].shard == test_shard_index - 1;
+        free(units[u].key);
     }
 
-    // Report
+    free(known);
+    free(load);
+    free(units);
+
+    return result;
+}
+
+static
+void bake_test_run_report(
+    bake_test_queue *queue,
+    bake_test_suite_run *run)
+{
+    bake_test_suite *suite = run->suite;
+
     if (!suite->param_count) {
-        bake_test_report(
-            test_id, suite->id, "", ctx->fail, ctx->empty, ctx->pass);
+        bake_test_report(queue->test_project, suite->id, "", 
+            run->fail, run->empty, run->pass);
     } else {
         ut_strbuf buf = UT_STRBUF_INIT;
         ut_strbuf_append(&buf, " [ ");
@@ -409,86 +719,585 @@ int8_t bake_test_run_suite(
                 ut_strbuf_append(&buf, "#[reset], ");
             }
             bake_test_param *param = &suite->params[p];
-            char *value = param->values[param->value_cur];
+            char *value = param->values[run->values[p]];
             ut_strbuf_append(&buf, "#[grey]%s#[reset]: #[green]%s", param->name, value);
         }
         ut_strbuf_append(&buf, " #[reset]]");
 
         char *param_str = ut_strbuf_get(&buf);
-        bake_test_report(
-            test_id, suite->id, param_str, ctx->fail, ctx->empty, ctx->pass);
+        bake_test_report(queue->test_project, suite->id, param_str, 
+            run->fail, run->empty, run->pass);
         free(param_str);
     }
 
-    int8_t result = ctx->result;
-    if (fail_out) {
-        *fail_out = ctx->fail;
+    if (run->fail || run->empty) {
+        ut_log("\n");
+    }
+}
+
+/* Report runs that finished, in the order in which they were added. Must be
+ * called while holding the lock. */
+static
+void bake_test_queue_report(
+    bake_test_queue *queue)
+{
+    while (queue->reported < queue->run_count &&
+        !queue->runs[queue->reported]->remaining)
+    {
+        bake_test_run_report(queue, queue->runs[queue->reported]);
+        queue->reported ++;
     }
-    if (empty_out) {
-        *empty_out = ctx->empty;
+}
+
+/* Add all testcases of a suite to the queue, with the specified parameter
+ * values */
+static
+bake_test_suite_run* bake_test_queue_add_run(
+    bake_test_queue *queue,
+    bake_test_suite *suite,
+    const int32_t *values,
+    const bool *in_shard)
+{
+    uint32_t t, testcase_count = 0;
+    for (t = 0; t < suite->testcase_count; t ++) {
+        if (!in_shard || in_shard[t]) {
+            testcase_count ++;
+        }
     }
-    if (pass_out) {
-        *pass_out = ctx->pass;
+
+    /* Don't report suites of which all testcases are in other shards */
+    if (suite->testcase_count && !testcase_count) {
+        return NULL;
     }
 
-    free(ctx);
+    bake_test_suite_run *run = ut_calloc(sizeof(bake_test_suite_run));
+    run->suite = suite;
+    run->remaining = testcase_count;
+    if (suite->param_count) {
+        size_t size = suite->param_count * sizeof(int32_t);
+        run->values = ut_calloc(size);
+        memcpy(run->values, values, size);
+    }
 
-    return result;
+    if (queue->run_count == queue->run_size) {
+        queue->run_size = queue->run_size ? queue->run_size * 2 : 32;
+        queue->runs = realloc(
+            queue->runs, queue->run_size * sizeof(bake_test_suite_run*));
+    }
+    queue->runs[queue->run_count ++] = run;
+
+    int32_t count = queue->count + testcase_count;
+    if (count > queue->size) {
+        queue->size = count * 2;
+        queue->items = realloc(
+            queue->items, queue->size * sizeof(bake_test_item));
+    }
+
+    for (t = 0; t < suite->testcase_count; t ++) {
+        if (in_shard && !in_shard[t]) {
+            continue;
+        }
+
+        bake_test_item *item = &queue->items[queue->count];
+        memset(item, 0, sizeof(bake_test_item));
+        item->run = run;
+        item->test = &suite->testcases[t];
+        item->order = queue->count ++;
+
+        ut_strbuf key = UT_STRBUF_INIT;
+        ut_strbuf_append(&key, "%s.%s", suite->id, item->test->id);
+        if (suite->param_count) {
+            bake_test_cmd_append_params(&key, run);
+        }
+        item->key = ut_strbuf_get(&key);
+
+        bake_test_history_entry *entry = ut_rb_find(queue->history, item->key);
+        item->expected = entry ? entry->timing.wall : -1;
+    }
+
+    /* A run without testcases is done before it starts */
+    if (!suite->testcase_count) {
+        ut_mutex_lock(&queue->lock);
+        bake_test_queue_report(queue);
+        ut_mutex_unlock(&queue->lock);
+    }
+
+    return run;
 }
 
+/* Add a run for each combination of parameter values of a suite. The last
+ * parameter changes fastest. When in_shard is not NULL, only testcases for
+ * which it is true are added. */
 static
-int8_t bake_test_run_suite_for_param(
-    const char *test_id,
-    const char *exec,
+void bake_test_queue_add(
+    bake_test_queue *queue,
     bake_test_suite *suite,
-    uint32_t *fail,
-    uint32_t *empty, 
-    uint32_t *pass,
-    uint32_t job_count,
-    uint32_t param)
+    const bool *in_shard)
 {
-    bake_test_param *p = &suite->params[param];
-    int32_t v;
-    int8_t result = 0;
+    uint32_t p;
 
-    for (v = 0; v < p->value_count; v ++) {
-        p->value_cur = v;
-        if (param < (suite->param_count - 1)) {
-            if (bake_test_run_suite_for_param(
-                test_id, exec, suite, fail, empty, pass, job_count, param + 1)) 
-            {
-                result = -1;
+    for (p = 0; p < suite->param_count; p ++) {
+        if (!suite->params[p].value_count) {
+            /* No combinations to run */
+            return;
+        }
+    }
+
+    int32_t *values = ut_calloc((suite->param_count + 1) * sizeof(int32_t));
+
+    do {
+        bake_test_queue_add_run(queue, suite, values, in_shard);
+
+        /* Advance to the next combination */
+        for (p = suite->param_count; p > 0; p --) {
+            if (++ values[p - 1] < suite->params[p - 1].value_count) {
+                break;
             }
-        } else {
-            if (!suite->param_count) {
-                uint32_t test_fail = 0;
-                uint32_t test_empty = 0; 
-                uint32_t test_pass = 0;
-                if (bake_test_run_suite(test_id, exec, suite, 
-                    &test_fail, &test_empty, &test_pass, job_count)) 
-                {
-                    result = -1;
+            values[p - 1] = 0;
+        }
+    } while (p > 0);
+
+    free(values);
+}
+
+typedef enum bake_test_outcome {
+    BAKE_TEST_PASS,
+    BAKE_TEST_FAIL,
+    BAKE_TEST_EMPTY
+} bake_test_outcome;
+
+/* Add the outcome of a testcase to its run, report the run when this was its
+ * last testcase */
+static
+void bake_test_finish(
+    bake_test_queue *queue,
+    bake_test_item *item,
+    bake_test_outcome outcome)
+{
+    bake_test_suite_run *run = item->run;
+
+    ut_mutex_lock(&queue->lock);
+
+    if (outcome == BAKE_TEST_PASS) {
+        run->pass ++;
+    } else if (outcome == BAKE_TEST_EMPTY) {
+        run->empty ++;
+    } else {
+        run->fail ++;
+        run->result = -1;
+    }
+
+    if (!-- run->remaining) {
+        bake_test_queue_report(queue);
+    }
+
+    ut_mutex_unlock(&queue->lock);
+}
+
+/* Report the result of a testcase. Returns true if the testcase should be
+ * retried. */
+static
+bool bake_test_result(
+    bake_test_queue *queue,
+    bake_test_item *item,
+    int sig,
+    int8_t rc,
+    int32_t *retry_count)
+{
+    bake_test_suite *suite = item->run->suite;
+    bake_test_case *test = item->test;
+    bake_test_outcome outcome = BAKE_TEST_PASS;
+    char *test_name = ut_asprintf("%s.%s", suite->id, test->id);
+
+    if (sig || rc) {
+        ut_catch();
+        if (sig) {
+            if (sig == 6) {
+                ut_log("#[red]FAIL#[reset]: %s aborted\n", test_name);
+            } else if (sig == 11) {
+                ut_log("#[red]FAIL#[reset]: %s segfaulted\n", test_name);
+            } else {
+                /* Signal 4 seems to get thrown every now and then when 
+                 * trying to create lots of processes. Retry a few times
+                 * before actually failing the test. */
+                if (sig == 4) {
+                    (*retry_count) ++;
+                    if (*retry_count < 5) {
+                        /* Don't retry too fast in case OS resources are
+                         * limited. */
+                        ut_sleep(0, 100 * 1000 * 1000);
+                        ut_log("#[grey]retrying after sig 4...\n");
+                        free(test_name);
+                        return true;
+                    } else {
+                        ut_log("#[red]retried 5 times after sig 4\n");
+                    }
                 }
-                *fail += test_fail;
-                *empty += test_empty;
-                *pass += test_pass;
+                ut_log("#[red]FAIL#[reset]: %s exited with signal %d\n", 
+                    test_name, sig);
+            }
+            outcome = BAKE_TEST_FAIL;
+        } else {
+            if (rc == 2) {
+                /* Testcase is empty. No action required, but print the
+                 * test command on command line */
+                outcome = BAKE_TEST_EMPTY;
+            } else if (rc != -1) {
+                /* If return code is not -1, this was not a simple
+                 * testcase failure (which already has been reported) */
+                ut_log(
+                    "#[red]FAIL#[reset]: %s failed with return code %d\n", 
+                    test_name, rc);
+                outcome = BAKE_TEST_FAIL;
             } else {
-                uint32_t test_fail = 0;
-                uint32_t test_empty = 0; 
-                uint32_t test_pass = 0;
-                if (bake_test_run_suite(test_id, exec, suite, 
-                    &test_fail, &test_empty, &test_pass, job_count)) 
-                {
-                    result = -1;
+                /* Normal test failure */
+                outcome = BAKE_TEST_FAIL;
+            }
+        }
+
+        ut_catch();
+
+        char *cmd_str = bake_test_cmd(queue->exec, item->run, test_name);
+        print_dbg_command(queue->test_project, cmd_str);
+        free(cmd_str);
+    } else {
+        if (ut_log_verbosityGet() <= UT_OK) {
+            ut_log("#[green]PASS#[reset] %s.%s\n", 
+                suite->id, test->id);
+        }
+    }
+
+    free(test_name);
+
+    bake_test_finish(queue, item, outcome);
+
+    return false;
+}
+
+/* Job that runs testcases as separate processes */
+static
+void* bake_test_job(
+    bake_test_queue *queue)
+{
+    int32_t i;
+    while ((i = ut_ainc(&queue->next) - 1) < queue->count) {
+        bake_test_item *item = &queue->items[i];
+        bake_test_suite *suite = item->run->suite;
+
+        char *test_name = ut_asprintf("%s.%s", suite->id, item->test->id);
+        int8_t rc;
+        int sig;
+        int32_t retry_count = 0;
+
+        do {
+            char *cmd_str = bake_test_cmd(queue->exec, item->run, test_name);
+            struct timespec start;
+            timespec_gettime(&start);
+            rc = 0;
+            sig = ut_proc_cmd(cmd_str, &rc);
+
+            /* CPU time and memory of a process started with a command are
+             * not known, only the wall time is measured */
+            item->timing.wall = timespec_measure(&start);
+            item->measured = true;
+            free(cmd_str);
+        } while (bake_test_result(queue, item, sig, rc, &retry_count));
+
+        free(test_name);
+    }
+
+    return 0;
+}
+
+#ifndef _WIN32
+
+/* The fork server runs each testcase in a process forked from the test
+ * executable, instead of starting the executable again for every testcase.
+ * The forked process starts out with libraries that are already loaded and
+ * initialized, and skips the dynamic linker and ut_init, which otherwise
+ * dominates the time it takes to run a small testcase. Testcases still run in
+ * their own process, so a testcase that crashes or aborts only fails itself.
+ *
+ * Processes are forked from the main thread while no other threads are
+ * running, so a forked process can't inherit locks held by other threads. */
+
+typedef struct bake_test_child {
+    pid_t pid;
+    bake_test_item *item;
+    int32_t retry_count;
+    struct timespec start;
+} bake_test_child;
+
+static
+void bake_test_fork_case(
+    bake_test_suite_run *run,
+    bake_test_case *test)
+{
+    bake_test_suite *suite = run->suite;
+
+    /* Pass values of suite parameters to test_param, like the command line
+     * of the test executable does */
+    uint32_t p;
+    for (p = 0; p < suite->param_count; p ++) {
+        bake_test_param *param = &suite->params[p];
+        if (!test_param(param->name)) {
+            bake_add_param(ut_asprintf("%s=%s", param->name,
+                param->values[run->values[p]]));
+        }
+    }
+
+    char *test_name = ut_asprintf("%s.%s", suite->id, test->id);
+    int result = bake_test_run_single_test(suite, 1, test_name);
+    free(test_name);
+
+    ut_deinit();
+
+    exit(result);
+}
+
+static
+int16_t bake_test_fork(
+    bake_test_queue *queue,
+    bake_test_child *child)
+{
+    bake_test_suite *suite = child->item->run->suite;
+    bake_test_case *test = child->item->test;
+
+    /* Don't let buffered output end up in both processes */
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        ut_log("Testcase '%s.%s' failed to start: %s\n",
+            suite->id, test->id, strerror(errno));
+        bake_test_finish(queue, child->item, BAKE_TEST_FAIL);
+        return -1;
+    }
+
+    if (!pid) {
+        bake_test_fork_case(child->item->run, test);
+    }
+
+    child->pid = pid;
+    timespec_gettime(&child->start);
+
+    return 0;
+}
+
+static
+void bake_test_fork_queue(
+    bake_test_queue *queue,
+    uint32_t job_count)
+{
+    bake_test_child *children = ut_calloc(sizeof(bake_test_child) * job_count);
+    uint32_t i, running = 0;
+
+    while (queue->next < queue->count || running) {
+        /* Start testcases until all jobs are running */
+        for (i = 0; i < job_count && queue->next < queue->count; i ++) {
+            if (!children[i].pid) {
+                children[i].item = &queue->items[queue->next ++];
+                children[i].retry_count = 0;
+                if (!bake_test_fork(queue, &children[i])) {
+                    running ++;
                 }
-                *fail += test_fail;
-                *empty += test_empty;
-                *pass += test_pass;
+            }
+        }
+
+        if (!running) {
+            continue;
+        }
+
+        int status;
+        struct rusage usage;
+        pid_t pid = wait4(-1, &status, 0, &usage);
+        if (pid == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ut_error("waiting for testcases failed: %s", strerror(errno));
+            break;
+        }
+
+        bake_test_child *child = NULL;
+        for (i = 0; i < job_count; i ++) {
+            if (children[i].pid == pid) {
+                child = &children[i];
+                break;
+            }
+        }
+
+        if (!child) {
+            continue;
+        }
+
+        running --;
+        child->pid = 0;
+
+        bake_test_timing *timing = &child->item->timing;
+        timing->wall = timespec_measure(&child->start);
+        timing->cpu = 
+            usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0 +
+            usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0;
+#ifdef __APPLE__
+        timing->rss = usage.ru_maxrss / 1024; /* Reported in bytes */
+#else
+        timing->rss = usage.ru_maxrss;
+#endif
+        child->item->measured = true;
+
+        int sig = 0;
+        int8_t rc = 0;
+        if (WIFSIGNALED(status)) {
+            sig = WTERMSIG(status);
+        } else {
+            rc = WEXITSTATUS(status);
+        }
+
+        if (bake_test_result(
+            queue, child->item, sig, rc, &child->retry_count)) 
+        {
+            if (!bake_test_fork(queue, child)) {
+                running ++;
             }
         }
     }
 
-    return result;
+    free(children);
+}
+
+#endif
+
+/* Testcases are forked from the test executable, unless they need to be
+ * started with a prefix command (like valgrind) or forking is disabled */
+static
+bool bake_test_use_fork(void)
+{
+#ifndef _WIN32
+    return !test_no_fork && !ut_getenv("BAKE_TEST_PREFIX");
+#else
+    return false;
+#endif
+}
+
+/* Testcases without history run first, in the order in which they were
+ * added, as they could be slow. Other testcases run longest first. */
+static
+int bake_test_item_compare(
+    const void *ptr1,
+    const void *ptr2)
+{
+    const bake_test_item *item1 = ptr1, *item2 = ptr2;
+
+    if ((item1->expected < 0) != (item2->expected < 0)) {
+        return item1->expected < 0 ? -1 : 1;
+    }
+
+    if (item1->expected != item2->expected) {
+        return item1->expected > item2->expected ? -1 : 1;
+    }
+
+    return item1->order - item2->order;
+}
+
+static
+int bake_test_item_compare_measured(
+    const void *ptr1,
+    const void *ptr2)
+{
+    const bake_test_item *item1 = *(bake_test_item* const*)ptr1;
+    const bake_test_item *item2 = *(bake_test_item* const*)ptr2;
+
+    if (item1->timing.wall != item2->timing.wall) {
+        return item1->timing.wall > item2->timing.wall ? -1 : 1;
+    }
+
+    return item1->order - item2->order;
+}
+
+/* Print testcases that took the most time in this run */
+static
+void bake_test_print_slowest(
+    bake_test_queue *queue,
+    int32_t count)
+{
+    bake_test_item **items = ut_calloc(sizeof(bake_test_item*) * queue->count);
+    int32_t i, measured = 0;
+
+    for (i = 0; i < queue->count; i ++) {
+        if (queue->items[i].measured) {
+            items[measured ++] = &queue->items[i];
+        }
+    }
+
+    qsort(items, measured, sizeof(bake_test_item*), 
+        bake_test_item_compare_measured);
+
+    if (count > measured) {
+        count = measured;
+    }
+
+    if (count) {
+        ut_log("slowest testcases:\n");
+    }
+
+    for (i = 0; i < count; i ++) {
+        bake_test_timing *timing = &items[i]->timing;
+        if (timing->rss) {
+            ut_log("#[]%9.3fs #[grey](cpu %.3fs, rss %lldKB)#[reset] %s\n", 
+                timing->wall, timing->cpu, (long long)timing->rss, 
+                items[i]->key);
+        } else {
+            ut_log("#[]%9.3fs %s\n", timing->wall, items[i]->key);
+        }
+    }
+
+    if (count) {
+        ut_log("\n");
+    }
+
+    free(items);
+}
+
+/* Run testcases in the queue that haven't run yet */
+static
+void bake_test_queue_run(
+    bake_test_queue *queue,
+    uint32_t job_count)
+{
+    if (queue->next >= queue->count) {
+        return;
+    }
+
+    qsort(&queue->items[queue->next], queue->count - queue->next, 
+        sizeof(bake_test_item), bake_test_item_compare);
+
+    if (bake_test_use_fork()) {
+#ifndef _WIN32
+        bake_test_fork_queue(queue, job_count);
+#endif
+    } else {
+        uint32_t i, remaining = queue->count - queue->next;
+        if (job_count > remaining) {
+            job_count = remaining;
+        }
+
+        ut_thread *jobs = ut_calloc(sizeof(ut_thread) * job_count);
+
+        for (i = 0; i < job_count; i ++) {
+            jobs[i] = ut_thread_new((ut_thread_cb)bake_test_job, queue);
+        }
+
+        for (i = 0; i < job_count; i ++) {
+            ut_thread_join(jobs[i], NULL);
+        }
+
+        /* Jobs increment next past the last item before they stop */
+        queue->next = queue->count;
+
+        free(jobs);
+    }
 }
 
 static
@@ -497,61 +1306,95 @@ int8_t bake_test_run_all_tests(
     const char *exec,
     bake_test_suite *suites,
     uint32_t suite_count,
+    const bool *in_shard,
     uint32_t job_count)
 {
     int8_t result = 0;
-
     uint32_t total_fail = 0, total_empty = 0, total_pass = 0;
-    uint32_t fail = 0, empty = 0, pass = 0;
+
+    bake_test_queue queue;
+    bake_test_queue_init(&queue, test_id, exec);
 
     ut_log("\n");
 
-    uint32_t i;
+    uint32_t i, offset = 0;
     for (i = 0; i < suite_count; i ++) {
-        bake_test_suite *suite = &suites[i];
-
-        fail = 0;
-        empty = 0;
-        pass = 0;
+        bake_test_queue_add(&queue, &suites[i], 
+            in_shard ? &in_shard[offset] : NULL);
+        offset += suites[i].testcase_count;
+    }
 
-        if (!suite->param_count) {
-            if (bake_test_run_suite(
-                test_id, exec, suite, &fail, &empty, &pass, job_count)) 
-            {
-                result = -1;
-            }
-        } else {
-            bake_test_run_suite_for_param(
-                test_id, exec, suite, &fail, &empty, &pass, job_count, 0);
-        }
+    bake_test_queue_run(&queue, job_count);
 
-        if (empty || fail) {
-            ut_log("\n");
-        }
+    int32_t r;
+    for (r = 0; r < queue.run_count; r ++) {
+        bake_test_suite_run *run = queue.runs[r];
+        total_fail += run->fail;
+        total_empty += run->empty;
+        total_pass += run->pass;
+        result |= run->result;
+    }
 
-        total_fail += fail;
-        total_empty += empty;
-        total_pass += pass;
+    /* The history is the input of the shard assignment, don't change it */
+    if (!in_shard && bake_test_history_save(&queue, true)) {
+        ut_raise();
     }
 
     ut_log("-----------------------------\n");
     bake_test_report(test_id, "all", "", total_fail, total_empty, total_pass);
     ut_log("\n");
 
+    bake_test_print_slowest(&queue, test_slowest);
+
+    bake_test_queue_deinit(&queue);
+
+    return result;
+}
+
+static
+int8_t bake_test_run_suite(
+    const char *test_id,
+    const char *exec,
+    bake_test_suite *suite,
+    const bool *in_shard,
+    uint32_t job_count)
+{
+    bake_test_queue queue;
+    bake_test_queue_init(&queue, test_id, exec);
+
+    bake_test_queue_add(&queue, suite, in_shard);
+    bake_test_queue_run(&queue, job_count);
+
+    int8_t result = 0;
+    int32_t r;
+    for (r = 0; r < queue.run_count; r ++) {
+        result |= queue.runs[r]->result;
+    }
+
+    if (!in_shard && bake_test_history_save(&queue, false)) {
+        ut_raise();
+    }
+
+    bake_test_queue_deinit(&queue);
+
     return result;
 }
 
 static
 void bake_list_tests(
     bake_test_suite *suites,
-    uint32_t suite_count)
+    uint32_t suite_count,
+    const bool *in_shard)
 {
-    uint32_t i, t;
+    uint32_t i, t, offset = 0;
     for (i = 0; i < suite_count; i ++) {
         bake_test_suite *suite = &suites[i];
         for (t = 0; t < suite->testcase_count; t ++) {
-            printf("%s.%s\n", suite->id, suite->testcases[t].id);
+            if (!in_shard || in_shard[offset + t]) {
+                printf("%s.%s\n", suite->id, suite->testcases[t].id);
+            }
         }
+        offset += suite->testcase_count;
     }
 }
 
@@ -570,14 +1413,18 @@ static
 void bake_list_commands(
     const char *exec,
     bake_test_suite *suites,
-    uint32_t suite_count)
+    uint32_t suite_count,
+    const bool *in_shard)
 {
-    uint32_t i, t;
+    uint32_t i, t, offset = 0;
     for (i = 0; i < suite_count; i ++) {
         bake_test_suite *suite = &suites[i];
         for (t = 0; t < suite->testcase_count; t ++) {
-            printf("%s %s.%s\n", exec, suite->id, suite->testcases[t].id);
+            if (!in_shard || in_shard[offset + t]) {
+                printf("%s %s.%s\n", exec, suite->id, suite->testcases[t].id);
+            }
         }
+        offset += suite->testcase_count;
     }
 }
 
@@ -589,8 +1436,10 @@ int bake_test_run(
     uint32_t suite_count)
 {
     const char *single_test = NULL;
+    const char *shard = ut_getenv("BAKE_TEST_SHARD");
     bake_test_suite *suite = NULL;
     int32_t job_count = 0;
+    bool list_tests = false, list_suites = false, list_commands = false;
 
     ut_init(test_id);
 
@@ -600,13 +1449,32 @@ int bake_test_run(
         if (arg[0] == '-') {
             if (arg[1] == '-') {
                 if (!strcmp(arg, "--list-tests")) {
-                    bake_list_tests(suites, suite_count);
+                    list_tests = true;
 
                 } else if (!strcmp(arg, "--list-suites")) {
-                    bake_list_suites(suites, suite_count);
+                    list_suites = true;
 
                 } else if (!strcmp(arg, "--list-commands")) {
-                    bake_list_commands(argv[0], suites, suite_count);
+                    list_commands = true;
+
+                } else if (!strcmp(arg, "--shard")) {
+                    if (!argv[i + 1]) {
+                        ut_error("missing argument for --shard");
+                        abort();
+                    }
+                    shard = argv[i + 1];
+                    i ++;
+
+                } else if (!strcmp(arg, "--no-fork")) {
+                    test_no_fork = true;
+
+                } else if (!strcmp(arg, "--slowest")) {
+                    if (!argv[i + 1]) {
+                        ut_error("missing argument for --slowest");
+                        abort();
+                    }
+                    test_slowest = atoi(argv[i + 1]);
+                    i ++;
 
                 } else if (!strcmp(arg, "--param")) {
                     if (!argv[i + 1]) {
@@ -649,18 +1517,43 @@ int bake_test_run(
         job_count = 8; /* run on 8 threads by default */
     }
 
+    if (shard && shard[0] && bake_test_shard_parse(shard)) {
+        ut_raise();
+        abort();
+    }
+
     int result = 0;
+    bool *in_shard = NULL;
+    if (!single_test) {
+        in_shard = bake_test_shard_select(argv[0], suites, suite_count);
+    }
 
-    if (single_test) {
+    if (list_tests || list_suites || list_commands) {
+        if (list_tests) {
+            bake_list_tests(suites, suite_count, in_shard);
+        }
+        if (list_suites) {
+            bake_list_suites(suites, suite_count);
+        }
+        if (list_commands) {
+            bake_list_commands(argv[0], suites, suite_count, in_shard);
+        }
+    } else if (single_test) {
         result = bake_test_run_single_test(suites, suite_count, argv[1]);
     } else if (suite) {
-        result = bake_test_run_suite(
-            test_id, argv[0], suite, NULL, NULL, NULL, job_count);
+        uint32_t i, offset = 0;
+        for (i = 0; &suites[i] != suite; i ++) {
+            offset += suites[i].testcase_count;
+        }
+        result = bake_test_run_suite(test_id, argv[0], suite, 
+            in_shard ? &in_shard[offset] : NULL, job_count);
     } else {
         result = bake_test_run_all_tests(
-            test_id, argv[0], suites, suite_count, job_count);
+            test_id, argv[0], suites, suite_count, in_shard, job_count);
     }
 
+    free(in_shard);
+
     ut_deinit();
 
     return result;
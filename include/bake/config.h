@@ -63,6 +63,9 @@ struct bake_config {
     bool sanitize_undefined;    /* Enable UB sanitizier (if supported) */
     bool loop_test;             /* Enable analysis for SIMD loops */
     bool assembly;              /* Enable assembly output */
+    int32_t jobs;               /* Max number of jobs to run in parallel */
+    bool cache;                 /* Enable object cache in $BAKE_HOME/cache */
+    uint64_t cache_size;        /* Max size of object cache in bytes */
 
     /* Environment attribubtes */
     ut_ll env_variables;        /* List with environment variable names */
@@ -75,6 +75,23 @@ char* (*bake_rule_map_cb)(
     bake_project *project,
     const char *input);
 
+/** Rule command callback */
+typedef
+char* (*bake_rule_command_cb)(
+    bake_driver_api *driver,
+    bake_config *config,
+    bake_project *project,
+    char *src,
+    char *target);
+
+/** Sources callback */
+typedef
+ut_ll (*bake_sources_cb)(
+    bake_driver_api *driver,
+    bake_config *config,
+    bake_project *project,
+    ut_ll sources);
+
 
 /* Bake target is a convenience type wrapped by functions that lets users
  * specify different kinds of targets as argument type. */
@@ -287,6 +304,37 @@ struct bake_driver_api {
 
     /* Get direct access to parson data */
     JSON_Object* (*get_json)(void);
+
+    /* Set callback that returns the command a map rule runs for a file. If the
+     * command is different from the one used in the previous build, the target
+     * is rebuilt. */
+    void (*rule_command)(
+        const char *name,
+        bake_rule_command_cb command);
+
+    /* Copy object stored under key in the object cache to target. Returns
+     * false if the cache is disabled or doesn't contain the object. */
+    bool (*cache_get)(
+        uint64_t key,
+        const char *target);
+
+    /* Store object in the object cache under key */
+    void (*cache_put)(
+        uint64_t key,
+        const char *target);
+
+    /* Callback that can replace the files matched by SOURCES. The callback
+     * receives the paths of the matched files relative to the project, and
+     * returns a new list of paths (relative to the project), or NULL to keep
+     * the files. Bake takes ownership of the returned list. */
+    void (*sources)(
+        bake_sources_cb action);
+
+    /* Execute a command with an argument vector. Arguments are passed to the
+     * process as-is, which avoids quoting issues and limits on the number of
+     * arguments of exec. The array must be terminated with NULL. */
+    void (*exec_argv)(
+        const char *argv[]);
 };
 
 #endif
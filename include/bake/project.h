@@ -152,6 +152,9 @@ struct bake_project {
     /* filelist with generated sources (set before build) */
     void *generated_sources;
 
+    /* Content hashes of inputs used to build outputs (loaded during build) */
+    void *build_state;
+
     /* Files to be cleaned other than objects and artefact (populated by
      * language binding) */
     ut_ll files_to_clean;
@@ -78,6 +78,10 @@ int16_t bake_config_load(
 void bake_config_log(
     bake_config *cfg);
 
+/** Find configuration files loaded by bake_config_load. Returns NULL if there
+ * are none, otherwise a list of paths that must be freed by the caller. */
+ut_ll bake_config_find_config(void);
+
 /** Export variable to bake configuration */
 int16_t bake_config_export(
     bake_config *cfg,
@@ -244,6 +248,7 @@ typedef struct bake_driver_impl {
     bake_driver_cb test;            /* Stage before test */
     bake_driver_cb coverage;        /* Coverage analysis */
     bake_driver_cb clean;           /* Specify files to clean */
+    bake_sources_cb sources;        /* Replace files matched by SOURCES */
 } bake_driver_impl;
 
 /** Driver type */
@@ -261,6 +266,9 @@ struct bake_driver {
     bake_driver_impl impl;        /* See above */
 };
 
+/* Initialize lock that protects loaded drivers */
+int16_t bake_driver_init(void);
+
 /* Find or load driver */
 bake_driver* bake_driver_get(
     const char *id);
@@ -342,11 +350,19 @@ typedef struct bake_file {
     uint64_t timestamp;     /* Last modified timestamp */
 } bake_file;
 
-/** A filelist is populated with files inside a path that match a pattern */
+/** A filelist is populated with files inside a path that match a pattern.
+ * Files and their strings are allocated in chunks owned by the filelist, so
+ * pointers to files remain valid until the filelist is freed. */
 typedef struct bake_filelist {
     char *path;             /* Path in which filelist applies pattern */
     char *pattern;          /* Pattern used to match against files */
-    ut_ll files;            /* List of matched files (bake_file) */
+    bake_file **files;      /* Matched files, in the order they were added */
+    int32_t count;          /* Number of files */
+    int32_t size;           /* Number of elements allocated for files */
+    int32_t *index;         /* Hash index on file_path (position in files + 1) */
+    int32_t index_size;     /* Number of buckets in index (power of 2) */
+    int32_t indexed;        /* Number of files added to index */
+    struct bake_filelist_chunk *chunks; /* Storage for files and strings */
     int16_t (*set)(const char *pattern);
 } bake_filelist;
 
@@ -379,6 +395,11 @@ int16_t bake_filelist_add_pattern(
     const char *path,
     const char *pattern);
 
+/** Find file by its file_path, returns NULL if not found */
+bake_file* bake_filelist_find(
+    bake_filelist *fl,
+    const char *file_path);
+
 /** Merge two filelists into destination */
 int16_t bake_filelist_merge(
     bake_filelist *dst,
@@ -415,6 +436,7 @@ typedef struct bake_rule {
     const char *source;     /* Source pattern */
     bake_rule_target target;      /* Rule target (MAP or PATTERN) */
     bake_rule_action_cb action;   /* Action to execute for rule */
+    bake_rule_command_cb command; /* Returns command that action will run */
 } bake_rule;
 
 /** Dependency rule
@@ -467,6 +489,263 @@ int16_t bake_node_eval(
     bake_filelist *outputs);
 
 
+/* -- Build state -- */
+
+/** The build state records for each output of a rule the content hashes of its
+ * inputs, so that outputs are only rebuilt when the content of an input changed,
+ * and not just its timestamp. */
+typedef struct bake_build_state bake_build_state;
+
+/** Load build state of project from file. Returns empty state if file doesn't
+ * exist. */
+bake_build_state* bake_build_state_load(
+    bake_project *project,
+    const char *file);
+
+/** Write build state to file, if it changed. */
+int16_t bake_build_state_save(
+    bake_build_state *state);
+
+/** Free build state. */
+void bake_build_state_free(
+    bake_build_state *state);
+
+/** Test if content of input changed since it was recorded for output. Returns
+ * true if input was not recorded for output. */
+bool bake_build_state_changed(
+    bake_build_state *state,
+    const char *output,
+    const char *input);
+
+/** Remove recorded inputs for output. */
+void bake_build_state_reset(
+    bake_build_state *state,
+    const char *output);
+
+/** Record current content of input for output. Replaces existing record. */
+int16_t bake_build_state_add(
+    bake_build_state *state,
+    const char *output,
+    const char *input);
+
+/** Test if hash of the command that creates output is different from the hash
+ * that was recorded. Returns true if output was not recorded. */
+bool bake_build_state_command_changed(
+    bake_build_state *state,
+    const char *output,
+    uint64_t command);
+
+/** Record source, dependencies from the dependency file and hash of the command
+ * (0 if unknown) for output. */
+int16_t bake_build_state_record(
+    bake_build_state *state,
+    const char *output,
+    const char *source,
+    uint64_t command);
+
+/** Callback for dependencies in dependency file. Return false to stop. */
+typedef bool (*bake_depfile_cb)(
+    const char *dep,
+    void *ctx);
+
+/** Walk dependencies in the dependency file generated by the compiler for a
+ * target (a makefile rule stored in the target path with a .d extension). The
+ * first dependency, which is the source of the target, is skipped. Relative
+ * dependencies are passed as absolute paths, as they are relative to the
+ * directory from which the target was compiled. Returns -1 if target has no
+ * dependency file. */
+int16_t bake_depfile_walk(
+    const char *target,
+    bake_depfile_cb callback,
+    void *ctx);
+
+/* -- Object cache -- */
+
+/** Parse cache size with optional K, M or G suffix. */
+uint64_t bake_cache_parse_size(
+    const char *str);
+
+/** Initialize object cache, if enabled in configuration. */
+int16_t bake_cache_init(
+    bake_config *config);
+
+/** Update cache statistics, evict objects if cache is too large. */
+void bake_cache_deinit(void);
+
+/** Copy object stored under key to target. Returns false if not in cache. */
+bool bake_cache_get(
+    uint64_t key,
+    const char *target);
+
+/** Store target in the cache under key. */
+int16_t bake_cache_put(
+    uint64_t key,
+    const char *target);
+
+/** Run cache command (stats or clear). */
+int16_t bake_cache_cmd(
+    bake_config *config,
+    const char *cmd);
+
+/* -- Crawl cache -- */
+
+typedef struct bake_crawl_cache bake_crawl_cache;
+
+/** Directory visited while discovering projects. */
+typedef struct bake_crawl_cache_dir {
+    char *path;             /* Path relative to searched path */
+    time_t modified;        /* Last modified time of directory */
+    bool project;           /* Does directory contain a project.json */
+    ut_ll dirs;             /* Names of subdirectories */
+} bake_crawl_cache_dir;
+
+/** Load crawl cache from file. Returns an empty cache if the file does not
+ * exist or is invalid. */
+bake_crawl_cache* bake_crawl_cache_load(
+    const char *file);
+
+/** Get cached directory, or NULL if the directory was modified since it was
+ * added to the cache. */
+bake_crawl_cache_dir* bake_crawl_cache_get(
+    bake_crawl_cache *cache,
+    const char *path,
+    time_t modified);
+
+/** Add directory to cache. The cache takes ownership of dirs. */
+bake_crawl_cache_dir* bake_crawl_cache_set(
+    bake_crawl_cache *cache,
+    const char *path,
+    time_t modified,
+    bool project,
+    ut_ll dirs);
+
+/** Write directories visited since cache was loaded to file. */
+int16_t bake_crawl_cache_save(
+    bake_crawl_cache *cache);
+
+/** Free crawl cache. */
+void bake_crawl_cache_free(
+    bake_crawl_cache *cache);
+
+/* -- Trace -- */
+
+/** Start recording a trace that is written to file in Chrome Trace Event
+ * format when bake_trace_deinit is called. */
+int16_t bake_trace_init(
+    const char *file);
+
+/** Write trace file, if a trace is being recorded. */
+void bake_trace_deinit(void);
+
+/** Microseconds since start of trace (0 if not recording a trace). */
+uint64_t bake_trace_now(void);
+
+/** Record beginning of a scope on the track of the current thread. */
+void bake_trace_begin(
+    const char *cat,
+    const char *name);
+
+/** Record end of a scope on the track of the current thread. */
+void bake_trace_end(
+    const char *cat,
+    const char *name);
+
+/** Record a command that started at start (obtained with bake_trace_now). */
+void bake_trace_command(
+    const char *name,
+    const char *cmd,
+    uint64_t start,
+    ut_proc pid,
+    int8_t rc,
+    int sig);
+
+/* -- Server -- */
+
+/** Callback that discovers and builds projects for a server request. After a
+ * build the callback adds files to outputs that are not watched by the server
+ * but that must not change for the projects to be up to date, like artefacts
+ * and dependencies. */
+typedef int16_t (*bake_server_build_cb)(
+    bake_config *config,
+    const char *action,
+    ut_ll outputs);
+
+/** Record environment that clients and the server compare before a build.
+ * Must be called before the configuration is loaded, which changes the
+ * environment. */
+void bake_server_init(void);
+
+/** Run server that builds projects in path on request of clients, until the
+ * process is interrupted. */
+int16_t bake_server_run(
+    bake_config *config,
+    const char *path,
+    bake_server_build_cb build);
+
+/** Let server that runs for path run action. Returns -1 if no server is
+ * running, otherwise 0 and the exit code of the build in rc_out. */
+int16_t bake_server_request(
+    const char *path,
+    const char *action,
+    int8_t *rc_out);
+
+/* -- Jobs -- */
+
+/** Job that invokes a rule action for a single source file. Jobs are executed
+ * by the worker threads of a job pool, which allows a rule that maps sources
+ * to targets (like compiling C files) to run multiple actions in parallel. */
+typedef struct bake_job {
+    bake_rule_action_cb action; /* Action to invoke */
+    char *source;           /* Path to source file */
+    bake_file *target;      /* Target file */
+    const char *name;       /* Name of task used in messages */
+    uint64_t command;       /* Hash of command invoked by action */
+    FILE *output;           /* Captures output of commands invoked by job */
+    bool error;             /* Set when a command invoked by job failed */
+} bake_job;
+
+typedef struct bake_job_pool bake_job_pool;
+
+/** Initialize the job slots shared by all projects. The number of slots is
+ * the number of jobs configured with -j. */
+int16_t bake_jobs_init(
+    bake_config *config);
+
+/** Free the job slots. */
+void bake_jobs_deinit(void);
+
+/** Take a job slot, block if none are available. */
+void bake_jobs_acquire(void);
+
+/** Return a job slot. */
+void bake_jobs_release(void);
+
+/** Create new job pool. Returns NULL if the pool would run jobs serially. */
+bake_job_pool* bake_job_pool_new(
+    bake_driver *driver,
+    bake_project *project,
+    bake_config *config);
+
+/** Submit job to pool. If no job slot is available the job runs in the calling
+ * thread before the function returns. Returns -1 if a previously submitted job
+ * failed, in which case no new jobs are accepted. */
+int16_t bake_job_pool_submit(
+    bake_job_pool *pool,
+    bake_rule_action_cb action,
+    const char *source,
+    bake_file *target,
+    uint64_t command,
+    const char *name,
+    const char *progress);
+
+/** Wait until all submitted jobs have finished and free pool. Returns -1 if
+ * any of the jobs failed. */
+int16_t bake_job_pool_wait(
+    bake_job_pool *pool);
+
+/** Return job that is running in the current thread, or NULL if none. */
+bake_job* bake_job_current(void);
+
 /* Attribute API */
 
 /** Parse JSON object into list of attributes */
@@ -80,6 +80,20 @@ error:
     return -1;
 }
 
+static
+void bake_build_state_save_and_free(
+    bake_project *project)
+{
+    if (project->build_state) {
+        if (bake_build_state_save(project->build_state)) {
+            /* Not fatal, next build will fall back to timestamps */
+            ut_raise();
+        }
+        bake_build_state_free(project->build_state);
+        project->build_state = NULL;
+    }
+}
+
 /* At this stage, the project configuration is fully loaded (including dependee
  * configuration), and all dependencies are built or found in the bake env. */
 static
@@ -97,12 +111,6 @@ int bake_do_build_intern(
         rebuild = true;
     }
 
-    /* If any of the steps invoke bake, they may invoke the bake script, which
-     * can reset the LD_LIBRARY_PATH environment variable. Setting this variable
-     * to false will cause bake to fork itself again after the environment is
-     * set correctly. */
-    ut_setenv("BAKE_CHILD", "FALSE");
-
     /* Step 5: if rebuilding, clean project cache for current platform/config */
     if (rebuild) {
         ut_log_push("clean-cache");
@@ -127,6 +135,15 @@ int bake_do_build_intern(
         ut_log_pop();
     }
 
+    /* Load content hashes of inputs from the previous build, so that files
+     * that have a new timestamp but unchanged content don't trigger a rebuild */
+    if (!project->build_state) {
+        char *file = ut_asprintf(
+            "%s"UT_OS_PS"build-state", project->cache_path);
+        project->build_state = bake_build_state_load(project, file);
+        free(file);
+    }
+
     /* Step 6: now that project config is fully loaded, check dependencies */
     ut_log_push("validate-dependencies");
     ut_try (bake_project_check_dependencies(config, project), NULL);
@@ -173,12 +190,12 @@ int bake_do_build_intern(
         ut_try (bake_install_postbuild(config, project), NULL);
     ut_log_pop();
 
-    /* Reset environment variable */
-    ut_setenv("BAKE_CHILD", "TRUE");
+    bake_build_state_save_and_free(project);
 
     return (project->error == true) * -1;
 error:
     ut_log_pop();
+    bake_build_state_save_and_free(project);
     return -1;
 }
 
@@ -0,0 +1,785 @@
+/* Copyright (c) 2010-2019 Sander Mertens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "bake.h"
+
+/* The build state is stored in a binary file with fixed size records, so that
+ * it can be loaded with a single read (or mapped in memory). The file contains
+ * a header, followed by an array with outputs, an array with inputs and a
+ * string table. Outputs refer to a range in the inputs array, and outputs and
+ * inputs refer to their path with an offset into the string table.
+ *
+ * Paths of files in the project are stored relative to the project, other
+ * paths are stored as absolute paths, so that the state can be used no matter
+ * from which directory the project is built. */
+
+#define BAKE_BUILD_STATE_MAGIC "BKST"
+#define BAKE_BUILD_STATE_VERSION (3)
+
+typedef struct bake_build_state_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t output_count;
+    uint32_t input_count;
+    uint32_t strings_size;
+    uint32_t reserved;
+} bake_build_state_header;
+
+typedef struct bake_build_state_output_record {
+    uint32_t path;          /* Offset into string table */
+    uint32_t input_start;   /* Index of first input */
+    uint32_t input_count;   /* Number of inputs */
+    uint32_t reserved;
+    uint64_t command;       /* Hash of command that created output */
+} bake_build_state_output_record;
+
+typedef struct bake_build_state_input_record {
+    uint32_t path;          /* Offset into string table */
+    uint32_t reserved;
+    uint64_t hash;          /* Hash of file content */
+    int64_t modified;       /* Last modified time when hash was computed */
+    uint64_t size;          /* File size when hash was computed */
+} bake_build_state_input_record;
+
+typedef struct bake_build_input {
+    char *path;
+    uint64_t hash;
+    int64_t modified;
+    uint64_t size;
+} bake_build_input;
+
+typedef struct bake_build_output {
+    char *path;
+    bake_build_input *inputs;
+    uint32_t input_count;
+    uint32_t input_size;
+    uint64_t command;
+} bake_build_output;
+
+/* Content hash of a file, cached for the duration of a build so that files
+ * used by many outputs (like headers) are only hashed once */
+typedef struct bake_build_file {
+    char *path;
+    int64_t modified;
+    uint64_t size;
+    uint64_t hash;
+} bake_build_file;
+
+struct bake_build_state {
+    char *file;             /* File from which state is loaded */
+    char *project_path;     /* Absolute path of project */
+    char *cwd;              /* Directory from which project is built */
+    ut_rb outputs;          /* Outputs by path (bake_build_output) */
+    ut_rb files;            /* Hashed files by path (bake_build_file) */
+    struct ut_mutex_s lock; /* State may be updated by parallel jobs */
+    bool changed;           /* Does state need to be written to disk */
+};
+
+static
+int bake_build_state_strcmp(
+    void *ctx,
+    const void* key1,
+    const void* key2)
+{
+    return strcmp(key1, key2);
+}
+
+/* Get path as it is stored in the state */
+static
+char* bake_build_state_key(
+    bake_build_state *state,
+    const char *path)
+{
+    char *result;
+    if (ut_path_is_relative(path)) {
+        result = ut_asprintf("%s"UT_OS_PS"%s", state->cwd, path);
+    } else {
+        result = ut_strdup(path);
+    }
+    ut_path_clean(result, result);
+
+    size_t len = strlen(state->project_path);
+    if (!strncmp(result, state->project_path, len) &&
+        result[len] == UT_OS_PS[0])
+    {
+        memmove(result, &result[len + 1], strlen(&result[len + 1]) + 1);
+    }
+
+    return result;
+}
+
+static
+bake_build_output* bake_build_state_get_output(
+    bake_build_state *state,
+    const char *path)
+{
+    bake_build_output *output = ut_rb_find(state->outputs, path);
+    if (!output) {
+        output = ut_calloc(sizeof(bake_build_output));
+        output->path = ut_strdup(path);
+        ut_rb_set(state->outputs, output->path, output);
+    }
+
+    return output;
+}
+
+static
+bake_build_input* bake_build_output_add_input(
+    bake_build_output *output,
+    const char *path)
+{
+    if (output->input_count == output->input_size) {
+        output->input_size = output->input_size ? output->input_size * 2 : 8;
+        output->inputs = realloc(output->inputs,
+            output->input_size * sizeof(bake_build_input));
+    }
+
+    bake_build_input *input = &output->inputs[output->input_count ++];
+    input->path = ut_strdup(path);
+    return input;
+}
+
+static
+void bake_build_output_clear(
+    bake_build_output *output)
+{
+    uint32_t i;
+    for (i = 0; i < output->input_count; i ++) {
+        free(output->inputs[i].path);
+    }
+    output->input_count = 0;
+}
+
+/* Obtain content hash of file, only hash file if it changed since it was last
+ * hashed in this build. */
+static
+int16_t bake_build_state_hash_file(
+    bake_build_state *state,
+    const char *path,
+    int64_t modified,
+    uint64_t size,
+    uint64_t *hash_out)
+{
+    bake_build_file *file = ut_rb_find(state->files, path);
+    if (!file || file->modified != modified || file->size != size) {
+        uint64_t hash;
+        if (ut_file_hash(path, &hash)) {
+            goto error;
+        }
+
+        if (!file) {
+            file = ut_calloc(sizeof(bake_build_file));
+            file->path = ut_strdup(path);
+            ut_rb_set(state->files, file->path, file);
+        }
+
+        file->modified = modified;
+        file->size = size;
+        file->hash = hash;
+    }
+
+    *hash_out = file->hash;
+
+    return 0;
+error:
+    return -1;
+}
+
+static
+int16_t bake_build_state_parse(
+    bake_build_state *state,
+    const char *buffer,
+    size_t size)
+{
+    const bake_build_state_header *hdr = (void*)buffer;
+    if (size < sizeof(bake_build_state_header)) {
+        goto error;
+    }
+
+    if (memcmp(hdr->magic, BAKE_BUILD_STATE_MAGIC, 4) ||
+        hdr->version != BAKE_BUILD_STATE_VERSION)
+    {
+        goto error;
+    }
+
+    size_t outputs_size =
+        hdr->output_count * sizeof(bake_build_state_output_record);
+    size_t inputs_size =
+        hdr->input_count * sizeof(bake_build_state_input_record);
+
+    if (size != sizeof(bake_build_state_header) + outputs_size + inputs_size +
+        hdr->strings_size || !hdr->strings_size)
+    {
+        goto error;
+    }
+
+    const bake_build_state_output_record *outputs = (void*)&hdr[1];
+    const bake_build_state_input_record *inputs = (void*)&outputs[hdr->output_count];
+    const char *strings = (void*)&inputs[hdr->input_count];
+
+    if (strings[hdr->strings_size - 1] != '\0') {
+        goto error;
+    }
+
+    uint32_t i, j;
+    for (i = 0; i < hdr->output_count; i ++) {
+        const bake_build_state_output_record *o = &outputs[i];
+        if (o->path >= hdr->strings_size ||
+            o->input_start + o->input_count > hdr->input_count)
+        {
+            goto error;
+        }
+
+        bake_build_output *output =
+            bake_build_state_get_output(state, &strings[o->path]);
+        output->command = o->command;
+
+        for (j = 0; j < o->input_count; j ++) {
+            const bake_build_state_input_record *in = &inputs[o->input_start + j];
+            if (in->path >= hdr->strings_size) {
+                goto error;
+            }
+
+            bake_build_input *input =
+                bake_build_output_add_input(output, &strings[in->path]);
+            input->hash = in->hash;
+            input->modified = in->modified;
+            input->size = in->size;
+        }
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+static
+void bake_build_state_clear(
+    bake_build_state *state)
+{
+    ut_iter it = ut_rb_iter(state->outputs);
+    while (ut_iter_hasNext(&it)) {
+        bake_build_output *output = ut_iter_next(&it);
+        bake_build_output_clear(output);
+        free(output->inputs);
+        free(output->path);
+        free(output);
+    }
+    ut_rb_free(state->outputs);
+    state->outputs = ut_rb_new(bake_build_state_strcmp, NULL);
+}
+
+bake_build_state* bake_build_state_load(
+    bake_project *project,
+    const char *file)
+{
+    bake_build_state *result = ut_calloc(sizeof(bake_build_state));
+    result->file = ut_strdup(file);
+    result->project_path = ut_strdup(project->fullpath);
+    ut_path_clean(result->project_path, result->project_path);
+    result->cwd = ut_strdup(ut_cwd());
+    result->outputs = ut_rb_new(bake_build_state_strcmp, NULL);
+    result->files = ut_rb_new(bake_build_state_strcmp, NULL);
+    ut_mutex_new(&result->lock);
+
+    if (ut_file_test(file) != 1) {
+        ut_trace("no build state found in '%s'", file);
+        return result;
+    }
+
+    FILE *f = fopen(file, "rb");
+    if (!f) {
+        ut_trace("cannot open build state '%s' (%s)", file, strerror(errno));
+        return result;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    rewind(f);
+
+    if (size > 0) {
+        char *buffer = malloc(size);
+        if (fread(buffer, 1, size, f) != (size_t)size ||
+            bake_build_state_parse(result, buffer, size))
+        {
+            /* If the state is corrupt or from another version, start over. This
+             * just means that outputs are rebuilt based on their timestamps */
+            ut_trace("discard invalid build state '%s'", file);
+            bake_build_state_clear(result);
+        } else {
+            ut_trace("loaded build state for %d outputs from '%s'",
+                ut_rb_count(result->outputs), file);
+        }
+        free(buffer);
+    }
+
+    fclose(f);
+
+    return result;
+}
+
+int16_t bake_build_state_save(
+    bake_build_state *state)
+{
+    FILE *f = NULL;
+    char *tmp_file = NULL;
+
+    if (!state->changed) {
+        return 0;
+    }
+
+    bake_build_state_header hdr = {
+        .magic = BAKE_BUILD_STATE_MAGIC,
+        .version = BAKE_BUILD_STATE_VERSION
+    };
+
+    /* First pass: count records & compute size of string table */
+    ut_iter it = ut_rb_iter(state->outputs);
+    while (ut_iter_hasNext(&it)) {
+        bake_build_output *output = ut_iter_next(&it);
+        uint32_t i;
+        hdr.output_count ++;
+        hdr.input_count += output->input_count;
+        hdr.strings_size += strlen(output->path) + 1;
+        for (i = 0; i < output->input_count; i ++) {
+            hdr.strings_size += strlen(output->inputs[i].path) + 1;
+        }
+    }
+
+    if (!hdr.strings_size) {
+        hdr.strings_size = 1;
+    }
+
+    size_t size = sizeof(bake_build_state_header) +
+        hdr.output_count * sizeof(bake_build_state_output_record) +
+        hdr.input_count * sizeof(bake_build_state_input_record) +
+        hdr.strings_size;
+
+    char *buffer = ut_calloc(size);
+    memcpy(buffer, &hdr, sizeof(hdr));
+
+    bake_build_state_output_record *outputs = (void*)&buffer[sizeof(hdr)];
+    bake_build_state_input_record *inputs = (void*)&outputs[hdr.output_count];
+    char *str = (char*)&inputs[hdr.input_count], *str_ptr = str;
+
+    /* Second pass: write records */
+    uint32_t output_index = 0, input_index = 0;
+    it = ut_rb_iter(state->outputs);
+    while (ut_iter_hasNext(&it)) {
+        bake_build_output *output = ut_iter_next(&it);
+        bake_build_state_output_record *o = &outputs[output_index ++];
+        uint32_t i;
+
+        o->path = str_ptr - str;
+        strcpy(str_ptr, output->path);
+        str_ptr += strlen(output->path) + 1;
+
+        o->input_start = input_index;
+        o->input_count = output->input_count;
+        o->command = output->command;
+
+        for (i = 0; i < output->input_count; i ++) {
+            bake_build_input *input = &output->inputs[i];
+            bake_build_state_input_record *in = &inputs[input_index ++];
+            in->path = str_ptr - str;
+            strcpy(str_ptr, input->path);
+            str_ptr += strlen(input->path) + 1;
+            in->hash = input->hash;
+            in->modified = input->modified;
+            in->size = input->size;
+        }
+    }
+
+    /* Write to temporary file first, so that an interrupted build doesn't
+     * leave a partially written state behind */
+    char *dir = ut_strdup(state->file);
+    char *sep = strrchr(dir, UT_OS_PS[0]);
+    if (sep) {
+        *sep = '\0';
+        if (ut_mkdir(dir)) {
+            free(dir);
+            goto error;
+        }
+    }
+    free(dir);
+
+    tmp_file = ut_asprintf("%s.tmp", state->file);
+
+    f = fopen(tmp_file, "wb");
+    if (!f) {
+        ut_throw("cannot open '%s' (%s)", tmp_file, strerror(errno));
+        goto error;
+    }
+
+    if (fwrite(buffer, 1, size, f) != size) {
+        ut_throw("failed to write build state to '%s'", tmp_file);
+        goto error;
+    }
+
+    fclose(f);
+    f = NULL;
+
+    ut_try (ut_rename(tmp_file, state->file), NULL);
+
+    ut_trace("saved build state for %d outputs to '%s'",
+        hdr.output_count, state->file);
+
+    state->changed = false;
+    free(buffer);
+    free(tmp_file);
+
+    return 0;
+error:
+    if (f) fclose(f);
+    free(buffer);
+    free(tmp_file);
+    return -1;
+}
+
+void bake_build_state_free(
+    bake_build_state *state)
+{
+    bake_build_state_clear(state);
+    ut_rb_free(state->outputs);
+
+    ut_iter it = ut_rb_iter(state->files);
+    while (ut_iter_hasNext(&it)) {
+        bake_build_file *file = ut_iter_next(&it);
+        free(file->path);
+        free(file);
+    }
+    ut_rb_free(state->files);
+
+    ut_mutex_free(&state->lock);
+    free(state->file);
+    free(state->project_path);
+    free(state->cwd);
+    free(state);
+}
+
+bool bake_build_state_changed(
+    bake_build_state *state,
+    const char *output,
+    const char *input)
+{
+    bool result = true;
+    time_t modified;
+    uint64_t size, hash;
+    uint32_t i;
+    char *output_key = bake_build_state_key(state, output);
+    char *input_key = bake_build_state_key(state, input);
+
+    ut_mutex_lock(&state->lock);
+
+    bake_build_output *o = ut_rb_find(state->outputs, output_key);
+    if (!o) {
+        goto done;
+    }
+
+    for (i = 0; i < o->input_count; i ++) {
+        bake_build_input *in = &o->inputs[i];
+        if (strcmp(in->path, input_key)) {
+            continue;
+        }
+
+        if (ut_file_info(input, &modified, &size)) {
+            ut_catch();
+            break;
+        }
+
+        /* Fast path: if timestamp and size did not change, assume that the
+         * content of the file did not change either */
+        if (in->modified == modified && in->size == size) {
+            result = false;
+            break;
+        }
+
+        if (bake_build_state_hash_file(state, input, modified, size, &hash)) {
+            ut_catch();
+            break;
+        }
+
+        if (in->hash == hash) {
+            /* Content did not change. Store new timestamp & size, so that the
+             * next build can take the fast path */
+            in->modified = modified;
+            in->size = size;
+            state->changed = true;
+            result = false;
+            ut_trace("#[grey]%s has new timestamp but same content", input);
+        }
+        break;
+    }
+
+done:
+    ut_mutex_unlock(&state->lock);
+    free(output_key);
+    free(input_key);
+    return result;
+}
+
+void bake_build_state_reset(
+    bake_build_state *state,
+    const char *output)
+{
+    char *key = bake_build_state_key(state, output);
+    ut_mutex_lock(&state->lock);
+    bake_build_output *o = ut_rb_find(state->outputs, key);
+    if (o && o->input_count) {
+        bake_build_output_clear(o);
+        state->changed = true;
+    }
+    ut_mutex_unlock(&state->lock);
+    free(key);
+}
+
+int16_t bake_build_state_add(
+    bake_build_state *state,
+    const char *output,
+    const char *input)
+{
+    time_t modified;
+    uint64_t size, hash;
+    char *output_key = bake_build_state_key(state, output);
+    char *input_key = bake_build_state_key(state, input);
+
+    ut_mutex_lock(&state->lock);
+
+    ut_try (ut_file_info(input, &modified, &size), NULL);
+    ut_try (bake_build_state_hash_file(state, input, modified, size, &hash),
+        NULL);
+
+    bake_build_output *o = bake_build_state_get_output(state, output_key);
+    bake_build_input *in = NULL;
+    uint32_t i;
+    for (i = 0; i < o->input_count; i ++) {
+        if (!strcmp(o->inputs[i].path, input_key)) {
+            in = &o->inputs[i];
+            break;
+        }
+    }
+
+    if (!in) {
+        in = bake_build_output_add_input(o, input_key);
+    }
+
+    in->hash = hash;
+    in->modified = modified;
+    in->size = size;
+    state->changed = true;
+
+    ut_mutex_unlock(&state->lock);
+    free(output_key);
+    free(input_key);
+    return 0;
+error:
+    ut_mutex_unlock(&state->lock);
+    free(output_key);
+    free(input_key);
+    return -1;
+}
+
+static
+bool bake_build_state_add_dep(
+    const char *dep,
+    void *ctx)
+{
+    void **args = ctx;
+    if (bake_build_state_add(args[0], args[1], dep)) {
+        /* If a dependency can't be hashed, remove the output from the state
+         * so it's never considered unchanged based on incomplete data */
+        ut_catch();
+        bake_build_state_reset(args[0], args[1]);
+        return false;
+    }
+    return true;
+}
+
+bool bake_build_state_command_changed(
+    bake_build_state *state,
+    const char *output,
+    uint64_t command)
+{
+    char *key = bake_build_state_key(state, output);
+    ut_mutex_lock(&state->lock);
+    bake_build_output *o = ut_rb_find(state->outputs, key);
+    bool result = !o || o->command != command;
+    ut_mutex_unlock(&state->lock);
+    free(key);
+    return result;
+}
+
+int16_t bake_build_state_record(
+    bake_build_state *state,
+    const char *output,
+    const char *source,
+    uint64_t command)
+{
+    bake_build_state_reset(state, output);
+
+    char *key = bake_build_state_key(state, output);
+    ut_mutex_lock(&state->lock);
+    bake_build_output *o = bake_build_state_get_output(state, key);
+    o->command = command;
+    state->changed = true;
+    ut_mutex_unlock(&state->lock);
+    free(key);
+
+    if (bake_build_state_add(state, output, source)) {
+        ut_catch();
+        return -1;
+    }
+
+    void *args[] = {state, (void*)output};
+    bake_depfile_walk(output, bake_build_state_add_dep, args);
+
+    return 0;
+}
+
+/* Get directory from which compiler was invoked, by removing the target as it
+ * is written in the dependency file from the path of the target. Returns NULL
+ * if it can't be determined. */
+static
+char* bake_depfile_cwd(
+    const char *target,
+    const char *depfile_target)
+{
+    char *result, *written;
+
+    if (!ut_path_is_relative(depfile_target)) {
+        return NULL;
+    }
+
+    if (ut_path_is_relative(target)) {
+        result = ut_asprintf("%s"UT_OS_PS"%s", ut_cwd(), target);
+    } else {
+        result = ut_strdup(target);
+    }
+    ut_path_clean(result, result);
+
+    written = ut_asprintf(UT_OS_PS"%s", depfile_target);
+    ut_path_clean(written, written);
+
+    size_t len = strlen(result), written_len = strlen(written);
+    if (!strstr(written, "..") && len > written_len &&
+        !strcmp(&result[len - written_len], written))
+    {
+        result[len - written_len] = '\0';
+    } else {
+        free(result);
+        result = NULL;
+    }
+
+    free(written);
+
+    return result;
+}
+
+int16_t bake_depfile_walk(
+    const char *target,
+    bake_depfile_cb callback,
+    void *ctx)
+{
+    char *compile_cwd = NULL;
+    char *depfile = ut_strdup(target);
+    char *content = NULL;
+    char *ext = strrchr(depfile, '.');
+    if (ext && !strchr(ext, UT_OS_PS[0])) {
+        *ext = '\0';
+    }
+
+    char *tmp = depfile;
+    depfile = ut_asprintf("%s.d", depfile);
+    free(tmp);
+
+    if (ut_file_test(depfile) != 1) {
+        goto error;
+    }
+
+    if (!(content = ut_file_load(depfile))) {
+        ut_catch();
+        goto error;
+    }
+
+    /* Skip target, which is terminated by ': ' (path may contain a ':') */
+    char *ptr = strstr(content, ": ");
+    if (!ptr) {
+        goto error;
+    }
+
+    /* Relative dependencies are relative to the directory from which the
+     * compiler was invoked, which may be different from the current one */
+    *ptr = '\0';
+    compile_cwd = bake_depfile_cwd(target, content);
+
+    ptr += 2;
+
+    /* Unescape dependencies in place, as the result is never longer than the
+     * input */
+    char *dep = ptr, *out = ptr, ch;
+    bool proceed = true, first = true;
+    do {
+        ch = *ptr;
+        if (ch == '\\' && (ptr[1] == '\n' || ptr[1] == '\r')) {
+            /* Line continuation */
+            ch = ' ';
+            ptr ++;
+        } else if (ch == '\\' && ptr[1] == ' ') {
+            /* Escaped space */
+            *(out ++) = ' ';
+            ptr += 2;
+            continue;
+        }
+
+        if (!ch || isspace(ch)) {
+            if (out != dep) {
+                *out = '\0';
+                if (first) {
+                    /* First dependency is the source of the target */
+                    first = false;
+                } else if (compile_cwd && ut_path_is_relative(dep)) {
+                    char *path = ut_asprintf(
+                        "%s"UT_OS_PS"%s", compile_cwd, dep);
+                    ut_path_clean(path, path);
+                    proceed = callback(path, ctx);
+                    free(path);
+                } else {
+                    proceed = callback(dep, ctx);
+                }
+            }
+            dep = out = ptr + 1;
+        } else {
+            *(out ++) = ch;
+        }
+
+        ptr ++;
+    } while (ch && proceed);
+
+    free(compile_cwd);
+    free(content);
+    free(depfile);
+    return 0;
+error:
+    free(compile_cwd);
+    free(content);
+    free(depfile);
+    return -1;
+}
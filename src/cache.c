@@ -0,0 +1,469 @@
+/* Copyright (c) 2010-2019 Sander Mertens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "bake.h"
+
+/* The object cache stores objects in $BAKE_HOME/cache/objects, by a key that a
+ * driver computes from the input of the compiler (like the preprocessed source
+ * and the compiler command). Objects are stored in subdirectories named after
+ * the first two characters of the key, to keep directories small.
+ *
+ * The last modified time of an object is updated when it is used, so that when
+ * the cache exceeds its maximum size, the least recently used objects can be
+ * evicted. Statistics are stored in $BAKE_HOME/cache/stats, and are updated
+ * when bake exits. */
+
+#define BAKE_CACHE_DEFAULT_SIZE (5ULL * 1024 * 1024 * 1024)
+
+typedef struct bake_cache_stats_t {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t size;          /* Size of objects in cache (in bytes) */
+} bake_cache_stats_t;
+
+typedef struct bake_cache_entry {
+    char *path;
+    time_t modified;
+    uint64_t size;
+} bake_cache_entry;
+
+static struct {
+    bool enabled;
+    char *path;             /* $BAKE_HOME/cache */
+    uint64_t max_size;
+    struct ut_mutex_s lock; /* Cache may be used by parallel jobs */
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t stored;        /* Bytes added to the cache by this process */
+    uint32_t tmp_count;     /* Used to create unique temporary file names */
+} bake_cache;
+
+static
+char* bake_cache_object_path(
+    const char *path,
+    uint64_t key)
+{
+    char key_str[17];
+    sprintf(key_str, "%016" PRIx64, key);
+    return ut_asprintf("%s"UT_OS_PS"objects"UT_OS_PS"%.2s"UT_OS_PS"%s.o",
+        path, key_str, key_str);
+}
+
+static
+void bake_cache_stats_load(
+    const char *path,
+    bake_cache_stats_t *stats)
+{
+    char *file = ut_asprintf("%s"UT_OS_PS"stats", path);
+    memset(stats, 0, sizeof(bake_cache_stats_t));
+
+    if (ut_file_test(file) == 1) {
+        FILE *f = fopen(file, "r");
+        if (f) {
+            char name[32];
+            uint64_t value;
+            while (fscanf(f, "%31s %" SCNu64, name, &value) == 2) {
+                if (!strcmp(name, "hits")) {
+                    stats->hits = value;
+                } else if (!strcmp(name, "misses")) {
+                    stats->misses = value;
+                } else if (!strcmp(name, "size")) {
+                    stats->size = value;
+                }
+            }
+            fclose(f);
+        }
+    }
+
+    free(file);
+}
+
+static
+int16_t bake_cache_stats_save(
+    const char *path,
+    bake_cache_stats_t *stats)
+{
+    char *file = ut_asprintf("%s"UT_OS_PS"stats", path);
+    char *tmp_file = ut_asprintf("%s.%u.tmp", file, (unsigned)ut_proc());
+
+    ut_try (ut_mkdir(path), NULL);
+
+    FILE *f = fopen(tmp_file, "w");
+    if (!f) {
+        ut_throw("cannot open '%s' (%s)", tmp_file, strerror(errno));
+        goto error;
+    }
+
+    fprintf(f, "hits %" PRIu64 "\n", stats->hits);
+    fprintf(f, "misses %" PRIu64 "\n", stats->misses);
+    fprintf(f, "size %" PRIu64 "\n", stats->size);
+    fclose(f);
+
+    /* Rename so that concurrent bake processes never read a partial file. Two
+     * processes that update the stats at the same time may lose each other's
+     * counters, which is acceptable for statistics. */
+    ut_try (ut_rename(tmp_file, file), NULL);
+
+    free(file);
+    free(tmp_file);
+    return 0;
+error:
+    free(file);
+    free(tmp_file);
+    return -1;
+}
+
+static
+int bake_cache_entry_compare(
+    const void *e1,
+    const void *e2)
+{
+    const bake_cache_entry *entry1 = e1, *entry2 = e2;
+    if (entry1->modified < entry2->modified) {
+        return -1;
+    } else if (entry1->modified > entry2->modified) {
+        return 1;
+    }
+    return strcmp(entry1->path, entry2->path);
+}
+
+/* Collect all objects in the cache */
+static
+bake_cache_entry* bake_cache_collect(
+    const char *path,
+    uint32_t *count_out,
+    uint64_t *size_out)
+{
+    bake_cache_entry *result = NULL;
+    uint32_t count = 0, capacity = 0;
+    uint64_t total = 0;
+
+    char *objects = ut_asprintf("%s"UT_OS_PS"objects", path);
+    if (ut_file_test(objects) != 1) {
+        goto done;
+    }
+
+    ut_ll dirs = ut_opendir(objects);
+    if (!dirs) {
+        ut_catch();
+        goto done;
+    }
+
+    ut_iter it = ut_ll_iter(dirs);
+    while (ut_iter_hasNext(&it)) {
+        char *dir = ut_asprintf(
+            "%s"UT_OS_PS"%s", objects, (char*)ut_iter_next(&it));
+        ut_ll files = ut_opendir(dir);
+        if (!files) {
+            ut_catch();
+            free(dir);
+            continue;
+        }
+
+        ut_iter f_it = ut_ll_iter(files);
+        while (ut_iter_hasNext(&f_it)) {
+            char *file = ut_asprintf(
+                "%s"UT_OS_PS"%s", dir, (char*)ut_iter_next(&f_it));
+            time_t modified;
+            uint64_t file_size;
+
+            if (ut_file_info(file, &modified, &file_size)) {
+                /* File may have been evicted by another process */
+                ut_catch();
+                free(file);
+                continue;
+            }
+
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 256;
+                result = realloc(result, capacity * sizeof(bake_cache_entry));
+            }
+
+            result[count].path = file;
+            result[count].modified = modified;
+            result[count].size = file_size;
+            total += file_size;
+            count ++;
+        }
+
+        ut_closedir(files);
+        free(dir);
+    }
+
+    ut_closedir(dirs);
+
+done:
+    free(objects);
+    *count_out = count;
+    *size_out = total;
+    return result;
+}
+
+static
+void bake_cache_free_entries(
+    bake_cache_entry *entries,
+    uint32_t count)
+{
+    uint32_t i;
+    for (i = 0; i < count; i ++) {
+        free(entries[i].path);
+    }
+    free(entries);
+}
+
+/* Remove least recently used objects until the cache is below 90% of its
+ * maximum size, so that eviction doesn't have to run on every build. Returns
+ * the size of the cache after eviction. */
+static
+uint64_t bake_cache_evict(
+    const char *path,
+    uint64_t max_size)
+{
+    uint32_t i, count, evicted = 0;
+    uint64_t size;
+    bake_cache_entry *entries = bake_cache_collect(path, &count, &size);
+
+    if (size > max_size) {
+        uint64_t limit = max_size / 10 * 9;
+
+        qsort(entries, count, sizeof(bake_cache_entry),
+            bake_cache_entry_compare);
+
+        for (i = 0; i < count && size > limit; i ++) {
+            if (!ut_rm(entries[i].path)) {
+                size -= entries[i].size;
+                evicted ++;
+            } else {
+                ut_catch();
+            }
+        }
+
+        ut_trace("evicted %u objects from cache", evicted);
+    }
+
+    bake_cache_free_entries(entries, count);
+
+    return size;
+}
+
+uint64_t bake_cache_parse_size(
+    const char *str)
+{
+    char *end;
+    uint64_t result = strtoull(str, &end, 10);
+
+    switch (toupper(*end)) {
+    case 'K': result *= 1024; break;
+    case 'M': result *= 1024 * 1024; break;
+    case 'G': result *= 1024 * 1024 * 1024; break;
+    default: break;
+    }
+
+    return result;
+}
+
+int16_t bake_cache_init(
+    bake_config *config)
+{
+    if (!config->cache || bake_cache.enabled) {
+        return 0;
+    }
+
+    bake_cache.path = ut_asprintf("%s"UT_OS_PS"cache", config->home);
+    bake_cache.max_size = config->cache_size;
+    if (!bake_cache.max_size) {
+        bake_cache.max_size = BAKE_CACHE_DEFAULT_SIZE;
+    }
+
+    ut_try (ut_mutex_new(&bake_cache.lock), NULL);
+
+    bake_cache.enabled = true;
+
+    ut_trace("object cache enabled in '%s' (max size = %" PRIu64 " bytes)",
+        bake_cache.path, bake_cache.max_size);
+
+    return 0;
+error:
+    free(bake_cache.path);
+    bake_cache.path = NULL;
+    return -1;
+}
+
+void bake_cache_deinit(void)
+{
+    if (!bake_cache.enabled) {
+        return;
+    }
+
+    if (bake_cache.hits || bake_cache.misses || bake_cache.stored) {
+        bake_cache_stats_t stats;
+        bake_cache_stats_load(bake_cache.path, &stats);
+
+        stats.hits += bake_cache.hits;
+        stats.misses += bake_cache.misses;
+        stats.size += bake_cache.stored;
+
+        if (stats.size > bake_cache.max_size) {
+            stats.size = bake_cache_evict(bake_cache.path, bake_cache.max_size);
+        }
+
+        if (bake_cache_stats_save(bake_cache.path, &stats)) {
+            ut_catch();
+        }
+
+        ut_trace("object cache: %" PRIu64 " hits, %" PRIu64 " misses",
+            bake_cache.hits, bake_cache.misses);
+    }
+
+    ut_mutex_free(&bake_cache.lock);
+    free(bake_cache.path);
+    memset(&bake_cache, 0, sizeof(bake_cache));
+}
+
+bool bake_cache_get(
+    uint64_t key,
+    const char *target)
+{
+    if (!bake_cache.enabled) {
+        return false;
+    }
+
+    bool result = false;
+    char *object = bake_cache_object_path(bake_cache.path, key);
+
+    if (ut_file_test(object) == 1) {
+        if (ut_cp(object, target)) {
+            /* Object may have been evicted by another process */
+            ut_catch();
+        } else {
+            /* Mark object as recently used */
+            if (ut_setlastmodified(object)) {
+                ut_catch();
+            }
+            result = true;
+        }
+    }
+
+    ut_mutex_lock(&bake_cache.lock);
+    if (result) {
+        bake_cache.hits ++;
+    } else {
+        bake_cache.misses ++;
+    }
+    ut_mutex_unlock(&bake_cache.lock);
+
+    free(object);
+    return result;
+}
+
+int16_t bake_cache_put(
+    uint64_t key,
+    const char *target)
+{
+    char *object = NULL, *tmp_object = NULL;
+    uint64_t size;
+
+    if (!bake_cache.enabled) {
+        return 0;
+    }
+
+    object = bake_cache_object_path(bake_cache.path, key);
+    if (ut_file_test(object) == 1) {
+        /* Object was already stored by another job or process */
+        free(object);
+        return 0;
+    }
+
+    ut_try (ut_file_info(target, NULL, &size), NULL);
+
+    ut_mutex_lock(&bake_cache.lock);
+    uint32_t tmp_id = bake_cache.tmp_count ++;
+    ut_mutex_unlock(&bake_cache.lock);
+
+    /* Copy to a temporary file first, so that other processes never see a
+     * partially written object */
+    tmp_object = ut_asprintf("%s.%u.%u.tmp", object, (unsigned)ut_proc(), tmp_id);
+    ut_try (ut_cp(target, tmp_object), NULL);
+    if (ut_rename(tmp_object, object)) {
+        ut_rm(tmp_object);
+        goto error;
+    }
+
+    ut_mutex_lock(&bake_cache.lock);
+    bake_cache.stored += size;
+    ut_mutex_unlock(&bake_cache.lock);
+
+    free(object);
+    free(tmp_object);
+    return 0;
+error:
+    free(object);
+    free(tmp_object);
+    return -1;
+}
+
+int16_t bake_cache_cmd(
+    bake_config *config,
+    const char *cmd)
+{
+    char *path = ut_asprintf("%s"UT_OS_PS"cache", config->home);
+    bake_cache_stats_t stats;
+    uint32_t count;
+    uint64_t size;
+
+    if (!strcmp(cmd, "stats")) {
+        bake_cache_stats_load(path, &stats);
+        bake_cache_entry *entries = bake_cache_collect(path, &count, &size);
+        bake_cache_free_entries(entries, count);
+
+        uint64_t max_size = config->cache_size;
+        if (!max_size) {
+            max_size = BAKE_CACHE_DEFAULT_SIZE;
+        }
+
+        uint64_t lookups = stats.hits + stats.misses;
+
+        ut_log("#[bold]object cache#[reset] #[cyan]%s#[reset] (%s)\n",
+            path, config->cache ? "enabled" : "disabled, set BAKE_CACHE to enable");
+        ut_log("  hits:     %" PRIu64 "\n", stats.hits);
+        ut_log("  misses:   %" PRIu64 "\n", stats.misses);
+        ut_log("  hit rate: %.1f%%\n",
+            lookups ? 100.0 * (double)stats.hits / (double)lookups : 0.0);
+        ut_log("  objects:  %u\n", count);
+        ut_log("  size:     %.1f MB (max %.1f MB)\n",
+            (double)size / (1024 * 1024), (double)max_size / (1024 * 1024));
+    } else if (!strcmp(cmd, "clear")) {
+        if (ut_file_test(path) == 1) {
+            ut_try (ut_rm(path), NULL);
+        }
+        ut_log("#[green]OK#[reset] cleared object cache in #[cyan]%s#[reset]\n",
+            path);
+    } else {
+        ut_throw("invalid cache command '%s' (expected stats or clear)", cmd);
+        goto error;
+    }
+
+    free(path);
+    return 0;
+error:
+    free(path);
+    return -1;
+}
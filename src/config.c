@@ -482,7 +482,6 @@ ut_ll bake_config_find_files(
     return config_files;
 }
 
-static
 ut_ll bake_config_find_config(void)
 {
     ut_ll config_files = NULL;
@@ -684,6 +683,8 @@ void bake_config_log(
         ut_trace("set '%s' to '%s'", CFG_SANITIZE_UNDEFINED, cfg->sanitize_undefined ? "true" : "false");
         ut_trace("set '%s' to '%s'", CFG_LOOP_TEST, cfg->loop_test ? "true" : "false");
         ut_trace("set '%s' to '%s'", CFG_ASSEMBLY, cfg->assembly ? "true" : "false");
+        ut_trace("set 'jobs' to '%d'", cfg->jobs);
+        ut_trace("set 'cache' to '%s'", cfg->cache ? "true" : "false");
         ut_log_pop();
     }
 }
@@ -0,0 +1,258 @@
+/* Copyright (c) 2010-2019 Sander Mertens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "bake.h"
+
+/* The crawl cache stores for each directory visited while discovering projects
+ * whether it contains a project.json and which subdirectories it has, together
+ * with the last modified time of the directory. Adding, removing or renaming
+ * an entry updates the modified time of a directory, so as long as the time
+ * is the same, the directory does not have to be read again.
+ *
+ * The cache is stored in a text file with a header line, followed by a line
+ * per directory ("<modified> <is project> <subdirectory count> <path>") and
+ * a line per subdirectory name. Paths are relative to the searched path, with
+ * "." for the searched path itself. */
+
+#define BAKE_CRAWL_CACHE_HEADER "bake crawl cache 1"
+
+struct bake_crawl_cache {
+    char *file;             /* File from which cache is loaded */
+    ut_rb loaded;           /* Directories loaded from file */
+    ut_rb visited;          /* Directories visited in this crawl */
+    time_t start;           /* Time at which crawl started */
+    uint32_t hits;
+    uint32_t misses;
+};
+
+static
+int bake_crawl_cache_strcmp(
+    void *ctx,
+    const void* key1,
+    const void* key2)
+{
+    return strcmp(key1, key2);
+}
+
+static
+void bake_crawl_cache_dir_free(
+    bake_crawl_cache_dir *dir)
+{
+    if (dir->dirs) {
+        ut_iter it = ut_ll_iter(dir->dirs);
+        while (ut_iter_hasNext(&it)) {
+            free(ut_iter_next(&it));
+        }
+        ut_ll_free(dir->dirs);
+    }
+    free(dir->path);
+    free(dir);
+}
+
+static
+void bake_crawl_cache_clear(
+    ut_rb tree)
+{
+    ut_iter it = ut_rb_iter(tree);
+    while (ut_iter_hasNext(&it)) {
+        bake_crawl_cache_dir_free(ut_iter_next(&it));
+    }
+    ut_rb_free(tree);
+}
+
+static
+int16_t bake_crawl_cache_parse(
+    bake_crawl_cache *cache,
+    char *buffer)
+{
+    char *ptr = buffer, *line;
+
+    line = ut_file_nextln(&ptr);
+    if (!line || strcmp(line, BAKE_CRAWL_CACHE_HEADER)) {
+        goto error;
+    }
+
+    while ((line = ut_file_nextln(&ptr))) {
+        long long modified;
+        int project, count, path_offset = 0;
+
+        if (sscanf(line, "%lld %d %d %n",
+            &modified, &project, &count, &path_offset) != 3 || !path_offset)
+        {
+            goto error;
+        }
+
+        bake_crawl_cache_dir *dir = ut_calloc(sizeof(bake_crawl_cache_dir));
+        dir->path = ut_strdup(&line[path_offset]);
+        dir->modified = modified;
+        dir->project = project != 0;
+        dir->dirs = ut_ll_new();
+        ut_rb_set(cache->loaded, dir->path, dir);
+
+        int i;
+        for (i = 0; i < count; i ++) {
+            char *name = ut_file_nextln(&ptr);
+            if (!name) {
+                goto error;
+            }
+            ut_ll_append(dir->dirs, ut_strdup(name));
+        }
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+bake_crawl_cache* bake_crawl_cache_load(
+    const char *file)
+{
+    bake_crawl_cache *result = ut_calloc(sizeof(bake_crawl_cache));
+    result->file = ut_strdup(file);
+    result->loaded = ut_rb_new(bake_crawl_cache_strcmp, NULL);
+    result->visited = ut_rb_new(bake_crawl_cache_strcmp, NULL);
+    result->start = time(NULL);
+
+    if (ut_file_test(file) != 1) {
+        ut_trace("no crawl cache found in '%s'", file);
+        return result;
+    }
+
+    char *buffer = ut_file_load(file);
+    if (!buffer) {
+        ut_catch();
+        return result;
+    }
+
+    if (bake_crawl_cache_parse(result, buffer)) {
+        /* An invalid cache just means that all directories are read */
+        ut_trace("discard invalid crawl cache '%s'", file);
+        bake_crawl_cache_clear(result->loaded);
+        result->loaded = ut_rb_new(bake_crawl_cache_strcmp, NULL);
+    } else {
+        ut_trace("loaded crawl cache for %d directories from '%s'",
+            ut_rb_count(result->loaded), file);
+    }
+
+    free(buffer);
+
+    return result;
+}
+
+bake_crawl_cache_dir* bake_crawl_cache_get(
+    bake_crawl_cache *cache,
+    const char *path,
+    time_t modified)
+{
+    bake_crawl_cache_dir *dir = ut_rb_find(cache->loaded, path);
+    if (!dir || dir->modified != modified || modified == -1) {
+        cache->misses ++;
+        return NULL;
+    }
+
+    /* Move directory to visited, so that directories that no longer exist
+     * are not written back to the cache */
+    ut_rb_remove(cache->loaded, dir->path);
+    ut_rb_set(cache->visited, dir->path, dir);
+    cache->hits ++;
+
+    return dir;
+}
+
+bake_crawl_cache_dir* bake_crawl_cache_set(
+    bake_crawl_cache *cache,
+    const char *path,
+    time_t modified,
+    bool project,
+    ut_ll dirs)
+{
+    bake_crawl_cache_dir *dir = ut_rb_find(cache->visited, path);
+    if (dir) {
+        ut_rb_remove(cache->visited, dir->path);
+        bake_crawl_cache_dir_free(dir);
+    }
+
+    dir = ut_calloc(sizeof(bake_crawl_cache_dir));
+    dir->path = ut_strdup(path);
+    dir->project = project;
+    dir->dirs = dirs;
+
+    /* If the directory was modified in the same second as the crawl started,
+     * it could be modified again without changing its modified time. Don't
+     * trust the cached data in that case. */
+    if (modified >= cache->start) {
+        dir->modified = -1;
+    } else {
+        dir->modified = modified;
+    }
+
+    ut_rb_set(cache->visited, dir->path, dir);
+
+    return dir;
+}
+
+int16_t bake_crawl_cache_save(
+    bake_crawl_cache *cache)
+{
+    ut_strbuf buf = UT_STRBUF_INIT;
+
+    ut_trace("crawl cache: %u directories unchanged, %u directories read",
+        cache->hits, cache->misses);
+
+    /* Nothing changed, no need to write cache */
+    if (!cache->misses && !ut_rb_count(cache->loaded)) {
+        return 0;
+    }
+
+    ut_strbuf_append(&buf, "%s\n", BAKE_CRAWL_CACHE_HEADER);
+
+    ut_iter it = ut_rb_iter(cache->visited);
+    while (ut_iter_hasNext(&it)) {
+        bake_crawl_cache_dir *dir = ut_iter_next(&it);
+        ut_strbuf_append(&buf, "%lld %d %d %s\n", (long long)dir->modified,
+            dir->project, ut_ll_count(dir->dirs), dir->path);
+
+        ut_iter dir_it = ut_ll_iter(dir->dirs);
+        while (ut_iter_hasNext(&dir_it)) {
+            ut_strbuf_append(&buf, "%s\n", (char*)ut_iter_next(&dir_it));
+        }
+    }
+
+    char *content = ut_strbuf_get(&buf);
+    int16_t result = ut_file_save(cache->file, content);
+    free(content);
+
+    if (!result) {
+        ut_trace("saved crawl cache for %d directories to '%s'",
+            ut_rb_count(cache->visited), cache->file);
+    }
+
+    return result;
+}
+
+void bake_crawl_cache_free(
+    bake_crawl_cache *cache)
+{
+    bake_crawl_cache_clear(cache->loaded);
+    bake_crawl_cache_clear(cache->visited);
+    free(cache->file);
+    free(cache);
+}
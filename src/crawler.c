@@ -28,6 +28,9 @@ struct bake_crawler {
 };
 
 static bake_crawler *crawler;
+static bool walking_parallel;
+
+extern ut_tls BAKE_CONFIG_KEY;
 
 typedef int16_t (*bake_dependency_action)(
     bake_config *cfg,
@@ -318,9 +321,78 @@ error:
     return -1;
 }
 
+static
+void bake_crawler_free_dirs(
+    ut_ll dirs)
+{
+    if (dirs) {
+        ut_iter it = ut_ll_iter(dirs);
+        while (ut_iter_hasNext(&it)) {
+            free(ut_iter_next(&it));
+        }
+        ut_ll_free(dirs);
+    }
+}
+
+typedef struct bake_crawler_dir {
+    bool project;
+    ut_ll dirs;
+} bake_crawler_dir;
+
+/* Find project.json and subdirectories while reading a directory, so that
+ * entries don't have to be stat'ed */
+static
+int16_t bake_crawler_dir_file(
+    const char *dir,
+    const char *name,
+    bool is_dir,
+    void *ctx)
+{
+    bake_crawler_dir *result = ctx;
+
+    if (!is_dir) {
+        if (!strcmp(name, "project.json")) {
+            result->project = true;
+        }
+    } else if (name[0] != '.') {
+        ut_ll_append(result->dirs, ut_strdup(name));
+    }
+
+    return 0;
+}
+
+/* Get key of directory in the crawl cache. Keys are relative to the root of
+ * the crawl without a leading separator, with "." for the root itself, so that
+ * they don't depend on how the root was passed to bake. The root is an
+ * absolute, clean path. */
+static
+char* bake_crawler_cache_key(
+    const char *root,
+    const char *path)
+{
+    char *result;
+    if (ut_path_is_relative(path)) {
+        result = ut_asprintf("%s"UT_OS_PS"%s", ut_cwd(), path);
+    } else {
+        result = ut_strdup(path);
+    }
+    ut_path_clean(result, result);
+
+    size_t len = strlen(root);
+    if (!strcmp(result, root)) {
+        strcpy(result, ".");
+    } else if (!strncmp(result, root, len) && result[len] == UT_OS_PS[0]) {
+        memmove(result, &result[len + 1], strlen(&result[len + 1]) + 1);
+    }
+
+    return result;
+}
+
 static
 int16_t bake_crawler_crawl(
     bake_config *config,
+    bake_crawl_cache *cache,
+    const char *root,
     const char *wd,
     const char *path)
 {
@@ -335,10 +407,44 @@ int16_t bake_crawler_crawl(
 
     bool isProject = false;
     bake_project *p = NULL;
+    bake_crawl_cache_dir uncached = {0};
+
+    /* If the directory hasn't changed since the last crawl, use the cached
+     * project flag and subdirectories instead of reading the directory */
+    bake_crawl_cache_dir *cached = NULL;
+    char *key = NULL;
+    time_t modified = -1;
+    if (cache) {
+        key = bake_crawler_cache_key(root, fullpath);
+        modified = ut_lastmodified(fullpath);
+        if (modified == -1) {
+            ut_catch();
+        }
+        cached = bake_crawl_cache_get(cache, key, modified);
+    }
+
+    if (cached) {
+        isProject = cached->project;
+    } else {
+        bake_crawler_dir dir = { .dirs = ut_ll_new() };
+        if (ut_dir_walk(fullpath, false, bake_crawler_dir_file, NULL, &dir)) {
+            ut_throw("failed to open directory '%s'", fullpath);
+            bake_crawler_free_dirs(dir.dirs);
+            goto error;
+        }
 
-    if (ut_file_test(strarg("%s"UT_OS_PS"project.json", fullpath))) {
-        isProject = true;
+        isProject = dir.project;
+        ut_ll dirs = dir.dirs;
+
+        if (cache) {
+            cached = bake_crawl_cache_set(cache, key, modified, isProject, dirs);
+        } else {
+            uncached.dirs = dirs;
+            cached = &uncached;
+        }
+    }
 
+    if (isProject) {
         p = bake_project_new(fullpath, config);
         if (!p) {
             ut_warning("ignoring '%s' because of errors", fullpath);
@@ -349,64 +455,57 @@ int16_t bake_crawler_crawl(
         }
     }
 
-    ut_iter it;
-    if (ut_dir_iter(fullpath, NULL, &it)) {
-        ut_throw("failed to open directory '%s'", fullpath);
-        goto error;
-    }
-
+    ut_iter it = ut_ll_iter(cached->dirs);
     while (ut_iter_hasNext(&it)) {
         char *file = ut_iter_next(&it);
 
-        if (file[0] == '.') {
-            continue;
-        }
-
-        if (ut_isdir(strarg("%s"UT_OS_PS"%s", fullpath, file))) {
-
-            /* If this is a bake project, filter out directories that have
-             * special meaning. */
-            if (isProject) {
-                if (!strcmp(file, "src") ||
-                    !strcmp(file, "include") ||
-                    !strcmp(file, "config") ||
-                    !strcmp(file, "data") ||
-                    !strcmp(file, "test") ||
-                    !strcmp(file, "etc") ||
-                    !strcmp(file, "lib") ||
-                    !strcmp(file, "bin") ||
-                    !strcmp(file, "install") ||
-                    !strcmp(file, "examples") ||
-                    !strcmp(file, "bake") ||
-                    !strcmp(file, ".bake_cache") ||
-                    (p && bake_project_should_ignore(p, file)))
-                {
-                    ut_debug("ignoring directory '%s'", file);
-                    continue;
-                }
+        /* If this is a bake project, filter out directories that have
+         * special meaning. */
+        if (isProject) {
+            if (!strcmp(file, "src") ||
+                !strcmp(file, "include") ||
+                !strcmp(file, "config") ||
+                !strcmp(file, "data") ||
+                !strcmp(file, "test") ||
+                !strcmp(file, "etc") ||
+                !strcmp(file, "lib") ||
+                !strcmp(file, "bin") ||
+                !strcmp(file, "install") ||
+                !strcmp(file, "examples") ||
+                !strcmp(file, "bake") ||
+                !strcmp(file, ".bake_cache") ||
+                (p && bake_project_should_ignore(p, file)))
+            {
+                ut_debug("ignoring directory '%s'", file);
+                continue;
+            }
 
-                ut_debug("looking for projects in '%s'", file);
+            ut_debug("looking for projects in '%s'", file);
 
-                /* TODO: ignore generated directories */
+            /* TODO: ignore generated directories */
 
-            /* Never try to build bake with bake, in case it is found in the source tree */
-            } else if (!strcmp(file, "bake")) {
-                ut_debug("ignoring directory 'bake'");
-                continue;
-            } else {
-                ut_debug("looking for projects in '%s'", file);
-            }
+        /* Never try to build bake with bake, in case it is found in the source tree */
+        } else if (!strcmp(file, "bake")) {
+            ut_debug("ignoring directory 'bake'");
+            continue;
+        } else {
+            ut_debug("looking for projects in '%s'", file);
+        }
 
-            if (bake_crawler_crawl(config, fullpath, file)) {
-                ut_iter_release(&it);
-                goto error;
-            }
+        if (bake_crawler_crawl(config, cache, root, fullpath, file)) {
+            goto error;
         }
     }
 
-skip:
+    bake_crawler_free_dirs(uncached.dirs);
+    free(fullpath);
+    free(key);
+    free(prev);
     return 0;
 error:
+    bake_crawler_free_dirs(uncached.dirs);
+    free(fullpath);
+    free(key);
     if (prev) free(prev);
     return -1;
 }
@@ -488,6 +587,25 @@ uint32_t bake_crawler_count(void)
     return crawler->count;
 }
 
+ut_ll bake_crawler_projects(void)
+{
+    ut_ll projects;
+    if (crawler->nodes) {
+        projects = bake_crawler_collect_projects();
+    } else {
+        projects = ut_ll_new();
+    }
+
+    if (crawler->leafs) {
+        ut_iter it = ut_ll_iter(crawler->leafs);
+        while (ut_iter_hasNext(&it)) {
+            ut_ll_append(projects, ut_iter_next(&it));
+        }
+    }
+
+    return projects;
+}
+
 uint32_t bake_crawler_search(
     bake_config *config,
     const char *path,
@@ -502,7 +620,26 @@ uint32_t bake_crawler_search(
     }
 
     if (ut_file_test(path)) {
-        ut_try( bake_crawler_crawl(config, ".", path), NULL);
+        /* Load directories visited by the previous crawl of the path */
+        char *root;
+        if (ut_path_is_relative(path)) {
+            root = ut_asprintf("%s"UT_OS_PS"%s", ut_cwd(), path);
+            ut_path_clean(root, root);
+        } else {
+            root = ut_strdup(path);
+        }
+
+        bake_crawl_cache *cache = bake_crawl_cache_load(
+            strarg("%s"UT_OS_PS".bake_cache"UT_OS_PS"crawl", root));
+
+        int16_t ret = bake_crawler_crawl(config, cache, root, ".", path);
+        if (!ret && bake_crawl_cache_save(cache)) {
+            ut_catch();
+        }
+
+        bake_crawl_cache_free(cache);
+        free(root);
+        ut_try (ret, NULL);
 
         /* If crawling recursively, discover unresolved depdendencies. Do this
          * after discovering projects in the provided directory, so these take
@@ -549,23 +686,27 @@ int16_t bake_crawler_build_project(
     bake_config *config,
     const char *action_name,
     bake_crawler_cb action,
-    bake_project *p,
-    ut_ll readyForBuild)
+    bake_project *p)
 {
     if (!ut_getenv("BAKE_SETUP")) {
         bake_message(UT_LOG, action_name, "#[green]%s#[reset] %s #[grey]=>#[reset] '%s'", 
             bake_project_type_str(p->type), p->id, p->path);
     }
 
-    if (action(config, p)) {
+    /* Project holds a job slot while it is built */
+    bake_jobs_acquire();
+    bake_trace_begin("project", p->id);
+    int ret = action(config, p);
+    bake_trace_end("project", p->id);
+    bake_jobs_release();
+
+    if (ret) {
         ut_raise();
         bake_message(UT_ERROR, "error", "build interrupted for %s in %s", p->id, p->path);
+        ut_error("project #[red]%s#[reset] built with errors", p->id);
         goto error;
     }
 
-    /* Decrease unresolved_dependencies of dependents */
-    bake_crawler_decrease_dependents(p, readyForBuild);
-
     return 0;
 error:
     return -1;
@@ -585,10 +726,127 @@ void bake_crawler_collect_ready_for_build(
     }
 }
 
+/* State shared by threads that build projects in parallel */
+typedef struct bake_crawler_walker {
+    bake_config *config;
+    const char *action_name;
+    bake_crawler_cb action;
+    ut_ll readyForBuild;    /* Projects of which all dependencies are built */
+    struct ut_mutex_s lock; /* Protects walker and dependency administration */
+    struct ut_cond_s cond;  /* Signals new ready projects or end of walk */
+    uint32_t running;       /* Number of projects that are being built */
+    uint32_t built;         /* Number of projects that have been built */
+    int16_t result;
+} bake_crawler_walker;
+
+static
+void* bake_crawler_walk_thread(
+    void *arg)
+{
+    bake_crawler_walker *walker = arg;
+    bake_project *p;
+
+    ut_tls_set(BAKE_CONFIG_KEY, walker->config);
+
+    ut_mutex_lock(&walker->lock);
+    do {
+        /* Wait for a project to become ready. If no projects are ready and no
+         * projects are being built, no more projects can become ready. */
+        while (!(p = ut_ll_takeFirst(walker->readyForBuild)) && walker->running) {
+            ut_cond_wait(&walker->cond, &walker->lock);
+        }
+
+        if (p) {
+            walker->running ++;
+            ut_mutex_unlock(&walker->lock);
+
+            int16_t ret = bake_crawler_build_project(
+                walker->config, walker->action_name, walker->action, p);
+
+            ut_mutex_lock(&walker->lock);
+            if (ret) {
+                walker->result = -1;
+            } else {
+                /* The project has been installed, so its location may have
+                 * changed. Reset it before dependents start, as projects
+                 * don't reset the locations of their dependencies while they
+                 * are built in parallel. */
+                ut_locate_reset(p->id);
+                bake_crawler_decrease_dependents(p, walker->readyForBuild);
+            }
+            walker->built ++;
+            walker->running --;
+            ut_cond_broadcast(&walker->cond);
+        }
+    } while (p);
+    ut_mutex_unlock(&walker->lock);
+
+    return NULL;
+}
+
+/* Build projects of which the dependencies have been built in parallel, with
+ * one thread for each job. Jobs of the projects (like compiling files) share
+ * the job slots with the projects, so that the total amount of work that runs
+ * at the same time does not exceed the number of jobs. */
+static
+int16_t bake_crawler_walk_parallel(
+    bake_config *config,
+    const char *action_name,
+    bake_crawler_cb action,
+    ut_ll readyForBuild,
+    uint32_t *built)
+{
+    bake_crawler_walker walker = {
+        .config = config,
+        .action_name = action_name,
+        .action = action,
+        .readyForBuild = readyForBuild
+    };
+    int32_t i, thread_count = config->jobs;
+    ut_thread *threads = ut_calloc(sizeof(ut_thread) * thread_count);
+
+    ut_try (ut_mutex_new(&walker.lock), NULL);
+    ut_try (ut_cond_new(&walker.cond), NULL);
+
+    walking_parallel = true;
+
+    for (i = 0; i < thread_count; i ++) {
+        threads[i] = ut_thread_new(bake_crawler_walk_thread, &walker);
+        if (!threads[i]) {
+            ut_throw("failed to start thread");
+            walker.result = -1;
+            break;
+        }
+    }
+
+    for (i = 0; i < thread_count && threads[i]; i ++) {
+        ut_thread_join(threads[i], NULL);
+    }
+
+    walking_parallel = false;
+
+    ut_cond_free(&walker.cond);
+    ut_mutex_free(&walker.lock);
+    free(threads);
+
+    *built = walker.built;
+
+    return walker.result;
+error:
+    free(threads);
+    return -1;
+}
+
+bool bake_crawler_is_parallel(void)
+{
+    return walking_parallel;
+}
+
 int16_t bake_crawler_walk(
     bake_config *config,
     const char *action_name,
-    bake_crawler_cb action)
+    bake_crawler_cb action,
+    bool parallel)
 {
     ut_ll readyForBuild = ut_ll_new();
     uint32_t built = 0;
@@ -619,16 +877,21 @@ int16_t bake_crawler_walk(
         bake_crawler_collect_ready_for_build(&it, readyForBuild);
     }
 
-    /* Walk projects (when dependencies are resolved the list will populate) */
-    bake_project *p;
-    while ((p = ut_ll_takeFirst(readyForBuild))) {
-        if (bake_crawler_build_project(
-                config, action_name, action, p, readyForBuild))
-        {
-            ut_error("project #[red]%s#[reset] built with errors", p->id);
-            result = -1;
+    if (parallel && config->jobs > 1) {
+        result = bake_crawler_walk_parallel(
+            config, action_name, action, readyForBuild, &built);
+    } else {
+        /* Walk projects (when dependencies are resolved the list will populate) */
+        bake_project *p;
+        while ((p = ut_ll_takeFirst(readyForBuild))) {
+            if (bake_crawler_build_project(config, action_name, action, p)) {
+                result = -1;
+            } else {
+                /* Decrease unresolved_dependencies of dependents */
+                bake_crawler_decrease_dependents(p, readyForBuild);
+            }
+            built ++;
         }
-        built ++;
     }
 
     /* If there are still unbuilt projects it could be a dependency cycle or a
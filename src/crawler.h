@@ -74,15 +74,34 @@ uint32_t bake_crawler_count(void);
   bake_project* bake_crawler_get(
       const char *id);
 
+/** Get projects found by searches.
+ *
+ * @return List of projects, which must be freed by the caller.
+ */
+ut_ll bake_crawler_projects(void);
+
+/** Test if projects are walked in parallel.
+ * While projects are walked in parallel, the crawler resets the location of a
+ * project after it is built. Projects must not reset locations of their
+ * dependencies, as other projects may still use them.
+ *
+ * @return true if projects are walked in parallel.
+ */
+bool bake_crawler_is_parallel(void);
+
 /** Walk projects.
  * This walks projects found with bake_crawler_search in correct dependency
- * order.
+ * order. When parallel is true and more than one job is configured, projects
+ * that do not depend on each other are walked at the same time, which requires
+ * the action to be safe to invoke from multiple threads.
  *
  * @param _this A crawler object.
  * @param action Callback to invoke when project is found.
+ * @param parallel Walk independent projects in parallel.
  * @return non-zero if success, zero if interrupted.
  */
 int16_t bake_crawler_walk(
     bake_config *config,
     const char *action_name,
-    bake_crawler_cb action);
+    bake_crawler_cb action,
+    bool parallel);
@@ -24,6 +24,11 @@
 typedef int (*buildmain_cb)(bake_driver_api *driver);
 
 static ut_ll drivers;
+
+/* Drivers can be loaded while projects are built in parallel. A driver that is
+ * being loaded can import or look up other drivers, so the thread that holds
+ * the lock may take it again, which is why the lock is recursive. */
+static struct ut_mutex_s drivers_lock;
 extern ut_tls BAKE_DRIVER_KEY;
 extern ut_tls BAKE_FILELIST_KEY;
 extern ut_tls BAKE_PROJECT_KEY;
@@ -268,6 +273,34 @@ void bake_driver_condition_cb(
     }
 }
 
+static
+void bake_driver_rule_command_cb(
+    const char *name,
+    bake_rule_command_cb command)
+{
+    bake_driver *driver = ut_tls_get(BAKE_DRIVER_KEY);
+    bake_node *n = bake_node_find(driver, name);
+    if (!n || n->kind != BAKE_RULE_RULE) {
+        ut_throw("rule '%s' not found for command", name);
+        driver->error = true;
+    } else {
+        ((bake_rule*)n)->command = command;
+    }
+}
+
+static
+void bake_driver_cache_put_cb(
+    uint64_t key,
+    const char *target)
+{
+    if (bake_cache_put(key, target)) {
+        /* Failing to store an object doesn't fail the build */
+        ut_warning("failed to store '%s' in object cache: %s",
+            target, ut_lasterr());
+        ut_catch();
+    }
+}
+
 static
 bake_rule_target bake_driver_target_pattern_cb(
     const char *pattern)
@@ -386,6 +419,14 @@ void bake_driver_clean_cb(
     driver->impl.clean = clean;
 }
 
+static
+void bake_driver_sources_cb(
+    bake_sources_cb sources)
+{
+    bake_driver *driver = ut_tls_get(BAKE_DRIVER_KEY);
+    driver->impl.sources = sources;
+}
+
 static
 bake_attr* bake_driver_get_attr_cb(
     const char *name)
@@ -501,6 +542,54 @@ void bake_driver_set_attr_bool_cb(
     bake_project_set_attr_bool(config, project, driver->id, name, value);
 }
 
+static
+void bake_driver_exec_error(
+    bake_job *job)
+{
+    if (job) {
+        job->error = true;
+    } else {
+        bake_project *p = ut_tls_get(BAKE_PROJECT_KEY);
+        p->error = true;
+    }
+}
+
+/* Run command, report errors on the job or project */
+static
+void bake_driver_exec_run(
+    const char *cmd,
+    const char *argv[])
+{
+    /* When invoked from a job, capture output and report errors on the job,
+     * as jobs for the same project may run in parallel */
+    bake_job *job = bake_job_current();
+    FILE *out = job ? job->output : NULL;
+    int8_t ret = 0;
+    int sig;
+    ut_proc pid = 0;
+    uint64_t start = bake_trace_now();
+
+    if (argv) {
+        sig = ut_proc_cmd_argv(argv, &ret, out, out, &pid);
+    } else {
+        sig = ut_proc_cmd_pid((char*)cmd, &ret, out, out, &pid);
+    }
+
+    bake_trace_command(job ? job->name : cmd, cmd, start, pid, ret, sig);
+
+    if (sig || ret) {
+        if (!sig) {
+            ut_throw("command returned %d", ret);
+        } else if (sig == -1) {
+            ut_throw("failed to run command");
+        } else {
+            ut_throw("command exited with signal %d", sig);
+        }
+        ut_throw_detail("%s", cmd);
+        bake_driver_exec_error(job);
+    }
+}
+
 static
 void bake_driver_exec_cb(
     const char *cmd)
@@ -508,25 +597,57 @@ void bake_driver_exec_cb(
     char *envcmd = ut_envparse("%s", cmd);
     if (!envcmd) {
         ut_throw("invalid command '%s'", cmd);
-        bake_project *p = ut_tls_get(BAKE_PROJECT_KEY);
-        p->error = true;
+        bake_driver_exec_error(bake_job_current());
     } else {
-        int8_t ret = 0;
-        int sig = ut_proc_cmd(envcmd, &ret);
-        if (sig || ret) {
-            if (!sig) {
-                ut_throw("command returned %d", ret);
-                ut_throw_detail("%s", envcmd);
-            } else {
-                ut_throw("command exited with signal %d", sig);
-                ut_throw_detail("%s", envcmd);
-            }
+        bake_driver_exec_run(envcmd, NULL);
+        free(envcmd);
+    }
+}
+
+static
+void bake_driver_exec_argv_cb(
+    const char *argv[])
+{
+    ut_strbuf cmd = UT_STRBUF_INIT;
+    int32_t i, count = 0;
+
+    while (argv[count]) {
+        count ++;
+    }
 
-            bake_project *p = ut_tls_get(BAKE_PROJECT_KEY);
-            p->error = true;
+    if (!count) {
+        ut_throw("empty command");
+        bake_driver_exec_error(bake_job_current());
+        return;
+    }
+
+    const char **args = malloc((count + 1) * sizeof(char*));
+    for (i = 0; i < count; i ++) {
+        char *arg = ut_envparse("%s", argv[i]);
+        if (!arg) {
+            ut_throw("invalid argument '%s'", argv[i]);
+            bake_driver_exec_error(bake_job_current());
+            break;
         }
-        free(envcmd);
+        args[i] = arg;
+
+        /* Command string is only used for reporting */
+        if (i) ut_strbuf_appendstr(&cmd, " ");
+        ut_strbuf_appendstr(&cmd, arg);
+    }
+
+    char *cmdstr = ut_strbuf_get(&cmd);
+
+    if (i == count) {
+        args[count] = NULL;
+        bake_driver_exec_run(cmdstr, args);
+    }
+
+    while (i --) {
+        free((char*)args[i]);
     }
+    free(args);
+    free(cmdstr);
 }
 
 static
@@ -686,7 +807,12 @@ bake_driver_api bake_driver_api_impl = {
     .get_json = bake_driver_get_json_cb,
     .set_attr_bool = bake_driver_set_attr_bool_cb,
     .set_attr_string = bake_driver_set_attr_string_cb,
-    .set_attr_array = bake_driver_set_attr_array_cb
+    .set_attr_array = bake_driver_set_attr_array_cb,
+    .rule_command = bake_driver_rule_command_cb,
+    .cache_get = bake_cache_get,
+    .cache_put = bake_driver_cache_put_cb,
+    .sources = bake_driver_sources_cb,
+    .exec_argv = bake_driver_exec_argv_cb
 };
 
 char* bake_driver__artefact(
@@ -971,9 +1097,26 @@ int16_t bake_driver__coverage(
     return 0;
 }
 
+int16_t bake_driver_init(void)
+{
+    return ut_mutex_new_recursive(&drivers_lock);
+}
+
+static
+void bake_driver_lock(void)
+{
+    ut_mutex_lock(&drivers_lock);
+}
+
+static
+void bake_driver_unlock(void)
+{
+    ut_mutex_unlock(&drivers_lock);
+}
+
 /** Load new driver, or import definitions from other driver */
 static
-bake_driver* bake_driver_get_intern(
+bake_driver* bake_driver_load(
     const char *id,
     bake_driver *driver)
 {
@@ -1048,6 +1191,17 @@ error:
     return NULL;
 }
 
+static
+bake_driver* bake_driver_get_intern(
+    const char *id,
+    bake_driver *driver)
+{
+    bake_driver_lock();
+    bake_driver *result = bake_driver_load(id, driver);
+    bake_driver_unlock();
+    return result;
+}
+
 bake_driver* bake_driver_get(
     const char *id)
 {
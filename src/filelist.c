@@ -21,36 +21,193 @@
 
 #include "bake.h"
 
+/* Files are stored in an array, together with a hash index on the file path.
+ * File records and strings are allocated from chunks that are owned by the
+ * filelist, so that adding a file doesn't require multiple allocations, and
+ * pointers to files remain valid while files are added. Files in the same
+ * directory share a single copy of the directory path. */
+
+#define BAKE_FILELIST_CHUNK_SIZE (16 * 1024)
+#define BAKE_FILELIST_ALIGN (sizeof(void*))
+
+typedef struct bake_filelist_chunk {
+    struct bake_filelist_chunk *next;
+    size_t size;
+    size_t used;
+    char data[];
+} bake_filelist_chunk;
+
 extern ut_tls BAKE_FILELIST_KEY;
 
-bake_file* bake_file_copy(
-    bake_file *file)
+static
+void* bake_filelist_alloc(
+    bake_filelist *fl,
+    size_t size)
+{
+    bake_filelist_chunk *chunk = fl->chunks;
+    size_t offset = 0;
+
+    if (chunk) {
+        offset = (chunk->used + BAKE_FILELIST_ALIGN - 1) &
+            ~(BAKE_FILELIST_ALIGN - 1);
+    }
+
+    if (!chunk || offset + size > chunk->size) {
+        size_t chunk_size = BAKE_FILELIST_CHUNK_SIZE;
+        if (size > chunk_size) {
+            chunk_size = size;
+        }
+
+        chunk = malloc(sizeof(bake_filelist_chunk) + chunk_size);
+        chunk->next = fl->chunks;
+        chunk->size = chunk_size;
+        fl->chunks = chunk;
+        offset = 0;
+    }
+
+    chunk->used = offset + size;
+
+    return &chunk->data[offset];
+}
+
+static
+char* bake_filelist_strdup(
+    bake_filelist *fl,
+    const char *str)
 {
-    bake_file *result = malloc(sizeof(bake_file));
-    result->name = ut_strdup(file->name);
-    result->path = ut_strdup(file->path);
-    result->file_path = ut_strdup(file->file_path);
-    result->timestamp = file->timestamp;
+    size_t len = strlen(str);
+    char *result = bake_filelist_alloc(fl, len + 1);
+    memcpy(result, str, len + 1);
     return result;
 }
 
-void bake_filelist_free(
+/* Files are usually added per directory, so only compare with the directory
+ * of the last added file to find a copy of the path */
+static
+char* bake_filelist_intern_path(
+    bake_filelist *fl,
+    const char *path)
+{
+    if (!path) {
+        return NULL;
+    }
+
+    if (fl->count) {
+        char *last = fl->files[fl->count - 1]->path;
+        if (last && !strcmp(last, path)) {
+            return last;
+        }
+    }
+
+    return bake_filelist_strdup(fl, path);
+}
+
+static
+int32_t* bake_filelist_bucket(
+    bake_filelist *fl,
+    const char *file_path)
+{
+    int32_t mask = fl->index_size - 1;
+    int32_t i = ut_hash_str(file_path, UT_HASH_INIT) & mask;
+
+    while (fl->index[i]) {
+        if (!strcmp(fl->files[fl->index[i] - 1]->file_path, file_path)) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+
+    return &fl->index[i];
+}
+
+/* Add files that were added since the last lookup to the index. The index is
+ * only built when it is used, so that filelists that are only iterated over
+ * don't pay for it. */
+static
+void bake_filelist_index_update(
     bake_filelist *fl)
 {
-    if (fl->pattern) {
-        free(fl->pattern);
+    /* Keep index at most half full */
+    if (fl->count * 2 > fl->index_size) {
+        free(fl->index);
+        fl->index_size = fl->index_size ? fl->index_size * 2 : 32;
+        while (fl->count * 2 > fl->index_size) {
+            fl->index_size *= 2;
+        }
+        fl->index = calloc(fl->index_size, sizeof(int32_t));
+        fl->indexed = 0;
     }
-    if (fl->files) {
-        ut_iter it = ut_ll_iter(fl->files);
-        while (ut_iter_hasNext(&it)) {
-            bake_file *f = ut_iter_next(&it);
-            if (f->name) free(f->name);
-            if (f->path) free(f->path);
-            if (f->file_path) free(f->file_path);
-            free(f);
+
+    for (; fl->indexed < fl->count; fl->indexed ++) {
+        int32_t *bucket = bake_filelist_bucket(
+            fl, fl->files[fl->indexed]->file_path);
+        if (!*bucket) {
+            *bucket = fl->indexed + 1;
         }
-        ut_ll_free(fl->files);
     }
+}
+
+/* Add file to filelist. If file_path is NULL, it is created from the path and
+ * name of the file. */
+static
+bake_file* bake_filelist_append(
+    bake_filelist *fl,
+    const char *path,
+    const char *name,
+    const char *file_path,
+    uint64_t timestamp)
+{
+    bake_file *bfile = bake_filelist_alloc(fl, sizeof(bake_file));
+    bfile->path = bake_filelist_intern_path(fl, path);
+
+    if (file_path) {
+        bfile->file_path = bake_filelist_strdup(fl, file_path);
+
+        /* If name is the last part of the file path, point to the copy */
+        size_t len = strlen(file_path), name_len = strlen(name);
+        if (name_len <= len && !strcmp(&file_path[len - name_len], name)) {
+            bfile->name = &bfile->file_path[len - name_len];
+        } else {
+            bfile->name = bake_filelist_strdup(fl, name);
+        }
+    } else if (!path || !ut_path_is_relative(name)) {
+        bfile->file_path = bake_filelist_strdup(fl, name);
+        bfile->name = bfile->file_path;
+    } else {
+        size_t path_len = strlen(path), name_len = strlen(name);
+        bfile->file_path = bake_filelist_alloc(fl, path_len + name_len + 2);
+        memcpy(bfile->file_path, path, path_len);
+        bfile->file_path[path_len] = UT_OS_PS[0];
+        memcpy(&bfile->file_path[path_len + 1], name, name_len + 1);
+        bfile->name = &bfile->file_path[path_len + 1];
+    }
+
+    bfile->timestamp = timestamp;
+
+    if (fl->count == fl->size) {
+        fl->size = fl->size ? fl->size * 2 : 16;
+        fl->files = realloc(fl->files, fl->size * sizeof(bake_file*));
+    }
+
+    fl->files[fl->count ++] = bfile;
+
+    return bfile;
+}
+
+void bake_filelist_free(
+    bake_filelist *fl)
+{
+    bake_filelist_chunk *chunk = fl->chunks, *next;
+    while (chunk) {
+        next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    free(fl->pattern);
+    free(fl->path);
+    free(fl->files);
+    free(fl->index);
     free(fl);
 }
 
@@ -66,18 +223,8 @@ bake_file* bake_filelist_add_intern(
         goto error;
     }
 
-    bake_file *bfile = malloc(sizeof(bake_file));
-    bfile->name = ut_strdup(filename);
-    bfile->path = ut_strdup(path);
-
-    if (!ut_path_is_relative(filename)) {
-        bfile->file_path = ut_strdup(filename);
-    } else {
-        bfile->file_path = ut_asprintf("%s%c%s", path, UT_OS_PS[0],  filename);
-    }
-    bfile->timestamp = timestamp;
-
-    ut_ll_append(fl->files, bfile);
+    bake_file *bfile = bake_filelist_append(
+        fl, path, filename, NULL, timestamp);
 
     if (timestamp) {
         ut_trace("#[grey]%s (modified=%d, path='%s')", filename, timestamp, path);
@@ -89,7 +236,6 @@ bake_file* bake_filelist_add_intern(
 error:
     return NULL;
 }
-
 static
 int16_t bake_filelist_populate(
     bake_filelist *fl,
@@ -124,10 +270,35 @@ error:
     return -1;
 }
 
+static
+bool bake_filelist_iter_hasNext(
+    ut_iter *it)
+{
+    bake_filelist *fl = it->ctx;
+    return (intptr_t)it->data < fl->count;
+}
+
+static
+void* bake_filelist_iter_next(
+    ut_iter *it)
+{
+    bake_filelist *fl = it->ctx;
+    intptr_t i = (intptr_t)it->data;
+    it->data = (void*)(i + 1);
+    return fl->files[i];
+}
+
 ut_iter bake_filelist_iter(
     bake_filelist *fl)
 {
-    return ut_ll_iterAlloc(fl->files);
+    ut_iter result = {
+        .ctx = fl,
+        .data = 0,
+        .hasNext = bake_filelist_iter_hasNext,
+        .next = bake_filelist_iter_next
+    };
+
+    return result;
 }
 
 int16_t bake_filelist_set(
@@ -157,11 +328,10 @@ bake_filelist* bake_filelist_new(
     const char *path,
     const char *pattern)
 {
-    bake_filelist *result = malloc(sizeof(bake_filelist));
+    bake_filelist *result = ut_calloc(sizeof(bake_filelist));
     if (!path) path = ".";
     result->path = ut_strdup(path);
     result->pattern = ut_strdup(pattern);
-    result->files = ut_ll_new();
     result->set = bake_filelist_set_cb;
 
     if (pattern) {
@@ -229,22 +399,40 @@ int16_t bake_filelist_add_pattern(
     return result;
 }
 
+bake_file* bake_filelist_find(
+    bake_filelist *fl,
+    const char *file_path)
+{
+    if (!fl->count) {
+        return NULL;
+    }
+
+    bake_filelist_index_update(fl);
+
+    int32_t *bucket = bake_filelist_bucket(fl, file_path);
+    if (*bucket) {
+        return fl->files[*bucket - 1];
+    } else {
+        return NULL;
+    }
+}
+
 int16_t bake_filelist_merge(
     bake_filelist *fl,
     bake_filelist *src)
 {
-    ut_iter it = ut_ll_iter(src->files);
-    while (ut_iter_hasNext(&it)) {
-        ut_ll_append(fl->files, bake_file_copy(ut_iter_next(&it)));
+    int32_t i;
+    for (i = 0; i < src->count; i ++) {
+        bake_file *file = src->files[i];
+        bake_filelist_append(
+            fl, file->path, file->name, file->file_path, file->timestamp);
     }
 
     return 0;
-error:
-    return -1;
 }
 
 int bake_filelist_count(
     bake_filelist *fl)
 {
-    return ut_ll_count(fl->files);
+    return fl->count;
 }
@@ -289,6 +289,7 @@ int16_t bake_install_metadata(
 
             fprintf(src_location, "%s\n", project->fullpath);
             fclose(src_location);
+            ut_stat_invalidate(strarg("%s"UT_OS_PS"source.txt", projectDir));
 
             /* If project contains dependee JSON, write to dependee.json */
             if (project->dependee_json && strlen(project->dependee_json)) {
@@ -302,6 +303,8 @@ int16_t bake_install_metadata(
                 }
                 fprintf(dependee_config, "%s\n", project->dependee_json);
                 fclose(dependee_config);
+                ut_stat_invalidate(
+                    strarg("%s"UT_OS_PS"dependee.json", projectDir));
                 ut_trace("#[cyan]write %s"UT_OS_PS"dependee.json", projectDir);
             }
             free(projectDir);
@@ -0,0 +1,347 @@
+/* Copyright (c) 2010-2019 Sander Mertens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "bake.h"
+
+extern ut_tls BAKE_DRIVER_KEY;
+extern ut_tls BAKE_PROJECT_KEY;
+extern ut_tls BAKE_CONFIG_KEY;
+extern ut_tls BAKE_JOB_KEY;
+
+/* Jobs that may run at the same time across all projects. Threads that build a
+ * project hold a slot for the duration of the build, and job pools of those
+ * projects only hand jobs to workers while slots are available. */
+static ut_sem bake_job_slots;
+
+/* Serializes log output of the threads that build projects and their workers,
+ * so that messages and output of commands are not interleaved */
+static struct ut_mutex_s bake_job_log_lock;
+
+struct bake_job_pool {
+    bake_driver *driver;
+    bake_project *project;
+    bake_config *config;
+
+    ut_thread *workers;     /* Worker threads */
+    int32_t worker_count;   /* Number of worker threads */
+
+    ut_ll queue;            /* Jobs that have not yet been picked up */
+    ut_ll jobs;             /* All jobs submitted to pool */
+    struct ut_mutex_s lock; /* Protects queue and job state */
+    struct ut_cond_s cond;  /* Signals new jobs or closing of pool */
+    bool closed;            /* Set when no new jobs will be submitted */
+    bake_job *failed;       /* First job that failed */
+};
+
+int16_t bake_jobs_init(
+    bake_config *config)
+{
+    ut_try (ut_mutex_new(&bake_job_log_lock), NULL);
+    ut_try (!(bake_job_slots = ut_sem_new(config->jobs)), NULL);
+    return 0;
+error:
+    return -1;
+}
+
+void bake_jobs_deinit(void)
+{
+    if (bake_job_slots) {
+        ut_sem_free(bake_job_slots);
+        ut_mutex_free(&bake_job_log_lock);
+        bake_job_slots = NULL;
+    }
+}
+
+void bake_jobs_acquire(void)
+{
+    if (bake_job_slots) {
+        ut_sem_wait(bake_job_slots);
+    }
+}
+
+void bake_jobs_release(void)
+{
+    if (bake_job_slots) {
+        ut_sem_post(bake_job_slots);
+    }
+}
+
+static
+bool bake_jobs_try_acquire(void)
+{
+    return bake_job_slots && !ut_sem_tryWait(bake_job_slots);
+}
+
+static
+void bake_jobs_log_lock(void)
+{
+    if (bake_job_slots) {
+        ut_mutex_lock(&bake_job_log_lock);
+    }
+}
+
+static
+void bake_jobs_log_unlock(void)
+{
+    if (bake_job_slots) {
+        ut_mutex_unlock(&bake_job_log_lock);
+    }
+}
+
+static
+bake_job* bake_job_pool_take(
+    bake_job_pool *pool)
+{
+    bake_job *job = NULL;
+
+    ut_mutex_lock(&pool->lock);
+    while (!(job = ut_ll_takeFirst(pool->queue)) && !pool->closed) {
+        ut_cond_wait(&pool->cond, &pool->lock);
+    }
+    ut_mutex_unlock(&pool->lock);
+
+    return job;
+}
+
+static
+void bake_job_flush_output(
+    bake_job *job)
+{
+    char buffer[4096];
+    size_t read;
+
+    if (!job->output) {
+        return;
+    }
+
+    rewind(job->output);
+    while ((read = fread(buffer, 1, sizeof(buffer), job->output))) {
+        fwrite(buffer, 1, read, stderr);
+    }
+    fflush(stderr);
+    fclose(job->output);
+    job->output = NULL;
+}
+
+static
+void bake_job_run(
+    bake_job_pool *pool,
+    bake_job *job)
+{
+    /* Capture output of commands, so that output of a job is not interleaved
+     * with output of jobs that run in parallel */
+    job->output = tmpfile();
+
+    ut_tls_set(BAKE_JOB_KEY, job);
+    job->action(
+        &bake_driver_api_impl,
+        pool->config,
+        pool->project,
+        job->source,
+        job->target->file_path);
+    ut_tls_set(BAKE_JOB_KEY, NULL);
+
+    /* Update target with latest timestamp */
+    ut_stat_invalidate(job->target->file_path);
+    if (ut_file_test(job->target->file_path) == 1) {
+        job->target->timestamp = ut_lastmodified(job->target->file_path);
+    } else {
+        job->target->timestamp = 0;
+    }
+
+    if (!job->error && pool->project->build_state) {
+        bake_build_state_record(
+            pool->project->build_state, job->target->file_path, job->source,
+            job->command);
+    }
+
+    bake_jobs_log_lock();
+    bake_job_flush_output(job);
+    if (job->error) {
+        ut_raise();
+    }
+    bake_jobs_log_unlock();
+
+    if (job->error) {
+        ut_mutex_lock(&pool->lock);
+        if (!pool->failed) {
+            pool->failed = job;
+        }
+        ut_mutex_unlock(&pool->lock);
+    }
+}
+
+static
+void* bake_job_worker(
+    void *arg)
+{
+    bake_job_pool *pool = arg;
+    bake_job *job;
+
+    /* Driver API callbacks obtain their context from thread local storage */
+    ut_tls_set(BAKE_DRIVER_KEY, pool->driver);
+    ut_tls_set(BAKE_PROJECT_KEY, pool->project);
+    ut_tls_set(BAKE_CONFIG_KEY, pool->config);
+
+    while ((job = bake_job_pool_take(pool))) {
+        bake_job_run(pool, job);
+        bake_jobs_release();
+    }
+
+    return NULL;
+}
+
+bake_job_pool* bake_job_pool_new(
+    bake_driver *driver,
+    bake_project *project,
+    bake_config *config)
+{
+    int32_t i;
+
+    if (config->jobs <= 1) {
+        return NULL;
+    }
+
+    bake_job_pool *result = ut_calloc(sizeof(bake_job_pool));
+    result->driver = driver;
+    result->project = project;
+    result->config = config;
+    /* The thread that submits jobs holds a slot, and runs jobs itself when no
+     * other slots are available, so one less worker is needed */
+    result->worker_count = config->jobs - 1;
+    result->queue = ut_ll_new();
+    result->jobs = ut_ll_new();
+
+    ut_try (ut_mutex_new(&result->lock), NULL);
+    ut_try (ut_cond_new(&result->cond), NULL);
+
+    result->workers = ut_calloc(sizeof(ut_thread) * result->worker_count);
+    for (i = 0; i < result->worker_count; i ++) {
+        result->workers[i] = ut_thread_new(bake_job_worker, result);
+        if (!result->workers[i]) {
+            ut_throw("failed to start worker thread");
+            goto error;
+        }
+    }
+
+    return result;
+error:
+    if (result->workers) {
+        bake_job_pool_wait(result);
+    } else {
+        ut_ll_free(result->queue);
+        ut_ll_free(result->jobs);
+        free(result);
+    }
+    return NULL;
+}
+
+int16_t bake_job_pool_submit(
+    bake_job_pool *pool,
+    bake_rule_action_cb action,
+    const char *source,
+    bake_file *target,
+    uint64_t command,
+    const char *name,
+    const char *progress)
+{
+    ut_mutex_lock(&pool->lock);
+    bool failed = pool->failed != NULL;
+    ut_mutex_unlock(&pool->lock);
+
+    /* Don't start new jobs after a job failed */
+    if (failed) {
+        return -1;
+    }
+
+    bake_job *job = ut_calloc(sizeof(bake_job));
+    job->action = action;
+    job->source = ut_strdup(source);
+    job->target = target;
+    job->command = command;
+    job->name = name;
+
+    bake_jobs_log_lock();
+    bake_message(UT_LOG, progress, name);
+    bake_jobs_log_unlock();
+
+    ut_mutex_lock(&pool->lock);
+    ut_ll_append(pool->jobs, job);
+
+    /* If all slots are taken by other jobs or projects, run the job in the
+     * current thread. This limits the total number of jobs to the budget, and
+     * cannot deadlock on threads that each wait for a slot. */
+    if (!bake_jobs_try_acquire()) {
+        ut_mutex_unlock(&pool->lock);
+        bake_job_run(pool, job);
+        return 0;
+    }
+
+    ut_ll_append(pool->queue, job);
+    ut_cond_signal(&pool->cond);
+    ut_mutex_unlock(&pool->lock);
+
+    return 0;
+}
+
+int16_t bake_job_pool_wait(
+    bake_job_pool *pool)
+{
+    int16_t result = 0;
+    int32_t i;
+
+    ut_mutex_lock(&pool->lock);
+    pool->closed = true;
+    ut_cond_broadcast(&pool->cond);
+    ut_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->worker_count; i ++) {
+        if (pool->workers[i]) {
+            ut_thread_join(pool->workers[i], NULL);
+        }
+    }
+
+    if (pool->failed) {
+        ut_throw("command for task '%s' failed", pool->failed->name);
+        pool->project->error = true;
+        result = -1;
+    }
+
+    bake_job *job;
+    while ((job = ut_ll_takeFirst(pool->jobs))) {
+        free(job->source);
+        free(job);
+    }
+
+    ut_ll_free(pool->jobs);
+    ut_ll_free(pool->queue);
+    ut_cond_free(&pool->cond);
+    ut_mutex_free(&pool->lock);
+    free(pool->workers);
+    free(pool);
+
+    return result;
+}
+
+bake_job* bake_job_current(void)
+{
+    return ut_tls_get(BAKE_JOB_KEY);
+}
@@ -27,6 +27,7 @@ ut_tls BAKE_DRIVER_KEY;
 ut_tls BAKE_FILELIST_KEY;
 ut_tls BAKE_PROJECT_KEY;
 ut_tls BAKE_CONFIG_KEY;
+ut_tls BAKE_JOB_KEY;
 
 /* Bake configuration */
 const char *cfg = NULL;
@@ -54,7 +55,10 @@ bool optimize = false;
 bool loop_test = false;
 bool assembly = false;
 bool profile_build = false;
+int32_t jobs = 0;
+bool cache = false;
 
+bool has_options = false;
 bool is_test = false;
 bool to_env = false;
 bool always_clone = false;
@@ -78,12 +82,15 @@ const char *use_expr = NULL;
 const char *publish_cmd = NULL;
 const char *run_prefix = NULL;
 const char *test_prefix = NULL;
+const char *test_shard = NULL;
 bool interactive = false;
 bool recursive = false;
 int run_argc = 0;
 const char **run_argv = NULL;
 const char *foreach_cmd = NULL;
 const char *list_filter = NULL;
+const char *cache_cmd = NULL;
+const char *trace_out = NULL;
 bool show_repositories = false;
 
 #define ARG(short, long, action)\
@@ -122,6 +129,8 @@ void bake_usage(void)
     printf("  --optimize                   Manually enable compiler optimizations\n");
     printf("  --loop-test                  Manually enable vectorization analysis\n");
     printf("  --profile-build              Manually enable build profiling\n");
+    printf("  -j,--jobs <count>            Number of jobs to run in parallel (default = $BAKE_JOBS or 1)\n");
+    printf("  --cache                      Use object cache in bake environment (default = $BAKE_CACHE)\n");
     printf("\n");
     printf("  --package                    Set the project type to package\n");
     printf("  --template                   Set the project type to template\n");
@@ -142,6 +151,7 @@ void bake_usage(void)
     printf("  --interactive                Rebuild project when files change (use with run)\n");
     printf("  --run-prefix                 Specify prefix command for run\n");
     printf("  --test-prefix                Specify prefix command for tests run by test\n");
+    printf("  --shard <index>/<count>      Only run the part of the tests assigned to shard (use with test)\n");
     printf("  --fast                       Don't add any instrumentations to test builds\n");
     printf("  -r,--recursive               Recursively build all dependencies of discovered projects\n");
     printf("  -t [id]                      Specify template for new project\n");
@@ -151,6 +161,7 @@ void bake_usage(void)
     printf("\n");
     printf("  -v,--verbosity <kind>        Set verbosity level (DEBUG, TRACE, OK, INFO, WARNING, ERROR, CRITICAL)\n");
     printf("  --trace                      Set verbosity to TRACE\n");
+    printf("  --trace-out <file>           Write timings of build to file in Chrome trace format\n");
     printf("  --debug                      Set verbosity to DEBUG (highest verbosity)\n");
     printf("\n");
     printf("Commands:\n");
@@ -177,6 +188,8 @@ void bake_usage(void)
     printf("\n");
     printf("  info <package id>            Display info on a project in the bake environment\n");
     printf("  list [filter]                List packages in bake environment\n");
+    printf("  cache <stats|clear>          Show statistics for or clear object cache\n");
+    printf("  server [path]                Keep bake loaded to build projects in path on request\n");
     printf("\n");
     printf("Examples:\n");
     printf("  bake                         Build all projects discovered in current directory\n");
@@ -273,6 +286,8 @@ int16_t bake_init_action(
         !strcmp(arg, "publish") ||
         !strcmp(arg, "info") ||
         !strcmp(arg, "list") ||
+        !strcmp(arg, "cache") ||
+        !strcmp(arg, "server") ||
         !strcmp(arg, "use") ||
         !strcmp(arg, "unuse") ||
         !strcmp(arg, "export") ||
@@ -308,6 +323,7 @@ int bake_parse_args(
     for (i = 1; i < argc; i ++) {
         if (argv[i][0] == '-') {
             bool parsed = false;
+            has_options = true;
 
             ARG(0, "env", env = argv[i + 1]; i ++);
             ARG(0, "cfg", cfg = argv[i + 1]; i ++);
@@ -319,8 +335,11 @@ int bake_parse_args(
             ARG(0, "optimize", optimize = true );
             ARG(0, "loop-test", loop_test = true );
             ARG(0, "assembly", assembly = true );
+            ARG('j', "jobs", jobs = atoi(argv[i + 1]); i ++);
+            ARG(0, "cache", cache = true);
 
             ARG(0, "trace", ut_log_verbositySet(UT_TRACE));
+            ARG(0, "trace-out", trace_out = argv[i + 1]; i ++);
             ARG(0, "debug", ut_log_verbositySet(UT_DEBUG));
             ARG('v', "verbosity", bake_set_verbosity(argv[i + 1]); i ++);
 
@@ -347,6 +366,7 @@ int bake_parse_args(
             ARG(0, "fast", fast_build = true);
             ARG(0, "run-prefix", run_prefix = argv[i + 1]; i++);
             ARG(0, "test-prefix", test_prefix = argv[i + 1]; i++);
+            ARG(0, "shard", test_shard = argv[i + 1]; i++);
             ARG('i', "interactive", interactive = true);
             ARG('r', "recursive", recursive = true);
             ARG('a', "args", run_argc = argc - i; run_argv = &argv[i + 1]; break);
@@ -455,6 +475,14 @@ int bake_parse_args(
         list_filter = path;
     }
 
+    else if (!strcmp(action, "cache")) {
+        if (!path_set) {
+            ut_throw("missing cache command (specify stats or clear)");
+            goto error;
+        }
+        cache_cmd = path;
+    }
+
     else if (!strcmp(action, "uninstall") && path_set) {
         id = path;
     }
@@ -535,8 +563,108 @@ int bake_build(
         goto error;
     }
 
-    /* Walk projects in correct dependency order */
-    ut_try( bake_crawler_walk(config, action, cb), NULL);
+    /* If any of the steps invoke bake, they may invoke the bake script, which
+     * can reset the LD_LIBRARY_PATH environment variable. Setting this variable
+     * to false will cause bake to fork itself again after the environment is
+     * set correctly. The variable is set once for all projects, as projects
+     * may be built in parallel. */
+    bool build = cb == bake_do_build || cb == bake_do_rebuild;
+    if (build) {
+        ut_setenv("BAKE_CHILD", "FALSE");
+    }
+
+    /* Walk projects in correct dependency order. Projects that don't depend on
+     * each other are built in parallel. */
+    ut_try( bake_crawler_walk(config, action, cb, build), NULL);
+
+    /* Reset environment variable */
+    if (build) {
+        ut_setenv("BAKE_CHILD", "TRUE");
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+/* Add dependency to server outputs if it isn't built from the server path */
+static
+void bake_server_add_dependency(
+    ut_ll outputs,
+    ut_ll dependencies)
+{
+    if (!dependencies) {
+        return;
+    }
+
+    ut_iter it = ut_ll_iter(dependencies);
+    while (ut_iter_hasNext(&it)) {
+        const char *dep = ut_iter_next(&it);
+        if (bake_crawler_get(dep)) {
+            continue;
+        }
+
+        const char *file = ut_locate(dep, NULL, UT_LOCATE_LIB);
+        if (file) {
+            ut_ll_append(outputs, ut_strdup(file));
+        } else {
+            ut_catch();
+            file = ut_locate(dep, NULL, UT_LOCATE_PROJECT);
+            if (file) {
+                ut_ll_append(outputs, ut_asprintf(
+                    "%s"UT_OS_PS"project.json", file));
+            } else {
+                ut_catch();
+            }
+        }
+    }
+}
+
+/* Collect files that the server doesn't watch, but which must not change for
+ * projects to be up to date */
+static
+void bake_server_outputs(
+    bake_config *config,
+    ut_ll outputs)
+{
+    ut_ll projects = bake_crawler_projects();
+    ut_iter it = ut_ll_iter(projects);
+    while (ut_iter_hasNext(&it)) {
+        bake_project *p = ut_iter_next(&it);
+        if (p->artefact_file) {
+            ut_ll_append(outputs, ut_strdup(p->artefact_file));
+        }
+
+        ut_ll_append(outputs, ut_asprintf("%s"UT_OS_PS"%s-%s"UT_OS_PS"obj",
+            p->cache_path, config->build_target, config->configuration));
+
+        bake_server_add_dependency(outputs, p->use);
+        bake_server_add_dependency(outputs, p->use_private);
+        bake_server_add_dependency(outputs, p->use_build);
+    }
+    ut_ll_free(projects);
+}
+
+/* Discover and build projects for a request to the bake server */
+static
+int16_t bake_server_build(
+    bake_config *config,
+    const char *action,
+    ut_ll outputs)
+{
+    /* Files may have changed since the last build */
+    ut_stat_invalidate(NULL);
+
+    /* Discover projects again, as projects may have been added or changed */
+    bake_crawler_free();
+    bake_crawler_init();
+
+    ut_try( bake_discovery(config), "discovery failed");
+
+    if (bake_crawler_count()) {
+        ut_try( bake_build(config, action), NULL);
+        bake_server_outputs(config, outputs);
+    }
 
     return 0;
 error:
@@ -1360,9 +1488,30 @@ int main(int argc, const char *argv[]) {
     ut_try (ut_tls_new(&BAKE_FILELIST_KEY, NULL), NULL);
     ut_try (ut_tls_new(&BAKE_PROJECT_KEY, NULL), NULL);
     ut_try (ut_tls_new(&BAKE_CONFIG_KEY, NULL), NULL);
+    ut_try (ut_tls_new(&BAKE_JOB_KEY, NULL), NULL);
+
+    ut_try (bake_driver_init(), NULL);
 
     ut_try (bake_parse_args(argc, argv), NULL);
 
+    bake_server_init();
+
+    /* If a bake server runs for the path, let it build the projects. Commands
+     * with options are not sent to the server, as the server builds with the
+     * options it was started with. */
+    if (!has_options && !ut_getenv("BAKE_SERVER") && (!strcmp(action, "build") ||
+        !strcmp(action, "rebuild") || !strcmp(action, "clean")))
+    {
+        int8_t rc = 0;
+        if (!bake_server_request(path, action, &rc)) {
+            ut_deinit();
+            return rc;
+        }
+
+        /* Don't send request again from the bake child process */
+        ut_setenv("BAKE_SERVER", "FALSE");
+    }
+
     if (ut_log_verbosityGet() <= UT_DEBUG) {
         ut_log_fmt("%f:%l: %C %V %m");
     } else {
@@ -1497,6 +1646,21 @@ int main(int argc, const char *argv[]) {
         config.sanitize_undefined = false;
     }
 
+    if (!jobs && ut_getenv("BAKE_JOBS")) {
+        jobs = atoi(ut_getenv("BAKE_JOBS"));
+    }
+    config.jobs = jobs > 0 ? jobs : 1;
+
+    if (!cache && ut_getenv("BAKE_CACHE")) {
+        const char *cache_env = ut_getenv("BAKE_CACHE");
+        cache = strcmp(cache_env, "0") && stricmp(cache_env, "false");
+    }
+    config.cache = cache;
+
+    if (ut_getenv("BAKE_CACHE_SIZE")) {
+        config.cache_size = bake_cache_parse_size(ut_getenv("BAKE_CACHE_SIZE"));
+    }
+
     config.defines = defines;
 
     const char *build_os = NULL;
@@ -1556,10 +1720,26 @@ int main(int argc, const char *argv[]) {
     }
 #endif
 
+    /* Start trace after forking, so it is only recorded by the process that
+     * builds the projects */
+    if (trace_out) {
+        ut_try (bake_trace_init(trace_out), NULL);
+    }
+
     /* Initialize crawler */
     bake_crawler_init();
 
+    /* Initialize job slots shared by projects and their jobs */
+    ut_try (bake_jobs_init(&config), NULL);
+
+    /* Initialize object cache */
+    ut_try (bake_cache_init(&config), NULL);
+
     if (discover) {
+        /* Projects test the same files many times while being discovered and
+         * built, so store file information while building */
+        ut_stat_cache_enable(true);
+
         /* If discover is true, first discover projects in provided path */
         ut_log_push("discovery");
         bake_project *project = NULL;
@@ -1591,25 +1771,34 @@ int main(int argc, const char *argv[]) {
             } else {
                 if (!strcmp(action, "foreach")) {
                     ut_try( bake_crawler_walk(
-                        &config, action, bake_foreach_action), NULL);
+                        &config, action, bake_foreach_action, false), NULL);
                 } else if (!strcmp(action, "update")) {
                     ut_try( bake_crawler_walk(
-                        &config, action, bake_update_action), NULL);
+                        &config, action, bake_update_action, false), NULL);
                 } else if (!strcmp(action, "test")) {
                     if (test_prefix) {
                         ut_setenv("BAKE_TEST_PREFIX", test_prefix);
                     }
+                    if (test_shard) {
+                        ut_setenv("BAKE_TEST_SHARD", test_shard);
+                    }
                     ut_try( bake_crawler_walk(
-                        &config, action, bake_test_action), NULL);
+                        &config, action, bake_test_action, false), NULL);
                 } else if (!strcmp(action, "runall")) {
                     ut_try( bake_crawler_walk(
-                        &config, action, bake_runall_action), NULL);
+                        &config, action, bake_runall_action, false), NULL);
                 } else if (!strcmp(action, "coverage")) {
                     ut_try( bake_crawler_walk(
-                        &config, action, bake_coverage_action), NULL);
+                        &config, action, bake_coverage_action, false), NULL);
                 }
             }
         }
+
+        uint64_t stat_hits, stat_misses;
+        ut_stat_cache_stats(&stat_hits, &stat_misses);
+        ut_trace("stat cache: %llu stat calls saved, %llu stat calls",
+            (unsigned long long)stat_hits, (unsigned long long)stat_misses);
+        ut_stat_cache_enable(false);
     } else {
         /* Actions that don't need project discovery */
         if (!strcmp(action, "env")) {
@@ -1655,6 +1844,11 @@ int main(int argc, const char *argv[]) {
             }
         } else if (!strcmp(action, "list")) {
             bake_list(&config, false);
+        } else if (!strcmp(action, "cache")) {
+            ut_try (bake_cache_cmd(&config, cache_cmd), NULL);
+        } else if (!strcmp(action, "server")) {
+            ut_stat_cache_enable(true);
+            ut_try (bake_server_run(&config, path, bake_server_build), NULL);
         } else if (!strcmp(action, "export")) {
             ut_try (bake_config_export(&config, export_expr), NULL);
         } else if (!strcmp(action, "unset")) {
@@ -1679,9 +1873,15 @@ int main(int argc, const char *argv[]) {
     bake_crawler_free();
 
 ok:
+    bake_trace_deinit();
+    bake_cache_deinit();
+    bake_jobs_deinit();
     ut_deinit();
     return UT_CMD_OK;
 error:
+    bake_trace_deinit();
+    bake_cache_deinit();
+    bake_jobs_deinit();
     ut_deinit();
     return UT_CMD_ERR;
 }
@@ -684,6 +684,18 @@ error:
     return -1;
 }
 
+/* Reset locate cache for a dependency, which may have been built since it was
+ * located. When projects are built in parallel, the crawler resets locations
+ * instead, as locations returned by ut_locate can be in use by other threads */
+static
+void bake_project_reset_location(
+    const char *dependency)
+{
+    if (!bake_crawler_is_parallel()) {
+        ut_locate_reset(dependency);
+    }
+}
+
 /* Add dependee configuration to project configuration (if exists) */
 static
 int16_t bake_project_add_dependee_config(
@@ -691,7 +703,7 @@ int16_t bake_project_add_dependee_config(
     bake_project *project,
     const char *dependency)
 {
-    ut_locate_reset(dependency);
+    bake_project_reset_location(dependency);
 
     const char *libpath = ut_locate(dependency, NULL, UT_LOCATE_PROJECT);
     if (libpath) {
@@ -1419,7 +1431,7 @@ int16_t bake_check_dependency(
     bake_driver *amalg_driver,
     ut_ll *amalg_copied)
 {
-    ut_locate_reset(dependency);
+    bake_project_reset_location(dependency);
 
     /* Try to find dependency path & project settings */
     const char *path = ut_locate(dependency, NULL, UT_LOCATE_PROJECT);
@@ -1474,7 +1486,22 @@ int16_t bake_check_dependency(
 
     time_t dep_modified = ut_lastmodified(lib);
 
-    if (!artefact_modified || dep_modified <= artefact_modified) {
+    /* A dependency with a newer timestamp only invalidates the artefact if
+     * the content of the dependency changed since the artefact was linked */
+    bool dep_changed = artefact_modified && dep_modified > artefact_modified;
+    if (dep_changed && p->build_state &&
+        !bake_build_state_changed(p->build_state, p->artefact_file, lib))
+    {
+        dep_changed = false;
+    }
+
+    if (p->build_state) {
+        if (bake_build_state_add(p->build_state, p->artefact_file, lib)) {
+            ut_catch();
+        }
+    }
+
+    if (!dep_changed) {
         const char *fmt = private
             ? "#[grey]use %s => %s (modified=%d private)"
             : "#[grey]use %s => %s (modified=%d)"
@@ -1793,7 +1820,7 @@ int16_t bake_project_add_dependency(
     * before when it did not exist yet, but since then has been created (which
     * would have to be through a code generation process). */
 
-    ut_locate_reset(dep);
+    bake_project_reset_location(dep);
 
     const char *libpath = ut_locate(dep, NULL, UT_LOCATE_PROJECT);
     if (!libpath) {
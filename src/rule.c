@@ -125,8 +125,61 @@ error:
     return -1;
 }
 
+/* Let driver replace the files matched by SOURCES, for example with files
+ * that compile the sources in batches */
+static
+bake_filelist* bake_node_replace_sources(
+    bake_driver *driver,
+    bake_config *config,
+    bake_project *p,
+    bake_filelist *sources)
+{
+    size_t path_len = strlen(p->path);
+    ut_ll files = ut_ll_new();
+
+    /* Pass paths relative to the project to the driver */
+    ut_iter it = bake_filelist_iter(sources);
+    while (ut_iter_hasNext(&it)) {
+        bake_file *src = ut_iter_next(&it);
+        char *file = src->file_path;
+        if (!strncmp(file, p->path, path_len) && file[path_len] == UT_OS_PS[0]) {
+            file += path_len + 1;
+        }
+        ut_ll_append(files, file);
+    }
+
+    ut_ll replace = driver->impl.sources(&bake_driver_api_impl, config, p, files);
+    ut_ll_free(files);
+
+    if (p->error) {
+        ut_throw("driver failed to replace sources");
+        goto error;
+    }
+
+    if (!replace) {
+        return sources;
+    }
+
+    bake_filelist *result = bake_filelist_new(p->path, NULL);
+    ut_try (!result, NULL);
+
+    char *file;
+    while ((file = ut_ll_takeFirst(replace))) {
+        bake_filelist_add_file(result, NULL, file);
+        free(file);
+    }
+    ut_ll_free(replace);
+
+    bake_filelist_free(sources);
+
+    return result;
+error:
+    return NULL;
+}
+
 static
 bake_filelist* bake_node_eval_pattern(
+    bake_driver *driver,
     bake_config *config,
     bake_node *n,
     bake_project *p)
@@ -154,11 +207,25 @@ bake_filelist* bake_node_eval_pattern(
             free(p_src);
         }
 
-        /* Add generated sources to list of files to compile */
+        /* Add generated sources to list of files to compile, unless they are
+         * generated in a source directory and were already matched */
         it = bake_filelist_iter(p->generated_sources);
         while (ut_iter_hasNext(&it)) {
             bake_file *src = ut_iter_next(&it);
-            bake_filelist_add_file(targets, src->path, src->name);
+            if (!bake_filelist_find(targets, src->file_path)) {
+                bake_filelist_add_file(targets, src->path, src->name);
+            }
+        }
+
+        if (driver->impl.sources) {
+            bake_filelist *replace = bake_node_replace_sources(
+                driver, config, p, targets);
+            if (!replace) {
+                bake_filelist_free(targets);
+                targets = NULL;
+                goto error;
+            }
+            targets = replace;
         }
 
     } else if (((bake_pattern*)n)->pattern) {
@@ -201,6 +268,129 @@ error:
     return NULL;
 }
 
+typedef struct bake_node_deps_ctx {
+    bake_build_state *state;
+    bake_file *dst;
+    bool changed;
+} bake_node_deps_ctx;
+
+static
+bool bake_node_dep_changed(
+    const char *dep,
+    void *ctx)
+{
+    bake_node_deps_ctx *data = ctx;
+    bake_file *dst = data->dst;
+
+    if (ut_file_test(dep) != 1) {
+        ut_trace("#[grey]%s no longer exists for %s, rebuilding",
+            dep, dst->name);
+        data->changed = true;
+    } else if (ut_lastmodified(dep) > (time_t)dst->timestamp) {
+        if (!data->state ||
+            bake_build_state_changed(data->state, dst->file_path, dep))
+        {
+            ut_trace("#[grey]%s is newer than %s, rebuilding",
+                dep, dst->name);
+            data->changed = true;
+        }
+    }
+
+    return !data->changed;
+}
+
+/* Test if a target is out of date with respect to its source, or any of the
+ * dependencies in the dependency file generated by the compiler (such as
+ * headers). A file with a newer timestamp only invalidates the target if its
+ * content changed since the target was built, according to the build state. */
+static
+bool bake_node_target_changed(
+    bake_build_state *state,
+    bake_file *src,
+    bake_file *dst)
+{
+    if (!dst->timestamp) {
+        return true;
+    }
+
+    if (src->timestamp > dst->timestamp) {
+        if (!state || bake_build_state_changed(state, dst->file_path, src->file_path)) {
+            return true;
+        }
+    }
+
+    bake_node_deps_ctx ctx = {.state = state, .dst = dst};
+    bake_depfile_walk(dst->file_path, bake_node_dep_changed, &ctx);
+
+    return ctx.changed;
+}
+
+/* Test if a path in a command can start at ptr. Paths start a word, follow a
+ * quote or '=', or follow a short option like -I. */
+static
+bool bake_node_path_start(
+    const char *word,
+    const char *ptr)
+{
+    if (ptr == word || strchr("=\"'", ptr[-1])) {
+        return true;
+    }
+
+    if (word[0] == '-') {
+        const char *ch;
+        for (ch = word + 1; ch < ptr && isalpha(*ch); ch ++) { }
+        return ch == ptr;
+    }
+
+    return false;
+}
+
+/* Remove the project path from paths in a command, so that the command does
+ * not depend on the directory from which the project is built */
+static
+char* bake_node_normalize_command(
+    bake_project *p,
+    const char *cmd)
+{
+    ut_strbuf buf = UT_STRBUF_INIT;
+    char *rel = ut_asprintf("%s"UT_OS_PS, p->path);
+    char *abs = ut_asprintf("%s"UT_OS_PS, p->fullpath);
+    size_t rel_len = strlen(rel), abs_len = strlen(abs);
+    const char *ptr = cmd, *word = cmd;
+
+    while (*ptr) {
+        if (isspace(*ptr)) {
+            ut_strbuf_appendstrn(&buf, ptr, 1);
+            word = ++ ptr;
+            continue;
+        }
+
+        if (bake_node_path_start(word, ptr)) {
+            if (!strncmp(ptr, abs, abs_len)) {
+                ptr += abs_len;
+                continue;
+            }
+            if (!strncmp(ptr, rel, rel_len)) {
+                ptr += rel_len;
+                continue;
+            }
+        }
+
+        ut_strbuf_appendstrn(&buf, ptr, 1);
+        ptr ++;
+    }
+
+    free(rel);
+    free(abs);
+
+    char *result = ut_strbuf_get(&buf);
+    if (!result) {
+        result = ut_strdup("");
+    }
+
+    return result;
+}
+
 static
 int16_t bake_node_run_rule_map(
     bake_driver *driver,
@@ -210,6 +400,8 @@ int16_t bake_node_run_rule_map(
     bake_filelist *inputs,
     bake_filelist *targets)
 {
+    bake_job_pool *pool = NULL;
+    bool built = false;
     ut_iter it = bake_filelist_iter(inputs);
     int count = 0;
     while (ut_iter_hasNext(&it)) {
@@ -225,20 +417,75 @@ int16_t bake_node_run_rule_map(
             goto error;
         }
 
+        char *srcPath = src->name;
+        if (src->path) {
+            srcPath = ut_asprintf("%s"UT_OS_PS"%s", src->path, src->name);
+        }
+
+        /* If the rule can tell which command it will run, rebuild the target
+         * when the command differs from the one that built it, for example
+         * because compiler flags or defines changed */
+        uint64_t command = 0;
+        bool command_changed = false;
+        if (r->command) {
+            char *cmd = r->command(
+                &bake_driver_api_impl, c, p, srcPath, dst->file_path);
+            if (cmd) {
+                char *normalized = bake_node_normalize_command(p, cmd);
+                command = ut_hash_str(normalized, UT_HASH_INIT);
+                free(normalized);
+                free(cmd);
+            }
+
+            if (command && dst->timestamp && p->build_state &&
+                bake_build_state_command_changed(
+                    p->build_state, dst->file_path, command))
+            {
+                ut_trace("#[grey]command for %s changed, rebuilding",
+                    dst->name);
+                command_changed = true;
+            }
+        }
+
         count ++;
-        if (src->timestamp > dst->timestamp) {
+        if (command_changed ||
+            bake_node_target_changed(p->build_state, src, dst))
+        {
             char counter[16];
             sprintf(counter, "%d%%", 100 * count / bake_filelist_count(inputs));
-            bake_message(UT_LOG, counter, src->name);
 
             /* Make sure target directory exists */
-            ut_try (bake_assertPathForFile(dst->path), NULL);
+            if (bake_assertPathForFile(dst->path)) {
+                if (srcPath != src->name) {
+                    free(srcPath);
+                }
+                goto error;
+            }
 
-            /* Invoke action */
-            char *srcPath = src->name;
-            if (src->path) {
-                srcPath = ut_asprintf("%s"UT_OS_PS"%s", src->path, src->name);
+            /* Start worker threads when the first file needs to be built */
+            if (!built) {
+                pool = bake_job_pool_new(driver, p, c);
+            }
+
+            built = true;
+
+            if (pool) {
+                /* Invoke action in worker thread */
+                int16_t ret = bake_job_pool_submit(
+                    pool, r->action, srcPath, dst, command, src->name, counter);
+                if (srcPath != src->name) {
+                    free(srcPath);
+                }
+                if (ret) {
+                    /* A job failed, error is reported when pool is done */
+                    break;
+                }
+                continue;
             }
+
+            bake_message(UT_LOG, counter, src->name);
+
+            /* Invoke action */
             r->action(&bake_driver_api_impl, c, p, srcPath, dst->file_path);
             if (srcPath != src->name) {
                 free(srcPath);
@@ -253,7 +500,13 @@ int16_t bake_node_run_rule_map(
                 p->changed = true;
             }
 
+            if (p->build_state) {
+                bake_build_state_record(
+                    p->build_state, dst->file_path, src->file_path, command);
+            }
+
             /* Update target with latest timestamp */
+            ut_stat_invalidate(dst->name);
             if (ut_file_test(dst->name) == 1) {
                 dst->timestamp = ut_lastmodified(dst->name);
             } else {
@@ -263,11 +516,29 @@ int16_t bake_node_run_rule_map(
             ut_trace("#[grey][%3lld%%] %s",
                 100 * count / bake_filelist_count(inputs),
                 src->name);
+            if (srcPath != src->name) {
+                free(srcPath);
+            }
+        }
+    }
+
+    if (pool) {
+        int16_t ret = bake_job_pool_wait(pool);
+        pool = NULL;
+        ut_try (ret, NULL);
+        if (p->error) {
+            ut_throw("command for rule '%s' failed", ((bake_node*)r)->name);
+            goto error;
         }
+        p->freshly_baked = true;
+        p->changed = true;
     }
 
     return 0;
 error:
+    if (pool) {
+        bake_job_pool_wait(pool);
+    }
     return -1;
 }
 
@@ -281,32 +552,69 @@ int16_t bake_node_run_rule_pattern(
     bake_filelist *targets,
     bool shouldBuild)
 {
-    /* Do n-to-n comparison between sources and targets. If the
-     * target list is empty, it is possible that files still have to
-     * be generated, in which case the rule must be executed. */
+    /* Compare the newest input with the oldest target. If the target list is
+     * empty, it is possible that files still have to be generated, in which
+     * case the rule must be executed. */
     if (!shouldBuild) {
         if (!targets || !bake_filelist_count(targets)) {
             shouldBuild = true;
             ut_trace("no targets found for rule '%s', rebuilding",
                 ((bake_node*)r)->name);
-        } else if (r->action) {
-            ut_iter src_iter = bake_filelist_iter(inputs);
-            while (!shouldBuild && ut_iter_hasNext(&src_iter)) {
-                bake_file *src = ut_iter_next(&src_iter);
+        } else if (r->action && bake_filelist_count(inputs)) {
+            bake_file *newest = NULL, *oldest = NULL, *missing = NULL;
+            int32_t i;
+
+            for (i = 0; i < inputs->count; i ++) {
+                bake_file *src = inputs->files[i];
+                if (!src->timestamp) {
+                    missing = src;
+                    break;
+                }
+                if (!newest || src->timestamp > newest->timestamp) {
+                    newest = src;
+                }
+            }
+
+            for (i = 0; i < targets->count; i ++) {
+                bake_file *dst = targets->files[i];
+                if (!oldest || dst->timestamp < oldest->timestamp) {
+                    oldest = dst;
+                }
+            }
 
-                ut_iter dst_iter = bake_filelist_iter(targets);
-                while (!shouldBuild && ut_iter_hasNext(&dst_iter)) {
-                    bake_file *dst = ut_iter_next(&dst_iter);
-                    if (!src->timestamp) {
-                        shouldBuild = true;
-                        ut_trace("#[grey]%s does not exist for %s, rebuilding",
-                            dst->name,
-                            ((bake_node*)r)->name);
-                    } else if (src->timestamp > dst->timestamp) {
-                        shouldBuild = true;
-                        ut_trace("#[grey]%s is newer than %s, rebuilding",
-                            src->name,
-                            dst->name);
+            if (missing) {
+                shouldBuild = true;
+                ut_trace("#[grey]%s does not exist for %s, rebuilding",
+                    missing->name,
+                    ((bake_node*)r)->name);
+            } else if (newest->timestamp > oldest->timestamp) {
+                if (!oldest->timestamp || !p->build_state) {
+                    shouldBuild = true;
+                    ut_trace("#[grey]%s is newer than %s, rebuilding",
+                        newest->name,
+                        oldest->name);
+                } else {
+                    /* Only rebuild if the content of a newer input changed
+                     * since the target was built */
+                    int32_t j;
+                    for (i = 0; !shouldBuild && i < inputs->count; i ++) {
+                        bake_file *src = inputs->files[i];
+                        if (src->timestamp <= oldest->timestamp) {
+                            continue;
+                        }
+
+                        for (j = 0; !shouldBuild && j < targets->count; j ++) {
+                            bake_file *dst = targets->files[j];
+                            if (src->timestamp > dst->timestamp &&
+                                bake_build_state_changed(p->build_state,
+                                    dst->file_path, src->file_path))
+                            {
+                                shouldBuild = true;
+                                ut_trace("#[grey]%s is newer than %s, rebuilding",
+                                    src->name,
+                                    dst->name);
+                            }
+                        }
                     }
                 }
             }
@@ -315,7 +623,7 @@ int16_t bake_node_run_rule_pattern(
 
     char *dst = NULL;
     if (bake_filelist_count(targets) == 1) {
-        bake_file *f = ut_ll_get(targets->files, 0);
+        bake_file *f = targets->files[0];
         bake_assertPathForFile(f->path);
         dst = f->file_path;
     }
@@ -359,6 +667,23 @@ int16_t bake_node_run_rule_pattern(
             p->changed = true;
         }
 
+        if (dst) {
+            ut_stat_invalidate(dst);
+        }
+
+        /* Record inputs that were used to build the target */
+        if (dst && p->build_state && r->action && ut_file_test(dst) == 1) {
+            src_iter = bake_filelist_iter(inputs);
+            while (ut_iter_hasNext(&src_iter)) {
+                bake_file *src = ut_iter_next(&src_iter);
+                if (bake_build_state_add(p->build_state, dst, src->file_path)) {
+                    ut_catch();
+                    bake_build_state_reset(p->build_state, dst);
+                    break;
+                }
+            }
+        }
+
         free(source_list_str);
     } else if (dst) {
         ut_trace("#[grey]%s", dst);
@@ -390,7 +715,7 @@ int16_t bake_node_eval(
     ut_log_push((char*)n->name);
 
     if (n->kind == BAKE_RULE_PATTERN || n->kind == BAKE_RULE_FILE) {
-        targets = bake_node_eval_pattern(c, n, p);
+        targets = bake_node_eval_pattern(driver, c, n, p);
         if (!targets) {
             targets = inherits;
         }
@@ -448,8 +773,14 @@ int16_t bake_node_eval(
 
                     ut_log_push("out");
 
-                    char *tok = strtok(pattern, ",");
+                    /* Don't use strtok, projects may be built in parallel */
+                    char *tok = pattern, *next;
                     while (tok) {
+                        if ((next = strchr(tok, ','))) {
+                            *next = '\0';
+                            next ++;
+                        }
+
                         bake_node *targetNode = bake_node_find(driver, &tok[1]);
                         if (!targetNode->cond || targetNode->cond(&bake_driver_api_impl, c, p)) {
                             bake_filelist *list = bake_filelist_new(
@@ -467,7 +798,7 @@ int16_t bake_node_eval(
                                 bake_filelist_free(list);
                             }
                         }
-                        tok = strtok(NULL, ",");
+                        tok = next;
                     }
                     free(pattern);
 
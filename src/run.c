@@ -21,242 +21,65 @@
  */
 
 #include "bake.h"
-#include <sys/stat.h>
-#include <errno.h>
 
 static int retcode;
 
-typedef struct ut_fileMonitor {
-    char *file;
-    char *lib;
-    time_t mtime;
-} ut_fileMonitor;
-
+/* Only watch source files, ignore build output and hidden files */
 static
-ut_fileMonitor* monitor_new(
+bool watch_filter(
     const char *file,
-    const char *lib)
-{
-    ut_fileMonitor *mon = malloc(sizeof(ut_fileMonitor));
-    mon->file = ut_strdup(file);
-    mon->lib = lib ? ut_strdup(lib) : NULL;
-    mon->mtime = 0;
-
-    return mon;
-}
-
-static
-void monitor_free(
-    ut_fileMonitor *mon)
-{
-    free(mon->file);
-    free(mon->lib);
-    free(mon);
-}
-
-static
-void add_changed(
-    ut_ll *libs,
-    char *lib)
-{
-    if (*libs && lib) {
-        ut_iter iter = ut_ll_iter(*libs);
-        while (ut_iter_hasNext(&iter)) {
-            char *l = ut_iter_next(&iter);
-            if (!strcmp(l, lib)) {
-                return;
-            }
-        }
-    }
-
-    if (!*libs) {
-        *libs = ut_ll_new();
-    }
-    ut_ll_append(*libs, lib);
-}
-
-static
-ut_ll get_modified(
-    ut_ll files,
-    ut_ll changed)
+    bool is_dir,
+    void *ctx)
 {
-    int32_t i = 0;
-    ut_ll libs = NULL;
-
-    if (changed) {
-        ut_ll_free(changed);
-        changed = NULL;
-    }
-
-    if (files) {
-        ut_iter iter = ut_ll_iter(files);
-        while (ut_iter_hasNext(&iter)) {
-            struct stat attr;
-            ut_fileMonitor *mon = ut_iter_next(&iter);
+    const char *name = strrchr(file, UT_OS_PS[0]);
+    name = name ? name + 1 : file;
 
-            if (stat(mon->file, &attr) < 0) {
-                ut_error("failed to stat '%s' (%s)\n",
-                mon->file, strerror(errno));
-            }
-
-            if (mon->mtime) {
-                if (mon->mtime != attr.st_mtime) {
-                    ut_log("#[grey]detected change in file '%s'\n", mon->file);
-                    add_changed(&libs, mon->lib);
-                } else {
-                    ut_debug("#[grey] no change in file '%s'",
-                        mon->file);
-                }
-            } else {
-                ut_debug("#[grey] ignoring file '%s'", mon->file);
-            }
-            mon->mtime = attr.st_mtime;
-
-            i++;
-        }
-    }
-
-    return libs;
-}
-
-static
-int compare_monitor(
-    void *o1,
-    void *o2)
-{
-    ut_fileMonitor
-        *m1 = o1,
-        *m2 = o2;
-
-    if (!strcmp(m1->file, m2->file)) {
-        return 0;
-    }
-    return 1;
-}
-
-static
-bool filter_file(
-    const char *file)
-{
-    char *ext = strrchr(file, '.');
-
-    if (!ut_isdir(file) &&
-        strncmp(file, "test", 4) &&
-        strncmp(file, "bin", 3) &&
-        strcmp(file, "include/bake_config.h") &&
-        !(file[0] == '.') &&
-        ext &&
-        strcmp(ext, ".so"))
+    if (name[0] == '.' ||
+        !strncmp(file, "test", 4) ||
+        !strncmp(file, "bin", 3))
     {
-        return true;
-    }
-
-    return false;
-}
-
-static
-ut_ll gather_files(
-    const char *project_dir,
-    const char *app_bin,
-    ut_ll old_files,
-    bool *files_removed)
-{
-    ut_ll result = ut_ll_new();
-    ut_iter it;
-
-    if (ut_dir_iter(project_dir, "//", &it))  {
-        goto error;
+        return false;
     }
 
-    /* Find files that are not binaries, directories or build artefacts */
-    while (ut_iter_hasNext(&it)) {
-        char *file = ut_iter_next(&it);
-        if (filter_file(file)) {
-            ut_fileMonitor *m = monitor_new(
-                strarg("%s"UT_OS_PS"%s", project_dir, file), app_bin);
-            ut_ll_append(result, m);
-        }
+    if (is_dir) {
+        return true;
     }
 
-    /* Update new filelist with timestamps from old list */
-    if (old_files) {
-        ut_fileMonitor *m;
-        while ((m = ut_ll_takeFirst(old_files))) {
-            ut_fileMonitor *m_new = ut_ll_find(
-                result, compare_monitor, m);
-            if (m_new) {
-                m_new->mtime = m->mtime;
-            } else {
-                if (files_removed) {
-                    *files_removed = true;
-                }
-            }
-            monitor_free(m);
-        }
-
-        ut_ll_free(old_files);
+    char *ext = strrchr(name, '.');
+    if (!ext ||
+        !strcmp(ext, ".so") ||
+        !strcmp(file, "include"UT_OS_PS"bake_config.h"))
+    {
+        return false;
     }
 
-    return result;
-error:
-    ut_ll_free(result);
-    return NULL;
+    return true;
 }
 
 static
-ut_ll wait_for_changes(
+bool wait_for_changes(
     ut_proc pid,
-    const char *project_dir,
-    const char *app_bin,
-    ut_ll changed)
+    ut_watch watch)
 {
-    int32_t i = 0;
-
-    /* Collect initial set of files in project directory */
-    ut_ll files = gather_files(project_dir, app_bin, NULL, NULL);
-
-    /* Get initial timestamps for all files */
-    get_modified(files, NULL);
-
-    if (changed) {
-        ut_ll_free(changed);
-        changed = NULL;
-    }
+    int32_t changes;
 
     do {
-        ut_sleep(0, 50000000);
+        /* If a process is running, check every 50ms if it is still alive */
+        changes = ut_watch_wait(watch, pid ? 50 : -1);
+        if (changes < 0) {
+            ut_raise();
+            ut_sleep(1, 0);
+            changes = 0;
+        }
 
-        /* Check if process is still running every 50ms */
         if (pid) {
             if ((retcode = ut_proc_check(pid, NULL))) {
                 break;
             }
         }
+    } while (!changes);
 
-        i++;
-
-        /* Check files every second */
-        if (!(i % 20)) {
-            bool files_removed = false;
-
-            /* Refresh files, new files will show up with timestamp 0 */
-            files = gather_files(
-                project_dir, app_bin, files, &files_removed);
-
-            /* Check for changes, new files will show up as changed */
-            changed = get_modified(files, changed);
-
-            /* If files have been removed but no files have changed, create an
-             * empty list, so it will still trigger a rebuild */
-            if (!changed && files_removed) {
-                changed = ut_ll_new();
-            }
-        } else {
-            continue;
-        }
-    }while (!changed || (pid && retcode));
-
-    return changed;
+    return changes != 0;
 }
 
 static
@@ -336,10 +159,16 @@ int16_t run_interactive(
     const char *argv[])
 {
     ut_proc pid = 0, last_pid = 0;
-    ut_ll changed = NULL;
+    bool changed = false;
     uint32_t retries = 0;
     int32_t rebuild = 0;
 
+    /* Watch source files of project, so it can be rebuilt when they change */
+    ut_watch watch = ut_watch_new(project_dir, watch_filter, NULL);
+    if (!watch) {
+        goto error;
+    }
+
     while (true) {
         if (!retries || changed) {
             if (changed) {
@@ -349,6 +178,9 @@ int16_t run_interactive(
             /* Build the project */
             build_project(project_dir);
             rebuild++;
+
+            /* Ignore files that were changed by the build */
+            ut_watch_reset(watch);
         }
 
         if (pid && rebuild) {
@@ -376,8 +208,7 @@ int16_t run_interactive(
             }
 
             /* Wait until either source changes, or executable finishes */
-            changed = wait_for_changes(
-                pid, project_dir, app_bin, changed);
+            changed = wait_for_changes(pid, watch);
 
             /* Set pid to 0 if process has exited */
             if (retcode) {
@@ -389,8 +220,7 @@ int16_t run_interactive(
                 " or change files to rebuild)\n");
 
             /* Wait for changed before trying again */
-            changed = wait_for_changes(
-                0, project_dir, app_bin, changed);
+            changed = wait_for_changes(0, watch);
         }
 
         /* If the process segfaults, wait for changes and rebuild */
@@ -402,8 +232,7 @@ int16_t run_interactive(
                 bake_message(UT_LOG, "", "press Ctrl-C to exit or change files to restart", app_id, last_pid, app_bin);
             }
 
-            changed = wait_for_changes(
-                0, project_dir, app_bin, changed);
+            changed = wait_for_changes(0, watch);
             retcode = 0;
             pid = 0;
         }
@@ -415,7 +244,11 @@ int16_t run_interactive(
         ut_error("process stopped with error (%d)", retcode);
     }
 
+    ut_watch_free(watch);
+
     return 0;
+error:
+    return -1;
 }
 
 static
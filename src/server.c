@@ -0,0 +1,682 @@
+/* Copyright (c) 2010-2019 Sander Mertens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "bake.h"
+
+/* The bake server builds the projects in a path on request of bake processes
+ * that are started from the command line. The server stays loaded, so drivers
+ * and the configuration don't have to be loaded for every build. When the
+ * server can watch the filesystem (on Linux), it also knows whether anything
+ * changed since the last build, in which case a build returns immediately.
+ *
+ * Clients connect to a Unix socket in the .bake_cache directory of the path,
+ * send the action and pass their stdout and stderr file descriptors, so that
+ * the output of the build appears in the terminal of the client. The server
+ * replies with the exit code of the build.
+ *
+ * The server only builds for clients with the same environment, and only while
+ * the bake configuration is the same as when it started. Otherwise it refuses
+ * the request, and the client builds the projects itself. */
+
+#ifndef UT_OS_WINDOWS
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
+#include <fcntl.h>
+
+#define BAKE_SERVER_SOCKET ".bake_cache"UT_OS_PS"server.sock"
+#define BAKE_SERVER_ACTION_MAX (32)
+#define BAKE_SERVER_REFUSED (-1)
+
+/* Environment variables that change how projects are built */
+static const char *bake_server_env_vars[] = {
+    "BAKE_HOME",
+    "BAKE_TARGET",
+    "BAKE_CONFIG",
+    "BAKE_OS",
+    "BAKE_ARCHITECTURE",
+    "BAKE_ENVIRONMENT",
+    "BAKE_JOBS",
+    "BAKE_CACHE",
+    "BAKE_CACHE_SIZE",
+    "CC",
+    "CXX",
+    "PATH",
+    "LD_LIBRARY_PATH",
+    "DYLD_LIBRARY_PATH",
+    "CLASSPATH"
+};
+
+#define BAKE_SERVER_ENV_COUNT \
+    (sizeof(bake_server_env_vars) / sizeof(bake_server_env_vars[0]))
+
+/* Request sent by client */
+typedef struct bake_server_msg {
+    char action[BAKE_SERVER_ACTION_MAX + 1];
+    uint64_t env[BAKE_SERVER_ENV_COUNT];
+} bake_server_msg;
+
+/* Hashes of environment variables before configuration was loaded */
+static uint64_t bake_server_env[BAKE_SERVER_ENV_COUNT];
+
+/* File that must not change for projects to be up to date */
+typedef struct bake_server_file {
+    char *path;
+    bool exists;
+    time_t modified;
+    off_t size;
+} bake_server_file;
+
+typedef struct bake_server_t {
+    bake_config *config;
+    const char *path;
+    bake_server_build_cb build;
+    int sock;               /* Socket on which server accepts clients */
+    ut_watch watch;         /* Notifies server of changed files */
+    bool changed;           /* Files changed since last successful build */
+    ut_ll config_files;     /* Configuration loaded when server started */
+    ut_ll outputs;          /* Files not watched used by last build */
+} bake_server_t;
+
+static volatile sig_atomic_t bake_server_quit = 0;
+
+static
+void bake_server_signal(
+    int sig)
+{
+    bake_server_quit = 1;
+}
+
+static
+void bake_server_nopipe(
+    int sig)
+{
+    /* Don't exit when client went away, error is reported by write */
+}
+
+static
+int16_t bake_server_address(
+    const char *path,
+    struct sockaddr_un *addr)
+{
+    char *file = ut_asprintf("%s"UT_OS_PS BAKE_SERVER_SOCKET, path);
+
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+
+    if (strlen(file) >= sizeof(addr->sun_path)) {
+        ut_throw("path of server socket '%s' is too long", file);
+        free(file);
+        return -1;
+    }
+
+    strcpy(addr->sun_path, file);
+    free(file);
+
+    return 0;
+}
+
+static
+int bake_server_connect(
+    struct sockaddr_un *addr)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr*)addr, sizeof(struct sockaddr_un))) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static
+void bake_server_cloexec(
+    int fd)
+{
+    fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+}
+
+/* -- Watching files -- */
+
+static
+void bake_server_file_stat(
+    bake_server_file *file)
+{
+    struct stat attr;
+    file->exists = !ut_stat(file->path, &attr);
+    file->modified = file->exists ? attr.st_mtime : 0;
+    file->size = file->exists ? attr.st_size : 0;
+}
+
+/* Record current state of files, takes ownership of paths */
+static
+ut_ll bake_server_files_new(
+    ut_ll paths)
+{
+    ut_ll result = ut_ll_new();
+    if (paths) {
+        char *path;
+        while ((path = ut_ll_takeFirst(paths))) {
+            bake_server_file *file = ut_calloc(sizeof(bake_server_file));
+            file->path = path;
+            bake_server_file_stat(file);
+            ut_ll_append(result, file);
+        }
+    }
+    return result;
+}
+
+static
+void bake_server_files_free(
+    ut_ll files)
+{
+    if (files) {
+        bake_server_file *file;
+        while ((file = ut_ll_takeFirst(files))) {
+            free(file->path);
+            free(file);
+        }
+        ut_ll_free(files);
+    }
+}
+
+/* Returns first file that was created, removed or modified since recorded */
+static
+const char* bake_server_files_changed(
+    ut_ll files)
+{
+    if (files) {
+        ut_iter it = ut_ll_iter(files);
+        while (ut_iter_hasNext(&it)) {
+            bake_server_file *file = ut_iter_next(&it);
+            bake_server_file cur = {.path = file->path};
+            bake_server_file_stat(&cur);
+            if (cur.exists != file->exists ||
+                cur.modified != file->modified ||
+                cur.size != file->size)
+            {
+                return file->path;
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Build output and version control data doesn't change the build result */
+static
+bool bake_server_watch_filter(
+    const char *file,
+    bool is_dir,
+    void *ctx)
+{
+    const char *name = strrchr(file, UT_OS_PS[0]);
+    name = name ? name + 1 : file;
+    return name[0] != '.' && (!is_dir || strcmp(name, "bin"));
+}
+
+/* Only when the server is notified of changes it can skip builds */
+static
+bool bake_server_watching(
+    bake_server_t *server)
+{
+    return server->watch && ut_watch_fd(server->watch) != -1;
+}
+
+/* Read pending notifications */
+static
+void bake_server_watch_read(
+    bake_server_t *server)
+{
+    if (bake_server_watching(server)) {
+        if (ut_watch_wait(server->watch, 0)) {
+            server->changed = true;
+        }
+    }
+}
+
+/* -- Handling requests -- */
+
+static
+int8_t bake_server_build(
+    bake_server_t *server,
+    const char *action)
+{
+    /* Without notifications the server can't tell whether files changed. The
+     * watcher ignores build output and dependencies outside of the path, so
+     * also check whether files used by the last build changed. */
+    if (!strcmp(action, "build") && !server->changed &&
+        bake_server_watching(server))
+    {
+        ut_stat_invalidate(NULL);
+        const char *changed = bake_server_files_changed(server->outputs);
+        if (!changed) {
+            bake_message(UT_OK, "done", "projects in '%s' are up to date",
+                server->path);
+            return 0;
+        }
+        ut_trace("'%s' changed since last build", changed);
+    }
+
+    /* Changes made after this point are picked up by the next build */
+    server->changed = false;
+    bake_server_files_free(server->outputs);
+    server->outputs = NULL;
+
+    ut_ll outputs = ut_ll_new();
+    if (server->build(server->config, action, outputs)) {
+        ut_raise();
+        server->changed = true;
+        bake_server_files_free(outputs);
+        return 1;
+    }
+
+    if (!strcmp(action, "clean")) {
+        server->changed = true;
+        bake_server_files_free(outputs);
+    } else {
+        ut_stat_invalidate(NULL);
+        server->outputs = bake_server_files_new(outputs);
+        ut_ll_free(outputs);
+    }
+
+    return 0;
+}
+
+/* Returns whether server can build for a client, or why it can't */
+static
+const char* bake_server_refuse(
+    bake_server_t *server,
+    bake_server_msg *msg)
+{
+    uint32_t i;
+    for (i = 0; i < BAKE_SERVER_ENV_COUNT; i ++) {
+        if (msg->env[i] != bake_server_env[i]) {
+            return strarg("%s is not the same as for the bake server",
+                bake_server_env_vars[i]);
+        }
+    }
+
+    ut_stat_invalidate(NULL);
+    const char *changed = bake_server_files_changed(server->config_files);
+    if (changed) {
+        return strarg("configuration '%s' changed after bake server started",
+            changed);
+    }
+
+    return NULL;
+}
+
+static
+void bake_server_handle(
+    bake_server_t *server,
+    int conn)
+{
+    bake_server_msg request = {{0}};
+    char *action = request.action;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+    int fds[2] = {-1, -1};
+    int8_t rc = 1;
+
+    struct iovec iov = {
+        .iov_base = &request,
+        .iov_len = sizeof(request)
+    };
+
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf)
+    };
+
+    if (recvmsg(conn, &msg, MSG_WAITALL) != sizeof(request)) {
+        ut_trace("failed to receive request (%s)", strerror(errno));
+        return;
+    }
+
+    action[BAKE_SERVER_ACTION_MAX] = '\0';
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int)))
+    {
+        ut_trace("request without output descriptors");
+        return;
+    }
+
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    /* Write output of build to the terminal of the client */
+    fflush(stdout);
+    fflush(stderr);
+    int old_stdout = dup(STDOUT_FILENO);
+    int old_stderr = dup(STDERR_FILENO);
+    dup2(fds[0], STDOUT_FILENO);
+    dup2(fds[1], STDERR_FILENO);
+
+    const char *refuse = bake_server_refuse(server, &request);
+    if (refuse) {
+        bake_message(UT_WARNING, "server", "%s, building without server",
+            refuse);
+        rc = BAKE_SERVER_REFUSED;
+    } else if (strcmp(action, "build") && strcmp(action, "rebuild") &&
+        strcmp(action, "clean"))
+    {
+        ut_error("server can't run action '%s'", action);
+    } else {
+        /* Pick up changes made right before the request */
+        bake_server_watch_read(server);
+        rc = bake_server_build(server, action);
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(old_stdout, STDOUT_FILENO);
+    dup2(old_stderr, STDERR_FILENO);
+    close(old_stdout);
+    close(old_stderr);
+    close(fds[0]);
+    close(fds[1]);
+
+    if (write(conn, &rc, sizeof(rc)) != sizeof(rc)) {
+        ut_trace("failed to send result to client (%s)", strerror(errno));
+    }
+}
+
+int16_t bake_server_run(
+    bake_config *config,
+    const char *path,
+    bake_server_build_cb build)
+{
+    struct sockaddr_un addr;
+    bake_server_t server = {
+        .config = config,
+        .path = path,
+        .build = build,
+        .sock = -1
+    };
+
+    ut_try (bake_server_address(path, &addr), NULL);
+
+    /* Record configuration files (and whether the one in BAKE_HOME exists), so
+     * that the server stops building when the configuration changes */
+    ut_ll config_files = bake_config_find_config();
+    if (!config_files) {
+        config_files = ut_ll_new();
+    }
+    ut_ll_append(config_files, ut_envparse("$BAKE_HOME"UT_OS_PS"bake.json"));
+    server.config_files = bake_server_files_new(config_files);
+    ut_ll_free(config_files);
+
+    /* Remove socket of a server that didn't exit cleanly. Sockets can't be
+     * opened as files, so use access instead of ut_file_test. */
+    if (!access(addr.sun_path, F_OK)) {
+        int fd = bake_server_connect(&addr);
+        if (fd != -1) {
+            close(fd);
+            ut_throw("a bake server is already running for '%s'", path);
+            goto error;
+        }
+        unlink(addr.sun_path);
+    }
+
+    ut_try (ut_mkdir("%s"UT_OS_PS".bake_cache", path), NULL);
+
+    server.sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server.sock == -1) {
+        ut_throw("failed to create socket: %s", strerror(errno));
+        goto error;
+    }
+
+    /* Processes started by builds should not inherit the socket */
+    bake_server_cloexec(server.sock);
+
+    if (bind(server.sock, (struct sockaddr*)&addr, sizeof(addr))) {
+        ut_throw("failed to bind '%s': %s", addr.sun_path, strerror(errno));
+        goto error;
+    }
+
+    if (listen(server.sock, 16)) {
+        ut_throw("failed to listen on '%s': %s", addr.sun_path, strerror(errno));
+        goto error;
+    }
+
+    /* Bake processes started by builds must not wait for the server */
+    ut_setenv("BAKE_SERVER", "TRUE");
+
+    struct sigaction sa = {.sa_handler = bake_server_signal};
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = bake_server_nopipe;
+    sigaction(SIGPIPE, &sa, NULL);
+
+    server.watch = ut_watch_new(path, bake_server_watch_filter, NULL);
+    if (!server.watch) {
+        ut_catch();
+    }
+    if (!bake_server_watching(&server)) {
+        ut_warning("cannot watch files, every build will check all projects");
+    }
+
+    /* Build projects once, so the first request only needs to check changes */
+    server.changed = true;
+    bake_server_build(&server, "build");
+
+    bake_message(UT_OK, "server", "listening on '%s'", addr.sun_path);
+
+    while (!bake_server_quit) {
+        bool watching = bake_server_watching(&server);
+        struct pollfd pfd[2] = {
+            {.fd = server.sock, .events = POLLIN},
+            {.fd = watching ? ut_watch_fd(server.watch) : -1, .events = POLLIN}
+        };
+
+        int count = poll(pfd, watching ? 2 : 1, -1);
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ut_throw("poll failed: %s", strerror(errno));
+            goto error;
+        }
+
+        if (watching && pfd[1].revents) {
+            bake_server_watch_read(&server);
+        }
+
+        if (pfd[0].revents & POLLIN) {
+            int conn = accept(server.sock, NULL, NULL);
+            if (conn != -1) {
+                bake_server_cloexec(conn);
+                bake_server_handle(&server, conn);
+                close(conn);
+            }
+        }
+    }
+
+    bake_message(UT_OK, "server", "stopped");
+
+    if (server.watch) {
+        ut_watch_free(server.watch);
+    }
+    bake_server_files_free(server.config_files);
+    bake_server_files_free(server.outputs);
+    close(server.sock);
+    unlink(addr.sun_path);
+
+    return 0;
+error:
+    if (server.watch) {
+        ut_watch_free(server.watch);
+    }
+    bake_server_files_free(server.config_files);
+    bake_server_files_free(server.outputs);
+    if (server.sock != -1) {
+        close(server.sock);
+        unlink(addr.sun_path);
+    }
+    return -1;
+}
+
+void bake_server_init(void)
+{
+    const char *exported = ut_getenv("BAKE_SERVER_ENV");
+    char buf[17] = {0};
+    uint32_t i;
+
+    /* The bake child process inherits the environment after the configuration
+     * was loaded, so it uses the hashes exported by its parent */
+    if (exported && strlen(exported) == BAKE_SERVER_ENV_COUNT * 16) {
+        for (i = 0; i < BAKE_SERVER_ENV_COUNT; i ++) {
+            memcpy(buf, &exported[i * 16], 16);
+            bake_server_env[i] = strtoull(buf, NULL, 16);
+        }
+        return;
+    }
+
+    ut_strbuf env = UT_STRBUF_INIT;
+    for (i = 0; i < BAKE_SERVER_ENV_COUNT; i ++) {
+        const char *value = ut_getenv(bake_server_env_vars[i]);
+
+        /* Distinguish between unset and empty variables */
+        bake_server_env[i] = value ? ut_hash_str(value, UT_HASH_INIT) : 0;
+        ut_strbuf_append(&env, "%016llx", (unsigned long long)bake_server_env[i]);
+    }
+
+    char *env_str = ut_strbuf_get(&env);
+    ut_setenv("BAKE_SERVER_ENV", env_str);
+    free(env_str);
+}
+
+int16_t bake_server_request(
+    const char *path,
+    const char *action,
+    int8_t *rc_out)
+{
+    bake_server_msg request = {{0}};
+    struct sockaddr_un addr;
+    int fds[2] = {STDOUT_FILENO, STDERR_FILENO};
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(fds))];
+    } control;
+    int8_t rc = 0;
+
+    if (strlen(action) > BAKE_SERVER_ACTION_MAX) {
+        return -1;
+    }
+
+    if (bake_server_address(path, &addr)) {
+        ut_catch();
+        return -1;
+    }
+
+    if (access(addr.sun_path, F_OK)) {
+        return -1;
+    }
+
+    /* If the server is not running the socket is stale, build locally */
+    int fd = bake_server_connect(&addr);
+    if (fd == -1) {
+        return -1;
+    }
+
+    strcpy(request.action, action);
+    memcpy(request.env, bake_server_env, sizeof(bake_server_env));
+
+    struct iovec iov = {
+        .iov_base = &request,
+        .iov_len = sizeof(request)
+    };
+
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf)
+    };
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    fflush(stdout);
+    fflush(stderr);
+
+    if (sendmsg(fd, &msg, 0) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    /* Wait for the server to finish the build. Once the request is sent, the
+     * project may be partially built, so don't fall back to a local build. */
+    if (read(fd, &rc, sizeof(rc)) != sizeof(rc)) {
+        ut_error("bake server disconnected during build");
+        rc = 1;
+    }
+
+    close(fd);
+
+    /* Server can't build for this client */
+    if (rc == BAKE_SERVER_REFUSED) {
+        return -1;
+    }
+
+    *rc_out = rc;
+
+    return 0;
+}
+
+#else
+
+int16_t bake_server_run(
+    bake_config *config,
+    const char *path,
+    bake_server_build_cb build)
+{
+    ut_throw("bake server is not supported on this platform");
+    return -1;
+}
+
+void bake_server_init(void) { }
+
+int16_t bake_server_request(
+    const char *path,
+    const char *action,
+    int8_t *rc_out)
+{
+    return -1;
+}
+
+#endif
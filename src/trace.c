@@ -0,0 +1,234 @@
+/* Copyright (c) 2010-2019 Sander Mertens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "bake.h"
+
+/* The trace records when log categories, projects and commands begin and end
+ * in the Chrome Trace Event format, which can be loaded in chrome://tracing or
+ * Perfetto. Each thread of bake gets its own track, so that parallel project
+ * builds and jobs show up next to each other. Events are kept in memory and
+ * written to the trace file when bake exits. */
+
+static struct {
+    bool enabled;
+    char *file;
+    struct timespec start;
+    struct ut_mutex_s lock; /* Events are added by multiple threads */
+    ut_strbuf events;
+    bool first;             /* No event has been added yet */
+    int32_t thread_count;
+    ut_tls thread_key;      /* Index of thread in trace (starting from 1) */
+} bake_trace;
+
+static
+void bake_trace_append_escaped(
+    ut_strbuf *buf,
+    const char *str)
+{
+    const char *ptr;
+    char ch;
+
+    ut_strbuf_appendstr(buf, "\"");
+    for (ptr = str; (ch = *ptr); ptr ++) {
+        if (ch == '"' || ch == '\\') {
+            ut_strbuf_append(buf, "\\%c", ch);
+        } else if ((unsigned char)ch < 0x20) {
+            ut_strbuf_append(buf, "\\u%04x", ch);
+        } else {
+            ut_strbuf_appendstrn(buf, ptr, 1);
+        }
+    }
+    ut_strbuf_appendstr(buf, "\"");
+}
+
+/* Must be called while holding the lock */
+static
+void bake_trace_event_begin(
+    const char *ph,
+    const char *cat,
+    const char *name,
+    int32_t tid,
+    uint64_t ts)
+{
+    if (!bake_trace.first) {
+        ut_strbuf_appendstr(&bake_trace.events, ",\n");
+    }
+    bake_trace.first = false;
+
+    ut_strbuf_append(&bake_trace.events,
+        "{\"ph\":\"%s\",\"pid\":%u,\"tid\":%d,\"ts\":%" PRIu64 ",\"cat\":",
+        ph, (unsigned int)ut_proc(), tid, ts);
+    bake_trace_append_escaped(&bake_trace.events, cat);
+    ut_strbuf_appendstr(&bake_trace.events, ",\"name\":");
+    bake_trace_append_escaped(&bake_trace.events, name);
+}
+
+static
+int32_t bake_trace_thread(void)
+{
+    intptr_t tid = (intptr_t)ut_tls_get(bake_trace.thread_key);
+    if (!tid) {
+        ut_mutex_lock(&bake_trace.lock);
+        tid = ++ bake_trace.thread_count;
+
+        /* Name the track of the thread */
+        bake_trace_event_begin("M", "__metadata", "thread_name", tid, 0);
+        ut_strbuf_appendstr(&bake_trace.events, ",\"args\":{\"name\":");
+        if (tid == 1) {
+            bake_trace_append_escaped(&bake_trace.events, "main");
+        } else {
+            char *name = ut_asprintf("thread %d", tid - 1);
+            bake_trace_append_escaped(&bake_trace.events, name);
+            free(name);
+        }
+        ut_strbuf_appendstr(&bake_trace.events, "}}");
+        ut_mutex_unlock(&bake_trace.lock);
+
+        ut_tls_set(bake_trace.thread_key, (void*)tid);
+    }
+
+    return tid;
+}
+
+uint64_t bake_trace_now(void)
+{
+    if (!bake_trace.enabled) {
+        return 0;
+    }
+
+    struct timespec now;
+    timespec_gettime(&now);
+    now = timespec_sub(now, bake_trace.start);
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+}
+
+static
+void bake_trace_scope(
+    const char *ph,
+    const char *cat,
+    const char *name)
+{
+    if (!bake_trace.enabled || !name) {
+        return;
+    }
+
+    int32_t tid = bake_trace_thread();
+    uint64_t ts = bake_trace_now();
+
+    ut_mutex_lock(&bake_trace.lock);
+    bake_trace_event_begin(ph, cat, name, tid, ts);
+    ut_strbuf_appendstr(&bake_trace.events, "}");
+    ut_mutex_unlock(&bake_trace.lock);
+}
+
+void bake_trace_begin(
+    const char *cat,
+    const char *name)
+{
+    bake_trace_scope("B", cat, name);
+}
+
+void bake_trace_end(
+    const char *cat,
+    const char *name)
+{
+    bake_trace_scope("E", cat, name);
+}
+
+void bake_trace_command(
+    const char *name,
+    const char *cmd,
+    uint64_t start,
+    ut_proc pid,
+    int8_t rc,
+    int sig)
+{
+    if (!bake_trace.enabled) {
+        return;
+    }
+
+    int32_t tid = bake_trace_thread();
+    uint64_t stop = bake_trace_now();
+
+    ut_mutex_lock(&bake_trace.lock);
+    bake_trace_event_begin("X", "command", name, tid, start);
+    ut_strbuf_append(&bake_trace.events,
+        ",\"dur\":%" PRIu64 ",\"args\":{\"pid\":%d,\"exit_code\":%d,"
+        "\"signal\":%d,\"cmd\":", stop - start, (int)pid, rc, sig);
+    bake_trace_append_escaped(&bake_trace.events, cmd);
+    ut_strbuf_appendstr(&bake_trace.events, "}}");
+    ut_mutex_unlock(&bake_trace.lock);
+}
+
+static
+void bake_trace_log_scope(
+    const char *category,
+    bool push,
+    void *ctx)
+{
+    bake_trace_scope(push ? "B" : "E", "log", category);
+}
+
+int16_t bake_trace_init(
+    const char *file)
+{
+    ut_try (ut_mutex_new(&bake_trace.lock), NULL);
+    ut_try (ut_tls_new(&bake_trace.thread_key, NULL), NULL);
+
+    bake_trace.file = ut_strdup(file);
+    bake_trace.first = true;
+    timespec_gettime(&bake_trace.start);
+    bake_trace.enabled = true;
+
+    ut_log_scopeHandlerRegister(bake_trace_log_scope, NULL);
+
+    return 0;
+error:
+    return -1;
+}
+
+void bake_trace_deinit(void)
+{
+    if (!bake_trace.enabled) {
+        return;
+    }
+
+    ut_log_scopeHandlerRegister(NULL, NULL);
+    bake_trace.enabled = false;
+
+    char *events = ut_strbuf_get(&bake_trace.events);
+
+    FILE *f = fopen(bake_trace.file, "w");
+    if (f) {
+        fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n%s\n]}\n",
+            events ? events : "");
+        fclose(f);
+        ut_ok("trace written to '%s'", bake_trace.file);
+    } else {
+        ut_error("cannot write trace to '%s': %s",
+            bake_trace.file, strerror(errno));
+    }
+
+    free(events);
+    free(bake_trace.file);
+    bake_trace.file = NULL;
+    ut_mutex_free(&bake_trace.lock);
+}
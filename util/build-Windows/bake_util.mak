@@ -60,6 +60,7 @@ CPP_SOURCE= ..\src\win\dl.c \
 			..\src\expr.c \
 			..\src\file.c \
 			..\src\fs.c \
+			..\src\hash.c \
 			..\src\iter.c \
 			..\src\jsw_rbtree.c \
 			..\src\ll.c \
@@ -71,11 +72,13 @@ CPP_SOURCE= ..\src\win\dl.c \
 			..\src\path.c \
 			..\src\proc_common.c \
 			..\src\rb.c \
+			..\src\stat.c \
 			..\src\strbuf.c \
 			..\src\string.c \
 			..\src\time.c \
 			..\src\util.c \
-			..\src\version.c
+			..\src\version.c \
+			..\src\watch.c
 
 OBJECTS=$(CPP_SOURCE:.c=.obj)
 
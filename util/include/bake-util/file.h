@@ -104,6 +104,31 @@ char* ut_file_readln(
     char* buf,
     unsigned int length);
 
+/** Get next line from a buffer, like one loaded with ut_file_load.
+ * The newline is replaced with a 0 terminator, and the buffer pointer is moved
+ * to the start of the next line.
+ *
+ * @param ptr Pointer to the current position in the buffer.
+ * @return The line, or NULL if there are no more lines.
+ */
+UT_API
+char* ut_file_nextln(
+    char **ptr);
+
+/** Replace contents of a file.
+ * The contents are written to a temporary file, which is then renamed to the
+ * file, so that the file is never partially written. The directory of the file
+ * is created if it does not exist.
+ *
+ * @param file The file to write.
+ * @param content The new contents of the file.
+ * @return 0 if success, non-zero if failed.
+ */
+UT_API
+int16_t ut_file_save(
+    const char *file,
+    const char *content);
+
 /** Get extension from a file.
  *
  * @param file The file to read.
@@ -82,6 +82,56 @@ int16_t ut_dir_iter(
     const char *filter,
     ut_iter *iter_out);
 
+/** Callback for ut_dir_walk, invoked for each file and directory.
+ *
+ * @param dir Directory of the file relative to the walked directory, or an
+ *            empty string for files in the walked directory.
+ * @param name Name of the file.
+ * @param is_dir True if the file is a directory.
+ * @param ctx Context passed to ut_dir_walk.
+ * @return 0 to continue walking, non-zero to stop.
+ */
+typedef int16_t (*ut_dir_walk_cb)(
+    const char *dir,
+    const char *name,
+    bool is_dir,
+    void *ctx);
+
+/** Callback that determines whether ut_dir_walk enters a directory.
+ *
+ * @param dir Directory that contains the directory, relative to the walked
+ *            directory.
+ * @param name Name of the directory.
+ * @param ctx Context passed to ut_dir_walk.
+ * @return true to walk the directory, false to skip it and its contents.
+ */
+typedef bool (*ut_dir_enter_cb)(
+    const char *dir,
+    const char *name,
+    void *ctx);
+
+/** Walk the files in a directory.
+ * Files are reported in the order in which they are read from the directory,
+ * and a directory is reported before its contents. Where the file system
+ * provides the type of a file in the directory entry, files are not stat'ed.
+ * The dir and name arguments passed to the callbacks are only valid for the
+ * duration of the callback.
+ *
+ * @param name The directory to walk.
+ * @param recursive Walk subdirectories.
+ * @param on_file Callback invoked for each file and directory.
+ * @param on_enter Callback to skip subdirectories, or NULL to walk all.
+ * @param ctx Context passed to the callbacks.
+ * @return 0 if success, non-zero if failed or stopped by a callback.
+ */
+UT_API
+int16_t ut_dir_walk(
+    const char *name,
+    bool recursive,
+    ut_dir_walk_cb on_file,
+    ut_dir_enter_cb on_enter,
+    void *ctx);
+
 /** Returns whether directory is empty or not.
  *
  * @param name The name of the directory to check.
@@ -253,6 +303,73 @@ UT_API
 time_t ut_lastmodified(
     const char *name);
 
+/** Set last modified date of file to current time.
+ *
+ * @param name Name of the file.
+ * @return 0 if success, -1 if failed.
+ */
+UT_API
+int16_t ut_setlastmodified(
+    const char *name);
+
+/** Get last modified date and size for file with a single stat call.
+ *
+ * @param name Name of the file.
+ * @param modified_out Output parameter for last modified date (optional).
+ * @param size_out Output parameter for file size (optional).
+ * @return 0 if success, -1 if file could not be accessed.
+ */
+UT_API
+int16_t ut_file_info(
+    const char *name,
+    time_t *modified_out,
+    uint64_t *size_out);
+
+/** Get information of a file.
+ * Same as stat, but when the stat cache is enabled, information is only read
+ * once for each path.
+ *
+ * @param name Name of the file.
+ * @param buf Output parameter for file information.
+ * @return 0 if success, -1 if failed (errno is set).
+ */
+UT_API
+int ut_stat(
+    const char *name,
+    struct stat *buf);
+
+/** Enable or disable the stat cache.
+ * When enabled, ut_stat and the functions that use it (ut_file_test,
+ * ut_isdir, ut_lastmodified, ut_file_info) remember the information of each
+ * path. Paths are invalidated when they are changed by functions in this
+ * library, and all paths are invalidated when a child process exits, as it
+ * may have changed any file. Files that are written in other ways must be
+ * invalidated with ut_stat_invalidate.
+ *
+ * @param enable Whether to enable the cache.
+ */
+UT_API
+void ut_stat_cache_enable(
+    bool enable);
+
+/** Invalidate information of a path in the stat cache.
+ *
+ * @param name Path to invalidate, or NULL to invalidate all paths.
+ */
+UT_API
+void ut_stat_invalidate(
+    const char *name);
+
+/** Get statistics of the stat cache.
+ *
+ * @param hits_out Output parameter for lookups that didn't call stat (optional).
+ * @param misses_out Output parameter for lookups that did call stat (optional).
+ */
+UT_API
+void ut_stat_cache_stats(
+    uint64_t *hits_out,
+    uint64_t *misses_out);
+
 bool ut_dir_hasNext(
     ut_iter *it);
 
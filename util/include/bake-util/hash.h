@@ -0,0 +1,79 @@
+/* Copyright (c) 2010-2019 Sander Mertens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/** @file
+ * @section Hash functions.
+ * @brief Functions for computing hashes over memory and file contents.
+ */
+
+#ifndef UT_HASH_H
+#define UT_HASH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Initial value for a hash. */
+#define UT_HASH_INIT (14695981039346656037ULL)
+
+/** Compute 64 bit hash for buffer.
+ * The hash is not cryptographically secure, and is intended to detect changes
+ * in content. A hash can be computed over multiple buffers by passing the result
+ * of a previous call as seed.
+ *
+ * @param data Data to hash.
+ * @param size Size of data.
+ * @param seed UT_HASH_INIT or result of a previous call.
+ * @return The hash.
+ */
+UT_API
+uint64_t ut_hash(
+    const void *data,
+    size_t size,
+    uint64_t seed);
+
+/** Compute 64 bit hash for string.
+ *
+ * @param str String to hash.
+ * @param seed UT_HASH_INIT or result of a previous call.
+ * @return The hash.
+ */
+UT_API
+uint64_t ut_hash_str(
+    const char *str,
+    uint64_t seed);
+
+/** Compute 64 bit hash for file contents.
+ *
+ * @param file Path to file.
+ * @param hash_out Output parameter for hash.
+ * @return 0 if success, -1 if file could not be read.
+ */
+UT_API
+int16_t ut_file_hash(
+    const char *file,
+    uint64_t *hash_out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
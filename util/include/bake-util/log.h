@@ -224,6 +224,22 @@ void ut_log_handlerRegister(
 UT_API
 bool ut_log_handlerRegistered(void);
 
+typedef void (*ut_log_scope_cb)(
+    const char *category,
+    bool push,
+    void *ctx);
+
+/** Register callback that is invoked when a category is pushed or popped.
+ * The callback is invoked from the thread that pushes or pops the category.
+ *
+ * @param callback Scope handler callback.
+ * @param context Generic value that will be passed to handler.
+ */
+UT_API
+void ut_log_scopeHandlerRegister(
+    ut_log_scope_cb callback,
+    void *context);
+
 
 /* -- Logging messages to console -- */
 
@@ -132,6 +132,64 @@ int ut_proc_cmd_stderr_only(
     char* cmd, 
     int8_t *rc);
 
+/** Run a process with redirected output (blocking).
+ * When out or err is NULL, the corresponding stream is discarded. The same
+ * file may be passed for out and err to capture combined output.
+ *
+ * @param cmd Process to run.
+ * @param rc Value returned by process.
+ * @param out File to which stdout is redirected.
+ * @param err File to which stderr is redirected.
+ * @return 0 if success, -1 if function failed, otherwise the signal raised by the process during exit.
+ */
+UT_API
+int ut_proc_cmd_redirect(
+    char* cmd,
+    int8_t *rc,
+    FILE *out,
+    FILE *err);
+
+/** Run a process (blocking) and return its process id.
+ * Output is only redirected when out or err is not NULL, in which case this
+ * function behaves like ut_proc_cmd_redirect. The process id is returned so
+ * that the command can be correlated with diagnostics of the system.
+ *
+ * @param cmd Process to run.
+ * @param rc Value returned by process.
+ * @param out File to which stdout is redirected.
+ * @param err File to which stderr is redirected.
+ * @param pid_out Process id of the command (0 if it could not be started).
+ * @return 0 if success, -1 if function failed, otherwise the signal raised by the process during exit.
+ */
+UT_API
+int ut_proc_cmd_pid(
+    char* cmd,
+    int8_t *rc,
+    FILE *out,
+    FILE *err,
+    ut_proc *pid_out);
+
+/** Run a process with an argument vector (blocking).
+ * Same as ut_proc_cmd_pid, but the arguments are passed as-is to the process
+ * instead of being parsed from a command string. There is no limit on the
+ * number of arguments other than the one imposed by the OS.
+ *
+ * @param argv NULL-terminated array with arguments, where argv[0] is the
+ *             executable to run.
+ * @param rc Value returned by process.
+ * @param out File to which stdout is redirected.
+ * @param err File to which stderr is redirected.
+ * @param pid_out Process id of the command (0 if it could not be started).
+ * @return 0 if success, -1 if function failed, otherwise the signal raised by the process during exit.
+ */
+UT_API
+int ut_proc_cmd_argv(
+    const char *argv[],
+    int8_t *rc,
+    FILE *out,
+    FILE *err,
+    ut_proc *pid_out);
+
 /** Function that checks if process is being traced (experimental)
  *
  * @return non-zero if being traced, otherwise 0.
@@ -169,6 +169,17 @@ UT_API
 int ut_mutex_new(
     struct ut_mutex_s *mutex);
 
+/** Create new recursive mutex.
+ * A recursive mutex may be locked again by the thread that holds it. The mutex
+ * is released when it is unlocked as many times as it was locked.
+ *
+ * @param mutex Pointer to uninitialized ut_mutex_s structure.
+ * @return 0 if success, non-zero if failed.
+ */
+UT_API
+int ut_mutex_new_recursive(
+    struct ut_mutex_s *mutex);
+
 /** Lock mutex
  *
  * @param mutex Mutex to lock.
@@ -0,0 +1,111 @@
+/* Copyright (c) 2010-2019 Sander Mertens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/** @file
+ * @section Watching files.
+ * @brief Wait for changes to files in a directory tree.
+ *
+ * On Linux the watcher is notified of changes with inotify. On other platforms,
+ * or when inotify is not available (for example because the limit of watches
+ * is reached), the watcher polls the timestamps of files once per second.
+ */
+
+#ifndef UT_WATCH_H
+#define UT_WATCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ut_watch_s* ut_watch;
+
+/** Callback that determines whether a file or directory should be watched.
+ * Files in directories that are not watched are ignored.
+ *
+ * @param file Path of file, relative to the watched directory.
+ * @param is_dir True if the file is a directory.
+ * @param ctx Context passed to ut_watch_new.
+ * @return true if the file should be watched, false if it should be ignored.
+ */
+typedef bool (*ut_watch_filter_cb)(
+    const char *file,
+    bool is_dir,
+    void *ctx);
+
+/** Watch files in a directory and its subdirectories.
+ *
+ * @param path Directory to watch.
+ * @param filter Callback that filters files, or NULL to watch all files.
+ * @param ctx Context passed to the filter callback.
+ * @return Watcher, NULL if failed.
+ */
+UT_API
+ut_watch ut_watch_new(
+    const char *path,
+    ut_watch_filter_cb filter,
+    void *ctx);
+
+/** Stop watching and free resources.
+ *
+ * @param watch The watcher.
+ */
+UT_API
+void ut_watch_free(
+    ut_watch watch);
+
+/** Wait until files changed.
+ * When a change is detected, the function waits until no more changes are
+ * reported for a short time, so that a file that is saved in multiple steps
+ * is reported once.
+ *
+ * @param watch The watcher.
+ * @param timeout Maximum time to wait in milliseconds, -1 to wait forever.
+ * @return Number of changes, 0 if timed out, -1 if failed.
+ */
+UT_API
+int32_t ut_watch_wait(
+    ut_watch watch,
+    int32_t timeout);
+
+/** Discard changes that happened since the last call to ut_watch_wait.
+ *
+ * @param watch The watcher.
+ */
+UT_API
+void ut_watch_reset(
+    ut_watch watch);
+
+/** Get descriptor that becomes readable when files change.
+ * This allows for waiting on changes together with other descriptors. When
+ * the descriptor is readable, call ut_watch_wait with a timeout of 0.
+ *
+ * @param watch The watcher.
+ * @return The descriptor, or -1 if the watcher polls for changes.
+ */
+UT_API
+int ut_watch_fd(
+    ut_watch watch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -128,9 +128,6 @@ extern "C" {
  * length will take advantage of the memory. */
 #define UT_MAX_TLS_STRINGS_MAX (1024)
 
-/* Maximum number of arguments for command */
-#define UT_MAX_CMD_ARGS (256)
-
 /* Maximum number of operations in an id expression */
 #define UT_EXPR_MAX_OP (32)
 
@@ -294,6 +291,8 @@ const char* ut_appname(void);
 #include "bake-util/path.h"
 #include "bake-util/load.h"
 #include "bake-util/version.h"
+#include "bake-util/hash.h"
+#include "bake-util/watch.h"
 
 #ifndef __BAKE_LEGACY__
 #include "bake-util/log.h"
@@ -36,6 +36,10 @@ FILE* ut_file_open(
 {
     FILE *result = fopen(filename, mode);
 
+    if (strchr(mode, 'a') || strchr(mode, 'w') || strchr(mode, '+')) {
+        ut_stat_invalidate(filename);
+    }
+
     if (!result && (strchr(mode, 'a') || strchr(mode, 'w'))) {
         if (errno == ENOENT) {
             char *dir = ut_path_dirname(filename);
@@ -115,11 +119,10 @@ int16_t ut_file_test(
 
     if (file) {
 #ifndef _WIN32
+        struct stat buf;
         errno = 0;
-        FILE *f = fopen(file, "rb");
-        if (f) {
+        if (!ut_stat(file, &buf)) {
             exists = true;
-            fclose(f);
         } else if ((errno != ENOENT) && (errno != ENOTDIR)) {
             ut_throw("%s: %s", file, strerror(errno));
             return -1;
@@ -194,6 +197,73 @@ char* ut_file_readln(
     }
 }
 
+/* Get next line from buffer */
+char* ut_file_nextln(
+    char **ptr)
+{
+    char *line = *ptr, *nl;
+    if (!line || !line[0]) {
+        return NULL;
+    }
+
+    if ((nl = strchr(line, '\n'))) {
+        *nl = '\0';
+        *ptr = nl + 1;
+    } else {
+        *ptr = NULL;
+    }
+
+    return line;
+}
+
+/* Write file by renaming a temporary file, so readers never see a partially
+ * written file. Processes that save the same file at the same time each write
+ * their own temporary file. */
+int16_t ut_file_save(
+    const char *filename,
+    const char *content)
+{
+    FILE *f = NULL;
+    char *tmp_file;
+    size_t size = strlen(content);
+
+#ifndef _WIN32
+    tmp_file = ut_asprintf("%s.%d.tmp", filename, ut_proc());
+#else
+    tmp_file = ut_asprintf("%s.%lu.tmp", filename,
+        (unsigned long)GetCurrentProcessId());
+#endif
+
+    f = ut_file_open(tmp_file, "w");
+    if (!f) {
+        printError(errno, tmp_file);
+        goto error;
+    }
+
+    if (fwrite(content, 1, size, f) != size) {
+        printError(errno, tmp_file);
+        goto error;
+    }
+
+    if (fclose(f)) {
+        f = NULL;
+        printError(errno, tmp_file);
+        goto error;
+    }
+    f = NULL;
+
+    ut_try (ut_rename(tmp_file, filename), NULL);
+
+    free(tmp_file);
+
+    return 0;
+error:
+    if (f) fclose(f);
+    ut_rm(tmp_file);
+    free(tmp_file);
+    return -1;
+}
+
 static
 bool ut_file_hasNext(
     ut_iter *it)
@@ -39,6 +39,7 @@ int ut_touch(const char *file) {
         if (touch) {
             fclose(touch);
         }
+        ut_stat_invalidate(file);
     }
 
     return touch ? 0 : -1;
@@ -122,6 +123,7 @@ int ut_mkdir(const char *fmt, ...) {
         }
     }
 
+    ut_stat_invalidate(name);
     ut_trace("#[cyan]mkdir %s", name);
 
     free(name);
@@ -156,6 +158,8 @@ int ut_cp_file(
         ut_rm(fullDst);
     }
 
+    ut_stat_invalidate(fullDst);
+
     if (!(sourceFile = fopen(src, "rb"))) {
         ut_throw("cannot open '%s': %s", src, strerror(errno));
         goto error;
@@ -347,69 +351,58 @@ void ut_dir_releaseRecursiveFilter(
     ut_ll_iterRelease(it);
 }
 
+typedef struct ut_dir_collector {
+    ut_expr_program filter;
+    const char *offset;
+    ut_ll files;
+} ut_dir_collector;
+
 static
-int16_t ut_dir_collect(
+int16_t ut_dir_collect_file(
+    const char *dir,
     const char *name,
-    ut_dirstack stack,
-    ut_expr_program filter,
-    const char *offset,
-    ut_ll files,
-    bool recursive)
+    bool is_dir,
+    void *ctx)
 {
-    ut_iter it;
-
-    /* Move to current directory */
-    if (name && name[0]) {
-        if (!(stack = ut_dirstack_push(stack, name))) {
-            goto stack_error;
-        }
-    }
+    ut_dir_collector *c = ctx;
 
-    /* Obtain iterator to current directory */
-    if (ut_dir_iter(ut_ll_last(stack), NULL, &it)) {
-        goto error;
+    /* Filter matches on the name of the file, so only allocate a path for
+     * files that are added to the results */
+    if (!ut_expr_run(c->filter, name)) {
+        return 0;
     }
 
-    while (ut_iter_hasNext(&it)) {
-        char *file = ut_iter_next(&it);
-
-        /* Add file to results if it matches filter */
-        char *path;
-        if (offset) {
-            path = ut_asprintf("%s"UT_OS_PS"%s"UT_OS_PS"%s", ut_dirstack_wd(stack), offset, file);
-        } else {
-            path = ut_asprintf("%s"UT_OS_PS"%s", ut_dirstack_wd(stack), file);
-        }
+    char *path;
+    if (c->offset) {
+        path = ut_asprintf("%s"UT_OS_PS"%s"UT_OS_PS"%s",
+            dir[0] ? dir : ".", c->offset, name);
         ut_path_clean(path, path);
-
-        if (ut_expr_run(filter, file)) {
-            ut_ll_append(files, path);
-        }
-
-        if (!recursive) {
-            continue;
-        }
-
-        /* If directory, crawl recursively */
-        char *fullpath = ut_asprintf("%s"UT_OS_PS"%s", ut_ll_last(stack), file);
-        if (ut_isdir(fullpath)) {
-            if (ut_dir_collect(file, stack, filter, offset, files, true)) {
-                free(fullpath);
-                goto error;
-            }
-        }
-        free(fullpath);
+    } else if (dir[0]) {
+        path = ut_asprintf("%s"UT_OS_PS"%s", dir, name);
+    } else {
+        path = ut_strdup(name);
     }
 
-    if (name && name[0]) {
-        ut_dirstack_pop(stack);
-    }
+    ut_ll_append(c->files, path);
 
     return 0;
-error:
-    ut_dirstack_pop(stack);
-stack_error:
-    return -1;
+}
+
+static
+int16_t ut_dir_collect(
+    const char *name,
+    ut_expr_program filter,
+    const char *offset,
+    ut_ll files,
+    bool recursive)
+{
+    ut_dir_collector c = {
+        .filter = filter,
+        .offset = offset,
+        .files = files
+    };
+
+    return ut_dir_walk(name, recursive, ut_dir_collect_file, NULL, &c);
 }
 
 int16_t ut_dir_iter(
@@ -512,12 +505,12 @@ int16_t ut_dir_iter(
         ut_ll files = ut_ll_new();
 
         if (ut_expr_scope(program) == 2) {
-            if (ut_dir_collect(path, NULL, program, offset, files, true)) {
+            if (ut_dir_collect(path, program, offset, files, true)) {
                 ut_throw("recursive dir_iter failed");
                 goto error;
             }
         } else {
-            if (ut_dir_collect(path, NULL, program, offset, files, false)) {
+            if (ut_dir_collect(path, program, offset, files, false)) {
                 ut_throw("dir_iter failed");
                 goto error;
             }
@@ -596,7 +589,7 @@ time_t ut_lastmodified(
 {
     struct stat attr;
 
-    if (stat(name, &attr) < 0) {
+    if (ut_stat(name, &attr) < 0) {
         ut_throw("failed to stat '%s' (%s)", name, strerror(errno));
         goto error;
     }
@@ -605,3 +598,27 @@ time_t ut_lastmodified(
 error:
     return -1;
 }
+
+int16_t ut_file_info(
+    const char *name,
+    time_t *modified_out,
+    uint64_t *size_out)
+{
+    struct stat attr;
+
+    if (ut_stat(name, &attr) < 0) {
+        ut_throw("failed to stat '%s' (%s)", name, strerror(errno));
+        goto error;
+    }
+
+    if (modified_out) {
+        *modified_out = attr.st_mtime;
+    }
+    if (size_out) {
+        *size_out = attr.st_size;
+    }
+
+    return 0;
+error:
+    return -1;
+}
@@ -0,0 +1,80 @@
+/* Copyright (c) 2010-2019 Sander Mertens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <bake_util.h>
+
+/* FNV-1a */
+#define UT_HASH_PRIME (1099511628211ULL)
+
+uint64_t ut_hash(
+    const void *data,
+    size_t size,
+    uint64_t seed)
+{
+    const uint8_t *ptr = data, *end = ptr + size;
+    uint64_t result = seed;
+
+    while (ptr < end) {
+        result ^= *(ptr ++);
+        result *= UT_HASH_PRIME;
+    }
+
+    return result;
+}
+
+uint64_t ut_hash_str(
+    const char *str,
+    uint64_t seed)
+{
+    return ut_hash(str, strlen(str), seed);
+}
+
+int16_t ut_file_hash(
+    const char *file,
+    uint64_t *hash_out)
+{
+    uint8_t buffer[8192];
+    uint64_t result = UT_HASH_INIT;
+    size_t read;
+
+    FILE *f = fopen(file, "rb");
+    if (!f) {
+        ut_throw("%s (%s)", strerror(errno), file);
+        goto error;
+    }
+
+    while ((read = fread(buffer, 1, sizeof(buffer), f))) {
+        result = ut_hash(buffer, read, result);
+    }
+
+    if (ferror(f)) {
+        ut_throw("failed to read '%s'", file);
+        fclose(f);
+        goto error;
+    }
+
+    fclose(f);
+
+    *hash_out = result;
+    return 0;
+error:
+    return -1;
+}
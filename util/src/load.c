@@ -23,6 +23,8 @@
 
 static ut_ll fileHandlers = NULL;
 static ut_ll loadedAdmin = NULL;
+static struct ut_loaded **loadedIndex = NULL; /* Hash index of loadedAdmin */
+static uint32_t loadedIndexSize = 0;
 static ut_ll libraries = NULL;
 
 /* Information about current target */
@@ -56,7 +58,7 @@ char *UT_STATIC_LIB_EXT;
 char *UT_LIB_PREFIX;
 
 /* Lock protecting the package administration */
-extern ut_mutex_s UT_LOAD_LOCK;
+extern ut_rwmutex_s UT_LOAD_LOCK;
 
 struct ut_loaded {
     char* id; /* package id or file */
@@ -81,6 +83,9 @@ struct ut_loaded {
     int16_t loaded; /* -1 error, 0 not loaded, 1 loaded */
 
     ut_dl library; /* pointer to library */
+
+    uint64_t hash; /* Hash of package id */
+    struct ut_loaded *next; /* Next package in same bucket of index */
 };
 
 struct ut_fileHandler {
@@ -96,32 +101,90 @@ int ut_load_fromDl(
     int argc,
     char *argv[]);
 
+/* Package identifiers are compared with idcmp, which ignores case, doesn't
+ * distinguish between '.' and '/' and ignores a leading separator. The hash
+ * normalizes identifiers in the same way. */
+static
+const char* ut_loaded_strip(
+    const char *name)
+{
+    if (name[0] == UT_OS_PS[0]) name ++;
+    if (name[0] == '.') name ++;
+    return name;
+}
+
+static
+uint64_t ut_loaded_hash(
+    const char *name)
+{
+    uint64_t hash = 14695981039346656037ULL; /* FNV-1a */
+    const char *ptr;
+    char ch;
+
+    for (ptr = ut_loaded_strip(name); (ch = *ptr); ptr ++) {
+        if (ch == '.') {
+            ch = '/';
+        } else {
+            ch = tolower(ch);
+        }
+        hash ^= (unsigned char)ch;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
 /* Lookup loaded library by name */
 static
 struct ut_loaded* ut_loaded_find(
     const char* name)
 {
-    if (loadedAdmin) {
-        ut_iter iter = ut_ll_iter(loadedAdmin);
-        struct ut_loaded *lib;
-        const char *nameptr = name;
-        if (nameptr[0] == UT_OS_PS[0]) nameptr ++;
-        if (nameptr[0] == '.') nameptr ++;
+    if (!loadedIndex) {
+        return NULL;
+    }
 
-        while (ut_iter_hasNext(&iter)) {
-            lib = ut_iter_next(&iter);
-            const char *idptr = lib->id;
-            if (idptr[0] == UT_OS_PS[0]) idptr ++;
-            if (idptr[0] == '.') idptr ++;
-            if (!idcmp(nameptr, idptr)) {
-                return lib;
-            }
+    uint64_t hash = ut_loaded_hash(name);
+    const char *nameptr = ut_loaded_strip(name);
+    struct ut_loaded *lib = loadedIndex[hash & (loadedIndexSize - 1)];
+
+    for (; lib; lib = lib->next) {
+        if (lib->hash == hash &&
+            !idcmp(nameptr, ut_loaded_strip(lib->id)))
+        {
+            return lib;
         }
     }
 
     return NULL;
 }
 
+static
+void ut_loaded_index(
+    struct ut_loaded *lib)
+{
+    uint32_t count = ut_ll_count(loadedAdmin);
+
+    /* Keep load factor below 1, grow by rehashing all packages */
+    if (count > loadedIndexSize) {
+        uint32_t size = loadedIndexSize ? loadedIndexSize * 2 : 64;
+        free(loadedIndex);
+        loadedIndex = ut_calloc(size * sizeof(struct ut_loaded*));
+        loadedIndexSize = size;
+
+        ut_iter it = ut_ll_iter(loadedAdmin);
+        while (ut_iter_hasNext(&it)) {
+            struct ut_loaded *el = ut_iter_next(&it);
+            uint32_t bucket = el->hash & (size - 1);
+            el->next = loadedIndex[bucket];
+            loadedIndex[bucket] = el;
+        }
+    } else {
+        uint32_t bucket = lib->hash & (loadedIndexSize - 1);
+        lib->next = loadedIndex[bucket];
+        loadedIndex[bucket] = lib;
+    }
+}
+
 /* Add file */
 static
 struct ut_loaded* ut_loaded_add(
@@ -129,11 +192,13 @@ struct ut_loaded* ut_loaded_add(
 {
     struct ut_loaded *lib = ut_calloc(sizeof(struct ut_loaded));
     lib->id = ut_strdup(library);
+    lib->hash = ut_loaded_hash(library);
     lib->loading = ut_thread_self();
     if (!loadedAdmin) {
         loadedAdmin = ut_ll_new();
     }
     ut_ll_insert(loadedAdmin, lib);
+    ut_loaded_index(lib);
     return lib;
 }
 
@@ -217,7 +282,7 @@ int ut_load_fromDl(
     }
 
     /* Add library to libraries list */
-    if (ut_mutex_lock (&UT_LOAD_LOCK)) {
+    if (ut_rwmutex_write(&UT_LOAD_LOCK)) {
         ut_throw(NULL);
         goto error;
     }
@@ -229,7 +294,7 @@ int ut_load_fromDl(
         ut_ll_insert(libraries, dl);
         ut_debug("loaded '%s'", fileName);
     }
-    if (ut_mutex_unlock (&UT_LOAD_LOCK)) {
+    if (ut_rwmutex_unlock(&UT_LOAD_LOCK)) {
         ut_throw(NULL);
         goto error;
     }
@@ -442,6 +507,77 @@ int16_t ut_locate_src(
     return 0;
 }
 
+/* Get a location that was resolved by an earlier call to ut_locate. Returns
+ * false if the location still has to be resolved, which requires a write lock
+ * as it modifies the package administration. */
+static
+bool ut_locate_cached(
+    struct ut_loaded *loaded,
+    ut_dl *dl_out,
+    ut_locate_kind kind,
+    const char **result_out)
+{
+    if (!loaded->tried_locating) {
+        return false;
+    }
+
+    /* Locating package failed before */
+    if (!loaded->repo) {
+        *result_out = NULL;
+        return true;
+    }
+
+    if (kind != UT_LOCATE_REPO_ID && kind != UT_LOCATE_TEMPLATE) {
+        if (!loaded->meta) {
+            return false;
+        }
+    }
+
+    switch(kind) {
+    case UT_LOCATE_PROJECT:
+        *result_out = loaded->meta;
+        return true;
+    case UT_LOCATE_TEMPLATE:
+        *result_out = loaded->template;
+        return loaded->template != NULL;
+    case UT_LOCATE_ETC:
+        *result_out = loaded->etc;
+        return loaded->etc != NULL;
+    case UT_LOCATE_INCLUDE:
+        *result_out = loaded->include;
+        return loaded->include != NULL;
+    case UT_LOCATE_SOURCE:
+        *result_out = loaded->src;
+        return loaded->tried_src;
+    case UT_LOCATE_DEVSRC:
+        *result_out = loaded->dev;
+        return loaded->tried_src;
+    case UT_LOCATE_REPO_ID:
+        *result_out = loaded->repo;
+        return true;
+    case UT_LOCATE_LIB:
+        if (dl_out && loaded->lib) {
+            if (!loaded->library) {
+                return false;
+            }
+            *dl_out = loaded->library;
+        }
+        *result_out = loaded->lib;
+        return loaded->tried_binary;
+    case UT_LOCATE_STATIC:
+        *result_out = loaded->static_lib;
+        return loaded->tried_binary;
+    case UT_LOCATE_APP:
+        *result_out = loaded->app;
+        return loaded->tried_binary;
+    case UT_LOCATE_BIN:
+        *result_out = loaded->bin;
+        return loaded->tried_binary;
+    }
+
+    return false;
+}
+
 /* Locate various paths for projects in the bake environment */
 const char* ut_locate(
     const char* id,
@@ -457,7 +593,20 @@ const char* ut_locate(
         goto error;
     }
 
-    ut_try ( ut_mutex_lock(&UT_LOAD_LOCK), NULL);
+    /* Most lookups are for packages that have been located before, which only
+     * requires a read lock */
+    ut_try ( ut_rwmutex_read(&UT_LOAD_LOCK), NULL);
+    loaded = ut_loaded_find(id);
+    if (loaded) {
+        const char *cached = NULL;
+        if (ut_locate_cached(loaded, dl_out, kind, &cached)) {
+            ut_try ( ut_rwmutex_unlock(&UT_LOAD_LOCK), NULL);
+            return cached;
+        }
+    }
+    ut_try ( ut_rwmutex_unlock(&UT_LOAD_LOCK), NULL);
+
+    ut_try ( ut_rwmutex_write(&UT_LOAD_LOCK), NULL);
 
     /* If package has been loaded already, don't resolve it again */
     loaded = ut_loaded_find(id);
@@ -585,11 +734,11 @@ const char* ut_locate(
         /* Library was not found */
     }
 
-    ut_try ( ut_mutex_unlock(&UT_LOAD_LOCK), NULL);
+    ut_try ( ut_rwmutex_unlock(&UT_LOAD_LOCK), NULL);
 
     return result;
 error:
-    if (ut_mutex_unlock(&UT_LOAD_LOCK)) {
+    if (ut_rwmutex_unlock(&UT_LOAD_LOCK)) {
         ut_throw(NULL);
     }
     return NULL;
@@ -615,7 +764,7 @@ void ut_locate_reset(
 {
     struct ut_loaded *loaded = NULL;
 
-    ut_try ( ut_mutex_lock(&UT_LOAD_LOCK), NULL);
+    ut_try ( ut_rwmutex_write(&UT_LOAD_LOCK), NULL);
 
     loaded = ut_loaded_find(package);
     if (loaded) {
@@ -646,7 +795,7 @@ void ut_locate_reset(
         }
     }
 
-    ut_try ( ut_mutex_unlock(&UT_LOAD_LOCK), NULL);
+    ut_try ( ut_rwmutex_unlock(&UT_LOAD_LOCK), NULL);
 
     return;
 error:
@@ -681,7 +830,7 @@ struct ut_fileHandler* ut_load_filehandler(
         sprintf(extPackage, "driver.ext.%s", ext);
 
         ut_try(
-            ut_mutex_unlock(&UT_LOAD_LOCK), NULL);
+            ut_rwmutex_unlock(&UT_LOAD_LOCK), NULL);
 
         /* Try to load the extension package */
         if (ut_use(extPackage, 0, NULL)) {
@@ -692,7 +841,7 @@ struct ut_fileHandler* ut_load_filehandler(
             goto error;
         }
         ut_try (
-            ut_mutex_lock(&UT_LOAD_LOCK), NULL);
+            ut_rwmutex_write(&UT_LOAD_LOCK), NULL);
 
         /* Extension package should have registered the extension in the
          * cortomain function, so try loading again. */
@@ -702,7 +851,7 @@ struct ut_fileHandler* ut_load_filehandler(
                 "package 'driver.ext.%s' loaded but extension is not registered",
                 ext);
             ut_try(
-                ut_mutex_unlock(&UT_LOAD_LOCK), NULL);
+                ut_rwmutex_unlock(&UT_LOAD_LOCK), NULL);
             goto error;
         }
     }
@@ -727,7 +876,7 @@ int ut_load_intern(
     ut_log_push(strarg("load:%s", file));
 
     ut_try(
-        ut_mutex_lock(&UT_LOAD_LOCK), NULL);
+        ut_rwmutex_write(&UT_LOAD_LOCK), NULL);
 
     /* Check if file is added to admin */
     struct ut_loaded *loaded_admin = ut_loaded_find(file);
@@ -752,7 +901,7 @@ int ut_load_intern(
             /* Need to unlock, as other thread will try to relock after the file
              * handler is executed. */
             ut_try(
-                ut_mutex_unlock(&UT_LOAD_LOCK), NULL);
+                ut_rwmutex_unlock(&UT_LOAD_LOCK), NULL);
 
             while (loaded_admin->loading) {
                 ut_sleep(0, 100000000);
@@ -760,7 +909,7 @@ int ut_load_intern(
 
             /* Relock, so we can safely inspect & modify the admin again. */
             ut_try(
-                ut_mutex_lock(&UT_LOAD_LOCK), NULL);
+                ut_rwmutex_write(&UT_LOAD_LOCK), NULL);
 
             /* Keep looping until we have the lock and there is no other thread
              * currently loading this file */
@@ -781,14 +930,14 @@ int ut_load_intern(
 
         /* Unlock, so file handler can load other files without deadlocking */
         ut_try(
-            ut_mutex_unlock(&UT_LOAD_LOCK), NULL);
+            ut_rwmutex_unlock(&UT_LOAD_LOCK), NULL);
 
         /* Load file */
         result = h->load((char*)file, argc, argv, h->userData);
 
         /* Relock admin to update */
         ut_try(
-            ut_mutex_lock(&UT_LOAD_LOCK), NULL);
+            ut_rwmutex_write(&UT_LOAD_LOCK), NULL);
 
         /* Set loaded to 1 if success, or -1 if failed */
         loaded_admin->loaded = result ? -1 : 1;
@@ -802,7 +951,7 @@ int ut_load_intern(
     }
 
     ut_try(
-        ut_mutex_unlock(&UT_LOAD_LOCK), NULL);
+        ut_rwmutex_unlock(&UT_LOAD_LOCK), NULL);
 
     if (!result) {
         if (loaded_by_me) {
@@ -835,7 +984,7 @@ recursive:
         free(str);
     }
     ut_try(
-        ut_mutex_unlock(&UT_LOAD_LOCK), NULL);
+        ut_rwmutex_unlock(&UT_LOAD_LOCK), NULL);
 
     if (ignore_recursive) {
         ut_log_pop();
@@ -967,7 +1116,7 @@ int ut_load_register(
 
     /* Check if extension is already registered */
     ut_try(
-        ut_mutex_lock(&UT_LOAD_LOCK), NULL);
+        ut_rwmutex_write(&UT_LOAD_LOCK), NULL);
 
     if ((h = ut_lookupExt(ext))) {
         if (h->load != handler) {
@@ -992,7 +1141,7 @@ int ut_load_register(
     }
 
     ut_try(
-        ut_mutex_unlock(&UT_LOAD_LOCK), NULL);
+        ut_rwmutex_unlock(&UT_LOAD_LOCK), NULL);
 
     return 0;
 error:
@@ -1117,8 +1266,13 @@ void ut_load_unload(
              free(loaded);
          }
          ut_ll_free(loadedAdmin);
+         loadedAdmin = NULL;
     }
 
+    free(loadedIndex);
+    loadedIndex = NULL;
+    loadedIndexSize = 0;
+
     /* Free handlers */
     if (fileHandlers) {
         while ((h = ut_ll_takeFirst(fileHandlers))) {
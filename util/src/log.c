@@ -66,6 +66,13 @@ typedef struct ut_log_handler {
 
 static ut_log_handler log_handler;
 
+typedef struct ut_log_scope_handler {
+    void *ctx;
+    ut_log_scope_cb cb;
+} ut_log_scope_handler;
+
+static ut_log_scope_handler log_scope_handler;
+
 /* These global variables are shared across threads and are *not* protected by
  * a mutex. Libraries should not invoke functions that touch these, and an
  * application should set them during startup. */
@@ -162,6 +169,14 @@ bool ut_log_handlerRegistered(void) {
     return log_handler.cb != NULL;
 }
 
+void ut_log_scopeHandlerRegister(
+    ut_log_scope_cb callback,
+    void *ctx)
+{
+    log_scope_handler.cb = callback;
+    log_scope_handler.ctx = ctx;
+}
+
 void ut_err_notifyCallkback(
     ut_log_verbosity level,
     char *msg)
@@ -1351,6 +1366,10 @@ int _ut_log_push(
 
     data->sp ++;
 
+    if (log_scope_handler.cb) {
+        log_scope_handler.cb(category, true, log_scope_handler.ctx);
+    }
+
     return -1;
 }
 
@@ -1387,6 +1406,10 @@ void _ut_log_pop(
                 false);
         }
 
+        if (log_scope_handler.cb) {
+            log_scope_handler.cb(frame->category, false, log_scope_handler.ctx);
+        }
+
         if (frame->initial.file) free(frame->initial.file);
         if (frame->initial.function) free(frame->initial.function);
         if (frame->category) free(frame->category);
@@ -19,7 +19,17 @@
  * THE SOFTWARE.
  */
 
+/* The directory walker uses openat, fdopendir and the d_type field of directory
+ * entries, which are not part of the XSI feature set bake is compiled with */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#ifndef _DARWIN_C_SOURCE
+#define _DARWIN_C_SOURCE
+#endif
+
 #include <bake_util.h>
+#include <utime.h>
 
 static
 bool ut_checklink(
@@ -65,6 +75,8 @@ int ut_symlink(
 
     ut_trace("#[cyan]symlink %s %s", newname, fullname);
 
+    ut_stat_invalidate(newname);
+
     if (symlink(fullname, newname)) {
 
         if (errno == ENOENT) {
@@ -139,13 +151,25 @@ int16_t ut_getperm(
 
 bool ut_isdir(const char *path) {
     struct stat buff;
-    if (stat(path, &buff) < 0) {
+    if (ut_stat(path, &buff) < 0) {
         return 0;
     }
     return S_ISDIR(buff.st_mode) ? true : false;
 }
 
+int16_t ut_setlastmodified(const char *name) {
+    ut_stat_invalidate(name);
+    if (utime(name, NULL)) {
+        ut_throw("failed to set modified time of '%s': %s",
+            name, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
 int ut_rename(const char *oldName, const char *newName) {
+    ut_stat_invalidate(oldName);
+    ut_stat_invalidate(newName);
 
     if (rename(oldName, newName)) {
         ut_throw("failed to move %s %s: %s",
@@ -161,6 +185,8 @@ error:
 int ut_rm(const char *name) {
     int result = 0;
 
+    ut_stat_invalidate(name);
+
     /* First try to remove file. The 'remove' function may fail if 'name' is a
     * directory that is not empty, however it may also be a link to a directory
     * in which case ut_isdir would also return true.
@@ -217,6 +243,8 @@ error:
 
 /* Recursively remove a directory */
 int ut_rmtree(const char *name) {
+    /* Files in the directory may be cached */
+    ut_stat_invalidate(NULL);
     return nftw(name, ut_rmtreeCallback, 20, FTW_DEPTH | FTW_PHYS);
 }
 
@@ -271,4 +299,145 @@ void ut_dir_release(
     closedir(it->ctx);
 }
 
+typedef struct ut_dir_walker {
+    const char *root;
+    bool recursive;
+    ut_dir_walk_cb on_file;
+    ut_dir_enter_cb on_enter;
+    void *ctx;
+    char *dir;              /* Current directory, relative to root */
+    size_t len;
+    size_t size;
+} ut_dir_walker;
+
+static
+bool ut_dir_walk_isdir(
+    DIR *dp,
+    struct dirent *ep)
+{
+#ifdef DT_DIR
+    if (ep->d_type == DT_DIR) {
+        return true;
+    }
+
+    /* Only stat when the file system does not report the type, or when the
+     * entry is a symbolic link that may point to a directory */
+    if (ep->d_type != DT_UNKNOWN && ep->d_type != DT_LNK) {
+        return false;
+    }
+#endif
+
+    struct stat st;
+    if (fstatat(dirfd(dp), ep->d_name, &st, 0)) {
+        return false;
+    }
+
+    return S_ISDIR(st.st_mode);
+}
+
+static
+int16_t ut_dir_walk_fd(
+    ut_dir_walker *w,
+    int fd)
+{
+    DIR *dp = fdopendir(fd);
+    if (!dp) {
+        ut_throw("%s"UT_OS_PS"%s: %s", w->root, w->dir, strerror(errno));
+        close(fd);
+        goto error;
+    }
+
+    struct dirent *ep;
+    while ((ep = readdir(dp))) {
+        const char *name = ep->d_name;
+        if (name[0] == '.' &&
+            (!name[1] || (name[1] == '.' && !name[2])))
+        {
+            continue;
+        }
+
+        bool is_dir = ut_dir_walk_isdir(dp, ep);
+
+        if (w->on_file(w->dir, name, is_dir, w->ctx)) {
+            goto stop;
+        }
+
+        if (!is_dir || !w->recursive) {
+            continue;
+        }
+
+        if (w->on_enter && !w->on_enter(w->dir, name, w->ctx)) {
+            continue;
+        }
+
+        int sub_fd = openat(
+            dirfd(dp), name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (sub_fd == -1) {
+            ut_throw("%s"UT_OS_PS"%s%s%s: %s", w->root, w->dir,
+                w->len ? UT_OS_PS : "", name, strerror(errno));
+            goto stop;
+        }
+
+        /* Append name of subdirectory to the current directory */
+        size_t len = w->len, name_len = strlen(name);
+        if (len + name_len + 2 > w->size) {
+            w->size = (len + name_len + 2) * 2;
+            w->dir = realloc(w->dir, w->size);
+        }
+        if (len) {
+            w->dir[w->len ++] = UT_OS_PS[0];
+        }
+        memcpy(&w->dir[w->len], name, name_len + 1);
+        w->len += name_len;
+
+        int16_t ret = ut_dir_walk_fd(w, sub_fd);
+
+        w->len = len;
+        w->dir[len] = '\0';
+
+        if (ret) {
+            goto stop;
+        }
+    }
+
+    closedir(dp);
+    return 0;
+stop:
+    closedir(dp);
+error:
+    return -1;
+}
+
+int16_t ut_dir_walk(
+    const char *name,
+    bool recursive,
+    ut_dir_walk_cb on_file,
+    ut_dir_enter_cb on_enter,
+    void *ctx)
+{
+    int fd = open(name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        ut_throw("%s: %s", name, strerror(errno));
+        return -1;
+    }
+
+    ut_dir_walker w = {
+        .root = name,
+        .recursive = recursive,
+        .on_file = on_file,
+        .on_enter = on_enter,
+        .ctx = ctx,
+        .size = 256
+    };
+
+    w.dir = malloc(w.size);
+    w.dir[0] = '\0';
+
+    int16_t ret = ut_dir_walk_fd(&w, fd);
+
+    free(w.dir);
+
+    return ret;
+}
+
 
@@ -20,24 +20,49 @@
  */
 
 #include <bake_util.h>
+#include <spawn.h>
+
+/* Processes are started with posix_spawn instead of fork + exec. Fork copies
+ * the page tables of the parent, which gets expensive when a process with a
+ * large heap (like bake, with all its drivers and projects loaded) starts
+ * thousands of compiler processes. posix_spawn lets the C library use vfork or
+ * clone(CLONE_VM), which do not copy the address space. */
+
+#ifdef __APPLE__
+#include <crt_externs.h>
+#define environ (*_NSGetEnviron())
+#else
+extern char **environ;
+#endif
+
+static
+ut_proc ut_proc_spawn(
+    const char *exec,
+    const char *argv[],
+    posix_spawn_file_actions_t *actions)
+{
+    pid_t pid = 0;
+
+    int err = posix_spawnp(
+        &pid, exec, actions, NULL, (char* const*)argv, environ);
+    if (err) {
+        ut_throw("failed to start process '%s'\n  cwd='%s'\n  err='%s'",
+            exec,
+            ut_cwd(),
+            strerror(err));
+        return 0;
+    }
+
+    return pid;
+}
 
 ut_proc ut_proc_run(
     const char* exec,
     const char *argv[])
 {
-    pid_t pid = fork();
+    pid_t pid = ut_proc_spawn(exec, argv, NULL);
 
-    if (pid == 0) {
-
-        /* Child process */
-        if (execvp(exec, (char**)argv)) {
-            ut_error("failed to start process '%s'\n  cwd='%s'\n  err='%s'",
-              exec,
-              ut_cwd(),
-              strerror(errno));
-            abort();
-        }
-    } else if (pid > 0) {
+    if (pid > 0) {
         /* Parent process */
         if (ut_log_verbosityGet() <= UT_TRACE) {
             ut_strbuf buff = UT_STRBUF_INIT;
@@ -54,13 +79,27 @@ ut_proc ut_proc_run(
             ut_trace("#[cyan]%s [%d]", str, pid);
             free(str);
         }
-    } else {
-        /* Failure */
     }
 
     return pid;
 }
 
+/* Redirect fd of child to file, or to /dev/null if file is NULL */
+static
+int ut_proc_redirect(
+    posix_spawn_file_actions_t *actions,
+    FILE *file,
+    int fd,
+    int flags)
+{
+    if (file) {
+        return posix_spawn_file_actions_adddup2(actions, fileno(file), fd);
+    } else {
+        return posix_spawn_file_actions_addopen(
+            actions, fd, "/dev/null", flags, 0);
+    }
+}
+
 ut_proc ut_proc_runRedirect(
     const char* exec,
     const char *argv[],
@@ -68,49 +107,44 @@ ut_proc ut_proc_runRedirect(
     FILE *out,
     FILE *err)
 {
-    pid_t pid = fork();
-
-    if (pid == 0) {
-        FILE *devnull = NULL;
-        if (!out || !err) {
-            devnull = fopen("/dev/null", "w");
-            if (!devnull) {
-                ut_error("failed to open /dev/null");
-                abort();
-            }
-        }
+    posix_spawn_file_actions_t actions;
+    pid_t pid = 0;
 
-        if (dup2(fileno(out ? out : devnull), STDOUT_FILENO) < 0) {
-            ut_error("failed to redirect stdout for '%s': %s", exec, strerror(errno));
-            abort();
-        }
-        if (out && (err != stdout)) fclose(out);
-
-        if (dup2(fileno(err ? err : devnull), STDERR_FILENO) < 0) {
-            ut_error("failed to redirect stderr for '%s': %s", exec, strerror(errno));
-            abort();
-        }
+    if (posix_spawn_file_actions_init(&actions)) {
+        ut_throw("failed to redirect output for '%s'", exec);
+        return 0;
+    }
 
-        if (err && (err != stderr)) fclose(err);
-        if (devnull) fclose(devnull);
+    if (ut_proc_redirect(&actions, out, STDOUT_FILENO, O_WRONLY) ||
+        ut_proc_redirect(&actions, err, STDERR_FILENO, O_WRONLY) ||
+        ut_proc_redirect(&actions, in, STDIN_FILENO, O_RDONLY))
+    {
+        ut_throw("failed to redirect output for '%s'", exec);
+        goto error;
+    }
 
-        if (dup2(fileno(in), STDIN_FILENO) < 0) {
-            ut_error("failed to redirect stdin for '%s': %s", exec, strerror(errno));
-            abort();
+    /* Don't leak the original descriptors of redirected files into the child */
+    int fds[3] = {
+        in ? fileno(in) : -1,
+        out ? fileno(out) : -1,
+        err ? fileno(err) : -1
+    };
+    int i, j;
+    for (i = 0; i < 3; i ++) {
+        bool closed = fds[i] <= STDERR_FILENO;
+        for (j = 0; j < i && !closed; j ++) {
+            closed = fds[j] == fds[i];
         }
-        if (in && (in != stdin)) fclose(in);
-
-        /* Child process */
-        if (execvp(exec, (char**)argv)) {
-            ut_error("failed to start process '%s'", exec);
-            abort();
+        if (!closed && posix_spawn_file_actions_addclose(&actions, fds[i])) {
+            ut_throw("failed to redirect output for '%s'", exec);
+            goto error;
         }
-    } else if (pid > 0) {
-        /* Parent process */
-    } else {
-        /* Failure */
     }
 
+    pid = ut_proc_spawn(exec, argv, &actions);
+
+error:
+    posix_spawn_file_actions_destroy(&actions);
     return pid;
 }
 
@@ -136,6 +170,9 @@ int ut_proc_wait(ut_proc pid, int8_t *rc) {
         }
     } while (retry);
 
+    /* The process may have changed any file */
+    ut_stat_invalidate(NULL);
+
     if (WIFSIGNALED(status)) {
         result = WTERMSIG(status);
     } else {
@@ -160,7 +197,13 @@ int ut_proc_check(ut_proc pid, int8_t *rc) {
     result = waitpid(pid, &status, WNOHANG);
     if (!result) {
         /* Process did not change state, still running */
-    } else if (WIFSIGNALED(status)) {
+        return 0;
+    }
+
+    /* The process may have changed any file */
+    ut_stat_invalidate(NULL);
+
+    if (WIFSIGNALED(status)) {
         /* Process exited with a signal */
         result = WTERMSIG(status);
     } else {
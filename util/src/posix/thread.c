@@ -162,6 +162,25 @@ int ut_mutex_new(
     return result;
 }
 
+int ut_mutex_new_recursive(
+    struct ut_mutex_s *m)
+{
+    pthread_mutexattr_t attr;
+    int result;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    if ((result = pthread_mutex_init (&m->mutex, &attr))) {
+#ifdef NDEBUG
+        ut_throw("mutex_new failed: %s", strerror(result));
+#else
+        ut_critical("mutex_new failed: %s", strerror(result));
+#endif
+    }
+    pthread_mutexattr_destroy(&attr);
+    return result;
+}
+
 int ut_mutex_lock(
     ut_mutex mutex)
 {
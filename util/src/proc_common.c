@@ -21,80 +21,148 @@
 
 #include <bake_util.h>
 
-#define BUFFER_SIZE (256)
-
-/* Simple blocking function to create and wait for a process */
+/* Run process with arguments, and wait for it to exit */
 static
-int ut_proc_cmd_intern(
-    char* cmd,
+int ut_proc_argv_intern(
+    const char *argv[],
     int8_t *rc,
-    bool stderr_only)
+    bool redirect,
+    FILE *out,
+    FILE *err,
+    ut_proc *pid_out)
 {
-    ut_proc pid;
-    const char *args[UT_MAX_CMD_ARGS];
-    char stack_buffer[BUFFER_SIZE];
-    char *buffer = stack_buffer;
-
-    int len = strlen(cmd);
-    if (len >= BUFFER_SIZE) {
-        buffer = malloc(len + 1);
+    ut_proc pid = 0;
+
+    if (redirect) {
+        pid = ut_proc_runRedirect(argv[0], argv, stdin, out, err);
+    } else {
+        pid = ut_proc_run(argv[0], argv);
     }
 
-    strcpy(buffer, cmd);
-
-    /* Split up commands */
-    char ch, *ptr;
-    uint8_t argCount = 0;
-    bool newArg = false;
-    bool isString = false;
-    args[argCount] = buffer;
-    for (ptr = buffer; (ch = *ptr); ptr++) {
-        if (ch == '"') {
-            if (isspace(ptr[-1])) {
-                *ptr = '\0';
+    if (pid_out) *pid_out = pid;
+
+    if (!pid) {
+        return -1;
+    }
+
+    return ut_proc_wait(pid, rc);
+}
+
+/* Split command into arguments. Arguments are separated by whitespace, unless
+ * the whitespace is between double quotes. Quotes around an argument are
+ * removed, while quotes inside an argument (as in -DFOO="bar") are passed to
+ * the process as-is. The arguments point into buffer, which is modified. */
+static
+const char** ut_proc_split(
+    char *buffer)
+{
+    int32_t count = 0, size = 16;
+    const char **args = malloc(size * sizeof(char*));
+    char *ptr = buffer;
+
+    while (*ptr) {
+        while (isspace(*ptr)) {
+            ptr ++;
+        }
+        if (!*ptr) {
+            break;
+        }
+
+        /* Keep space for terminating NULL */
+        if (count == size - 1) {
+            size *= 2;
+            args = realloc(args, size * sizeof(char*));
+        }
+
+        char *out = ptr;
+        args[count ++] = out;
+
+        if (*ptr == '"') {
+            /* Quoted argument, copy everything up to the closing quote */
+            ptr ++;
+            while (*ptr && *ptr != '"') {
+                *out++ = *ptr++;
             }
-            isString = !isString;
-            if (!isString) {
-                newArg = true;
+            if (*ptr) {
+                ptr ++;
             }
-        } else
-        if (!isString && isspace(ch)) {
-            *ptr = '\0';
-            newArg = true;
-        } else if (newArg) {
-            args[++argCount] = ptr;
-            newArg = false;
         }
-    }
-    args[argCount + 1] = NULL;
-
-    if (stderr_only) {
-        if (!(pid = ut_proc_runRedirect(
-            args[0],
-            args,
-            stdin,
-            NULL,
-            stderr)))
-        {
-            goto error;
+
+        bool quoted = false;
+        while (*ptr && (quoted || !isspace(*ptr))) {
+            if (*ptr == '"') {
+                quoted = !quoted;
+            }
+            *out++ = *ptr++;
         }
-    } else {
-        if (!(pid = ut_proc_run(args[0], args))) {
-            goto error;
+
+        if (*ptr) {
+            ptr ++;
         }
+        *out = '\0';
     }
 
-    if (buffer != stack_buffer) free(buffer);
-    return ut_proc_wait(pid, rc);
-error:
-    if (buffer != stack_buffer) free(buffer);
-    return -1;
+    args[count] = NULL;
+
+    return args;
+}
+
+/* Simple blocking function to create and wait for a process */
+static
+int ut_proc_cmd_intern(
+    char* cmd,
+    int8_t *rc,
+    bool redirect,
+    FILE *out,
+    FILE *err,
+    ut_proc *pid_out)
+{
+    char *buffer = ut_strdup(cmd);
+    const char **args = ut_proc_split(buffer);
+    int result;
+
+    if (!args[0]) {
+        ut_throw("empty command");
+        if (pid_out) *pid_out = 0;
+        result = -1;
+    } else {
+        result = ut_proc_argv_intern(args, rc, redirect, out, err, pid_out);
+    }
+
+    free(args);
+    free(buffer);
+
+    return result;
 }
 
 int ut_proc_cmd(char* cmd, int8_t *rc) {
-    return ut_proc_cmd_intern(cmd, rc, false);
+    return ut_proc_cmd_intern(cmd, rc, false, NULL, NULL, NULL);
 }
 
 int ut_proc_cmd_stderr_only(char* cmd, int8_t *rc) {
-    return ut_proc_cmd_intern(cmd, rc, true);
+    return ut_proc_cmd_intern(cmd, rc, true, NULL, stderr, NULL);
+}
+
+int ut_proc_cmd_redirect(char* cmd, int8_t *rc, FILE *out, FILE *err) {
+    return ut_proc_cmd_intern(cmd, rc, true, out, err, NULL);
+}
+
+int ut_proc_cmd_pid(
+    char* cmd,
+    int8_t *rc,
+    FILE *out,
+    FILE *err,
+    ut_proc *pid_out)
+{
+    return ut_proc_cmd_intern(cmd, rc, out || err, out, err, pid_out);
+}
+
+int ut_proc_cmd_argv(
+    const char *argv[],
+    int8_t *rc,
+    FILE *out,
+    FILE *err,
+    ut_proc *pid_out)
+{
+    return ut_proc_argv_intern(argv, rc, out || err, out, err, pid_out);
 }
@@ -0,0 +1,167 @@
+/* Copyright (c) 2010-2019 Sander Mertens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <bake_util.h>
+
+/* The stat cache stores the result of stat for each path, so that a path that
+ * is tested many times during a build (like a header that is included by many
+ * sources) is only read once. Invalidating all paths increments a generation
+ * counter, so that a stat that was started before the invalidation is not
+ * stored in the cache after it. */
+
+typedef struct ut_stat_entry {
+    char *name;
+    int error;              /* errno of stat, 0 if success */
+    struct stat buf;
+} ut_stat_entry;
+
+static struct {
+    bool enabled;
+    struct ut_mutex_s lock;
+    ut_rb entries;
+    uint64_t generation;
+    uint64_t hits;
+    uint64_t misses;
+} ut_stat_cache;
+
+static
+int ut_stat_compare(
+    void *ctx,
+    const void* key1,
+    const void* key2)
+{
+    return strcmp(key1, key2);
+}
+
+static
+void ut_stat_clear(void)
+{
+    ut_iter it = ut_rb_iter(ut_stat_cache.entries);
+    while (ut_iter_hasNext(&it)) {
+        ut_stat_entry *entry = ut_iter_next(&it);
+        free(entry->name);
+        free(entry);
+    }
+    ut_rb_free(ut_stat_cache.entries);
+    ut_stat_cache.entries = ut_rb_new(ut_stat_compare, NULL);
+}
+
+int ut_stat(
+    const char *name,
+    struct stat *buf)
+{
+    if (!ut_stat_cache.enabled) {
+        return stat(name, buf);
+    }
+
+    ut_mutex_lock(&ut_stat_cache.lock);
+    ut_stat_entry *entry = ut_rb_find(ut_stat_cache.entries, name);
+    if (entry) {
+        int error = entry->error;
+        *buf = entry->buf;
+        ut_stat_cache.hits ++;
+        ut_mutex_unlock(&ut_stat_cache.lock);
+
+        if (error) {
+            errno = error;
+            return -1;
+        }
+        return 0;
+    }
+
+    uint64_t generation = ut_stat_cache.generation;
+    ut_stat_cache.misses ++;
+    ut_mutex_unlock(&ut_stat_cache.lock);
+
+    int result = stat(name, buf);
+    int error = result ? errno : 0;
+
+    ut_mutex_lock(&ut_stat_cache.lock);
+    if (generation == ut_stat_cache.generation &&
+        !ut_rb_find(ut_stat_cache.entries, name))
+    {
+        entry = malloc(sizeof(ut_stat_entry));
+        entry->name = ut_strdup(name);
+        entry->error = error;
+        entry->buf = *buf;
+        ut_rb_set(ut_stat_cache.entries, entry->name, entry);
+    }
+    ut_mutex_unlock(&ut_stat_cache.lock);
+
+    errno = error;
+
+    return result;
+}
+
+void ut_stat_cache_enable(
+    bool enable)
+{
+    if (enable && !ut_stat_cache.entries) {
+        ut_mutex_new(&ut_stat_cache.lock);
+        ut_stat_cache.entries = ut_rb_new(ut_stat_compare, NULL);
+    }
+
+    if (!enable && ut_stat_cache.entries) {
+        ut_mutex_lock(&ut_stat_cache.lock);
+        ut_stat_cache.generation ++;
+        ut_stat_clear();
+        ut_mutex_unlock(&ut_stat_cache.lock);
+    }
+
+    ut_stat_cache.enabled = enable;
+}
+
+void ut_stat_invalidate(
+    const char *name)
+{
+    if (!ut_stat_cache.enabled) {
+        return;
+    }
+
+    ut_mutex_lock(&ut_stat_cache.lock);
+    if (!name) {
+        ut_stat_cache.generation ++;
+        ut_stat_clear();
+    } else {
+        ut_stat_entry *entry = ut_rb_find(ut_stat_cache.entries, name);
+        if (entry) {
+            ut_rb_remove(ut_stat_cache.entries, entry->name);
+            free(entry->name);
+            free(entry);
+        }
+
+        /* A stat of the path may be in progress */
+        ut_stat_cache.generation ++;
+    }
+    ut_mutex_unlock(&ut_stat_cache.lock);
+}
+
+void ut_stat_cache_stats(
+    uint64_t *hits_out,
+    uint64_t *misses_out)
+{
+    if (hits_out) {
+        *hits_out = ut_stat_cache.hits;
+    }
+    if (misses_out) {
+        *misses_out = ut_stat_cache.misses;
+    }
+}
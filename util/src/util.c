@@ -26,7 +26,7 @@ int8_t UT_LOG_BACKTRACE = 0;
 
 /* Lock to protect global administration related to logging framework */
 ut_mutex_s ut_log_lock;
-ut_mutex_s UT_LOAD_LOCK;
+ut_rwmutex_s UT_LOAD_LOCK;
 
 extern const char *ut_log_appName;
 
@@ -41,7 +41,7 @@ void ut_init(
         ut_critical("failed to create mutex for logging framework");
     }
 
-    if (ut_mutex_new(&UT_LOAD_LOCK)) {
+    if (ut_rwmutex_new(&UT_LOAD_LOCK)) {
         ut_critical("failed to create mutex for package loader");
     }
 
@@ -104,7 +104,7 @@ void ut_deinit(void) {
         ut_critical("failed to delete mutex for logging framework");
     }
 
-    if (ut_mutex_free(&UT_LOAD_LOCK)) {
+    if (ut_rwmutex_free(&UT_LOAD_LOCK)) {
         ut_critical("failed to delete mutex for package loader");
     }    
 }
@@ -0,0 +1,587 @@
+/* Copyright (c) 2010-2019 Sander Mertens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <bake_util.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
+
+/* Interval at which timestamps are checked when polling */
+#define UT_WATCH_POLL_INTERVAL (1000)
+
+/* Time without changes after which a series of changes is reported */
+#define UT_WATCH_SETTLE_TIME (20)
+
+struct ut_watch_s {
+    char *path;
+    ut_watch_filter_cb filter;
+    void *ctx;
+
+    int fd;                 /* Inotify descriptor, -1 when polling */
+    ut_rb dirs;             /* Watched directories by watch descriptor */
+
+    ut_rb files;            /* Timestamps of files by path, when polling */
+    uint64_t last_scan;     /* Time of last poll (in ms) */
+};
+
+static
+uint64_t ut_watch_now(void)
+{
+    struct timespec now;
+    timespec_gettime(&now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static
+bool ut_watch_filter(
+    ut_watch watch,
+    const char *file,
+    bool is_dir)
+{
+    if (!watch->filter) {
+        return true;
+    }
+    return watch->filter(file, is_dir, watch->ctx);
+}
+
+static
+int ut_watch_strcmp(
+    void *ctx,
+    const void* key1,
+    const void* key2)
+{
+    return strcmp(key1, key2);
+}
+
+/* -- Polling -- */
+
+typedef struct ut_watch_file {
+    char *path;
+    time_t modified;
+} ut_watch_file;
+
+static
+void ut_watch_free_files(
+    ut_rb files)
+{
+    if (files) {
+        ut_iter it = ut_rb_iter(files);
+        while (ut_iter_hasNext(&it)) {
+            ut_watch_file *file = ut_iter_next(&it);
+            free(file->path);
+            free(file);
+        }
+        ut_rb_free(files);
+    }
+}
+
+typedef struct ut_watch_scanner {
+    ut_watch watch;
+    ut_rb files;
+    int32_t changes;
+} ut_watch_scanner;
+
+/* Skip directories that are filtered out, including their contents */
+static
+bool ut_watch_scan_enter(
+    const char *dir,
+    const char *name,
+    void *ctx)
+{
+    ut_watch_scanner *s = ctx;
+    char *sub = dir[0]
+        ? ut_asprintf("%s"UT_OS_PS"%s", dir, name)
+        : ut_strdup(name);
+    bool result = ut_watch_filter(s->watch, sub, true);
+    free(sub);
+    return result;
+}
+
+static
+int16_t ut_watch_scan_file(
+    const char *dir,
+    const char *name,
+    bool is_dir,
+    void *ctx)
+{
+    ut_watch_scanner *s = ctx;
+    ut_watch watch = s->watch;
+
+    if (is_dir) {
+        return 0;
+    }
+
+    char *file = dir[0]
+        ? ut_asprintf("%s"UT_OS_PS"%s", dir, name)
+        : ut_strdup(name);
+
+    if (!ut_watch_filter(watch, file, false)) {
+        free(file);
+        return 0;
+    }
+
+    char *path = ut_asprintf("%s"UT_OS_PS"%s", watch->path, file);
+    time_t modified = ut_lastmodified(path);
+    if (modified == -1) {
+        /* File may have been removed since directory was read */
+        ut_catch();
+        free(file);
+    } else {
+        ut_watch_file *f = ut_calloc(sizeof(ut_watch_file));
+        f->path = file;
+        f->modified = modified;
+        ut_rb_set(s->files, f->path, f);
+
+        if (watch->files) {
+            ut_watch_file *old = ut_rb_find(watch->files, f->path);
+            if (!old || old->modified != modified) {
+                ut_trace("detected change in '%s'", path);
+                s->changes ++;
+            }
+        }
+    }
+
+    free(path);
+
+    return 0;
+}
+
+/* Collect timestamps of files, return number of changes since last scan */
+static
+int32_t ut_watch_scan(
+    ut_watch watch)
+{
+    ut_watch_scanner s = {
+        .watch = watch,
+        .files = ut_rb_new(ut_watch_strcmp, NULL)
+    };
+    ut_iter it;
+
+    watch->last_scan = ut_watch_now();
+
+    /* Read timestamps from the file system, not from the stat cache */
+    ut_stat_invalidate(NULL);
+
+    if (ut_dir_walk(watch->path, true,
+        ut_watch_scan_file, ut_watch_scan_enter, &s))
+    {
+        ut_watch_free_files(s.files);
+        return -1;
+    }
+
+    /* Files that are no longer there have been removed */
+    if (watch->files) {
+        it = ut_rb_iter(watch->files);
+        while (ut_iter_hasNext(&it)) {
+            ut_watch_file *old = ut_iter_next(&it);
+            if (!ut_rb_find(s.files, old->path)) {
+                ut_trace("detected removal of '%s'", old->path);
+                s.changes ++;
+            }
+        }
+    }
+
+    ut_watch_free_files(watch->files);
+    watch->files = s.files;
+
+    return s.changes;
+}
+
+static
+int32_t ut_watch_poll(
+    ut_watch watch,
+    int32_t timeout)
+{
+    uint64_t start = ut_watch_now();
+
+    do {
+        uint64_t now = ut_watch_now();
+        uint64_t next_scan = watch->last_scan + UT_WATCH_POLL_INTERVAL;
+
+        if (now >= next_scan) {
+            int32_t changes = ut_watch_scan(watch);
+            if (changes) {
+                return changes;
+            }
+            next_scan = watch->last_scan + UT_WATCH_POLL_INTERVAL;
+        }
+
+        /* Sleep until next scan, or until timeout expires */
+        uint64_t wake = next_scan;
+        if (timeout != -1 && start + timeout < wake) {
+            wake = start + timeout;
+        }
+        if (wake > now) {
+            uint64_t ms = wake - now;
+            ut_sleep(ms / 1000, (ms % 1000) * 1000000);
+        }
+    } while (timeout == -1 || ut_watch_now() < start + timeout);
+
+    return 0;
+}
+
+/* -- Inotify -- */
+
+#ifdef __linux__
+
+static
+int ut_watch_intcmp(
+    void *ctx,
+    const void* key1,
+    const void* key2)
+{
+    intptr_t i1 = (intptr_t)key1, i2 = (intptr_t)key2;
+    return (i1 > i2) - (i1 < i2);
+}
+
+static
+void ut_watch_free_tree(
+    ut_rb tree)
+{
+    if (tree) {
+        ut_iter it = ut_rb_iter(tree);
+        while (ut_iter_hasNext(&it)) {
+            free(ut_iter_next(&it));
+        }
+        ut_rb_free(tree);
+    }
+}
+
+static
+int16_t ut_watch_add_dir(
+    ut_watch watch,
+    const char *dir)
+{
+    char *path = dir[0]
+        ? ut_asprintf("%s"UT_OS_PS"%s", watch->path, dir)
+        : ut_strdup(watch->path);
+
+    int wd = inotify_add_watch(watch->fd, path,
+        IN_CREATE | IN_DELETE | IN_MODIFY | IN_MOVED_FROM | IN_MOVED_TO |
+        IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE_SELF);
+    if (wd == -1) {
+        ut_throw("cannot watch '%s' (%s)", path, strerror(errno));
+        free(path);
+        goto error;
+    }
+
+    /* If the directory was already watched, the same descriptor is returned */
+    char *old = ut_rb_find(watch->dirs, (void*)(intptr_t)wd);
+    ut_rb_set(watch->dirs, (void*)(intptr_t)wd, ut_strdup(dir));
+    free(old);
+
+    ut_ll files = ut_opendir(path);
+    free(path);
+    if (!files) {
+        /* Directory may have been removed in the meantime */
+        ut_catch();
+        return 0;
+    }
+
+    ut_iter it = ut_ll_iter(files);
+    while (ut_iter_hasNext(&it)) {
+        char *file = ut_iter_next(&it);
+        char *sub = dir[0]
+            ? ut_asprintf("%s"UT_OS_PS"%s", dir, file)
+            : ut_strdup(file);
+        char *sub_path = ut_asprintf("%s"UT_OS_PS"%s", watch->path, sub);
+
+        if (ut_isdir(sub_path) && ut_watch_filter(watch, sub, true)) {
+            if (ut_watch_add_dir(watch, sub)) {
+                free(sub);
+                free(sub_path);
+                ut_closedir(files);
+                goto error;
+            }
+        }
+
+        free(sub);
+        free(sub_path);
+    }
+
+    ut_closedir(files);
+
+    return 0;
+error:
+    return -1;
+}
+
+static
+void ut_watch_close(
+    ut_watch watch)
+{
+    if (watch->fd != -1) {
+        close(watch->fd);
+        watch->fd = -1;
+    }
+    ut_watch_free_tree(watch->dirs);
+    watch->dirs = NULL;
+}
+
+/* Watch the directory tree with inotify. If that is not possible, fall back
+ * to polling. */
+static
+void ut_watch_init(
+    ut_watch watch)
+{
+    ut_watch_close(watch);
+
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fd == -1) {
+        ut_trace("inotify not available (%s), polling '%s'",
+            strerror(errno), watch->path);
+        goto poll;
+    }
+
+    watch->dirs = ut_rb_new(ut_watch_intcmp, NULL);
+
+    if (ut_watch_add_dir(watch, "")) {
+        ut_raise();
+        ut_trace("polling '%s'", watch->path);
+        ut_watch_close(watch);
+        goto poll;
+    }
+
+    return;
+poll:
+    ut_watch_scan(watch);
+}
+
+/* Read pending events, return number of events for files that are watched */
+static
+int32_t ut_watch_read(
+    ut_watch watch)
+{
+    char buffer[4096]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    int32_t changes = 0;
+    bool overflow = false;
+    ssize_t len;
+
+    while ((len = read(watch->fd, buffer, sizeof(buffer))) > 0) {
+        char *ptr = buffer;
+        while (ptr < buffer + len) {
+            struct inotify_event *event = (struct inotify_event*)ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                overflow = true;
+                continue;
+            }
+
+            const char *dir = ut_rb_find(
+                watch->dirs, (void*)(intptr_t)event->wd);
+            if (!dir) {
+                continue;
+            }
+
+            if (event->mask & IN_IGNORED) {
+                ut_rb_remove(watch->dirs, (void*)(intptr_t)event->wd);
+                free((char*)dir);
+                continue;
+            }
+
+            if (!event->len) {
+                /* Event for the watched directory itself */
+                if (event->mask & IN_DELETE_SELF) {
+                    changes ++;
+                }
+                continue;
+            }
+
+            char *file = dir[0]
+                ? ut_asprintf("%s"UT_OS_PS"%s", dir, event->name)
+                : ut_strdup(event->name);
+            bool is_dir = event->mask & IN_ISDIR;
+
+            if (ut_watch_filter(watch, file, is_dir)) {
+                ut_trace("detected change in '%s'", file);
+                changes ++;
+
+                /* Watch new directories */
+                if (is_dir && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+                    if (ut_watch_add_dir(watch, file)) {
+                        ut_raise();
+                        overflow = true;
+                    }
+                }
+            }
+
+            free(file);
+        }
+    }
+
+    /* Events were lost, so new directories may not be watched */
+    if (overflow) {
+        ut_watch_init(watch);
+        changes ++;
+    }
+
+    return changes;
+}
+
+static
+int32_t ut_watch_notify(
+    ut_watch watch,
+    int32_t timeout)
+{
+    uint64_t start = ut_watch_now();
+    int32_t changes = 0;
+
+    do {
+        int32_t remaining = -1;
+        if (timeout != -1) {
+            uint64_t elapsed = ut_watch_now() - start;
+            remaining = elapsed < (uint64_t)timeout ? timeout - elapsed : 0;
+        }
+
+        struct pollfd pfd = {.fd = watch->fd, .events = POLLIN};
+        int count = poll(&pfd, 1, remaining);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ut_throw("poll failed (%s)", strerror(errno));
+            return -1;
+        }
+
+        if (count) {
+            changes = ut_watch_read(watch);
+            if (watch->fd == -1) {
+                /* Fell back to polling */
+                return changes;
+            }
+        }
+    } while (!changes && (timeout == -1 || ut_watch_now() < start + timeout));
+
+    /* Wait until changes settle */
+    if (changes) {
+        struct pollfd pfd = {.fd = watch->fd, .events = POLLIN};
+        while (poll(&pfd, 1, UT_WATCH_SETTLE_TIME) > 0) {
+            changes += ut_watch_read(watch);
+            if (watch->fd == -1) {
+                break;
+            }
+        }
+    }
+
+    return changes;
+}
+
+#else
+
+static
+void ut_watch_close(
+    ut_watch watch)
+{
+    (void)watch;
+}
+
+static
+void ut_watch_init(
+    ut_watch watch)
+{
+    watch->fd = -1;
+    ut_watch_scan(watch);
+}
+
+static
+int32_t ut_watch_read(
+    ut_watch watch)
+{
+    (void)watch;
+    return 0;
+}
+
+static
+int32_t ut_watch_notify(
+    ut_watch watch,
+    int32_t timeout)
+{
+    (void)watch;
+    (void)timeout;
+    return 0;
+}
+
+#endif
+
+/* -- Public API -- */
+
+ut_watch ut_watch_new(
+    const char *path,
+    ut_watch_filter_cb filter,
+    void *ctx)
+{
+    if (!ut_isdir(path)) {
+        ut_throw("cannot watch '%s': not a directory", path);
+        goto error;
+    }
+
+    ut_watch result = ut_calloc(sizeof(struct ut_watch_s));
+    result->path = ut_strdup(path);
+    result->filter = filter;
+    result->ctx = ctx;
+    result->fd = -1;
+
+    ut_watch_init(result);
+
+    return result;
+error:
+    return NULL;
+}
+
+void ut_watch_free(
+    ut_watch watch)
+{
+    ut_watch_close(watch);
+    ut_watch_free_files(watch->files);
+    free(watch->path);
+    free(watch);
+}
+
+int32_t ut_watch_wait(
+    ut_watch watch,
+    int32_t timeout)
+{
+    if (watch->fd != -1) {
+        return ut_watch_notify(watch, timeout);
+    } else {
+        return ut_watch_poll(watch, timeout);
+    }
+}
+
+void ut_watch_reset(
+    ut_watch watch)
+{
+    if (watch->fd != -1) {
+        ut_watch_read(watch);
+    } else {
+        ut_watch_scan(watch);
+    }
+}
+
+int ut_watch_fd(
+    ut_watch watch)
+{
+    return watch->fd;
+}
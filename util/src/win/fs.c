@@ -20,6 +20,7 @@
  */
 
 #include <bake_util.h>
+#include <sys/utime.h>
 
 int ut_symlink(
     const char *oldname,
@@ -68,10 +69,23 @@ bool ut_isdir(const char *path) {
     return PathIsDirectoryA(path);
 }
 
+int16_t ut_setlastmodified(const char *name) {
+    ut_stat_invalidate(name);
+    if (_utime(name, NULL)) {
+        ut_throw("failed to set modified time of '%s': %s",
+            name, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
 int ut_rename(const char *oldName, const char *newName) {
 
     ut_trace("#[cyan]rename %s %s", oldName, newName);
 
+    ut_stat_invalidate(oldName);
+    ut_stat_invalidate(newName);
+
     if (!_access_s(newName, 0))
         ut_rm(newName);
 
@@ -88,6 +102,8 @@ error:
 /* Remove a file. Returns 0 if OK, -1 if failed */
 int ut_rm(const char *name) {
 
+    ut_stat_invalidate(name);
+
     /* First try to remove file. The 'remove' function may fail if 'name' is a
     * directory that is not empty, however it may also be a link to a directory
     * in which case ut_isdir would also return true.
@@ -126,6 +142,10 @@ error:
 /* Recursively remove a directory */
 int ut_rmtree(const char *name) {
     char *fullname;
+
+    /* Files in the directory may be cached */
+    ut_stat_invalidate(NULL);
+
     if (ut_path_is_relative(name)) {
         fullname = ut_asprintf("%s"UT_OS_PS"%s", ut_cwd(), name);
         ut_path_clean(fullname, fullname);
@@ -253,3 +273,109 @@ void ut_dir_release(
     FindClose(ep->hFind);
 }
 
+
+typedef struct ut_dir_walker {
+    const char *root;
+    bool recursive;
+    ut_dir_walk_cb on_file;
+    ut_dir_enter_cb on_enter;
+    void *ctx;
+    char *dir;              /* Current directory, relative to root */
+    size_t len;
+    size_t size;
+} ut_dir_walker;
+
+static
+int16_t ut_dir_walk_dir(
+    ut_dir_walker *w)
+{
+    WIN32_FIND_DATA ffd;
+    char *pattern = w->len
+        ? ut_asprintf("%s\\%s\\*", w->root, w->dir)
+        : ut_asprintf("%s\\*", w->root);
+
+    HANDLE hFind = FindFirstFile(pattern, &ffd);
+    free(pattern);
+    if (hFind == INVALID_HANDLE_VALUE) {
+        ut_throw("%s\\%s: %s", w->root, w->dir, ut_last_win_error());
+        goto error;
+    }
+
+    do {
+        const char *name = ffd.cFileName;
+        if (name[0] == '.' &&
+            (!name[1] || (name[1] == '.' && !name[2])))
+        {
+            continue;
+        }
+
+        /* The type of the file is part of the find data */
+        bool is_dir = (ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+
+        if (w->on_file(w->dir, name, is_dir, w->ctx)) {
+            goto stop;
+        }
+
+        if (!is_dir || !w->recursive) {
+            continue;
+        }
+
+        if (w->on_enter && !w->on_enter(w->dir, name, w->ctx)) {
+            continue;
+        }
+
+        /* Append name of subdirectory to the current directory */
+        size_t len = w->len, name_len = strlen(name);
+        if (len + name_len + 2 > w->size) {
+            w->size = (len + name_len + 2) * 2;
+            w->dir = realloc(w->dir, w->size);
+        }
+        if (len) {
+            w->dir[w->len ++] = '\\';
+        }
+        memcpy(&w->dir[w->len], name, name_len + 1);
+        w->len += name_len;
+
+        int16_t ret = ut_dir_walk_dir(w);
+
+        w->len = len;
+        w->dir[len] = '\0';
+
+        if (ret) {
+            goto stop;
+        }
+    } while (FindNextFile(hFind, &ffd));
+
+    FindClose(hFind);
+    return 0;
+stop:
+    FindClose(hFind);
+error:
+    return -1;
+}
+
+int16_t ut_dir_walk(
+    const char *name,
+    bool recursive,
+    ut_dir_walk_cb on_file,
+    ut_dir_enter_cb on_enter,
+    void *ctx)
+{
+    ut_dir_walker w = {
+        .root = name,
+        .recursive = recursive,
+        .on_file = on_file,
+        .on_enter = on_enter,
+        .ctx = ctx,
+        .size = 256
+    };
+
+    w.dir = malloc(w.size);
+    w.dir[0] = '\0';
+
+    int16_t ret = ut_dir_walk_dir(&w);
+
+    free(w.dir);
+
+    return ret;
+}
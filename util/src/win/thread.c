@@ -166,6 +166,13 @@ int ut_mutex_new(
     return result;
 }
 
+/* Critical sections can be entered again by the thread that owns them */
+int ut_mutex_new_recursive(
+    struct ut_mutex_s *m)
+{
+    return ut_mutex_new(m);
+}
+
 int ut_mutex_lock(
     ut_mutex mutex)
 {